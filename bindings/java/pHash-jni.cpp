@@ -117,8 +117,11 @@ JNIEXPORT jdouble JNICALL Java_org_phash_pHash_imageDistance(JNIEnv *e,
         int N2 = e->GetArrayLength(h2);
         jbyte *hash = e->GetByteArrayElements(h, NULL);
         jbyte *hash2 = e->GetByteArrayElements(h2, NULL);
-        double hd =
-            ph_hammingdistance2((uint8_t *)hash, N, (uint8_t *)hash2, N2);
+        double hd = -1.0;
+        if (N == N2 && N > 0) {
+            int dist = ph_hamming_bytes((uint8_t *)hash, (uint8_t *)hash2, N);
+            hd = (double)dist / (N * 8);
+        }
         e->ReleaseByteArrayElements(h, hash, 0);
         e->ReleaseByteArrayElements(h2, hash2, 0);
         return hd;
@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <vector>
+
+#include "pHash.h"
+
+#ifndef RES_DIR_PATH
+#error ResourcesDir path not define! Need Modifiy CMakeLists.txt
+#endif
+
+/* dct hashes of every image in a directory: one file at a time with
+ * ph_dct_imagehash against ph_dct_image_hashes_ex with each read backend,
+ * checks they agree and times them; drop the page cache between runs
+ * (echo 3 > /proc/sys/vm/drop_caches) to time cold reads
+ * usage: BenchImageHashes [directory] [depth] */
+
+static double seconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* failed[i] files have no hash in the batch */
+static int check(DP **d, const std::vector<ulong64> &ref, const std::vector<char> &failed) {
+    int bad = 0;
+    for (size_t i = 0; i < ref.size(); i++) {
+        if (!d || !d[i])
+            bad++;
+        else if (failed[i] ? (d[i]->hash || d[i]->hash_length)
+                           : (!d[i]->hash || *(ulong64 *)d[i]->hash != ref[i]))
+            bad++;
+    }
+    return bad;
+}
+
+int main(int argc, char **argv) {
+    const char *dir = (argc > 1) ? argv[1] : RES_DIR_PATH;
+    const int depth = (argc > 2) ? atoi(argv[2]) : 0;
+    int count = 0;
+    char **files = ph_readfilenames(dir, count);
+    if (!files || count <= 0) {
+        printf("usage: %s [directory] [depth]\n", argv[0]);
+        return 1;
+    }
+    printf("%d files in %s\n", count, dir);
+
+    std::vector<ulong64> ref(count);
+    std::vector<char> failed(count, 0);
+    double t = seconds();
+    for (int i = 0; i < count; i++) {
+        if (ph_dct_imagehash(files[i], ref[i]) < 0)
+            failed[i] = 1;
+    }
+    printf("%-32s %8.1f ms\n", "ph_dct_imagehash", (seconds() - t) * 1000);
+
+    const struct {
+        const char *name;
+        ReadBackend backend;
+    } backends[] = {{"pread", PH_READ_PREAD}, {"io_uring", PH_READ_URING}};
+    int bad = 0;
+    for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+        PipelineOptions opts = {0, 0, depth, 0, backends[b].backend};
+        t = seconds();
+        DP **d = ph_dct_image_hashes_ex(files, count, &opts);
+        printf("ph_dct_image_hashes_ex, %-8s %8.1f ms\n", backends[b].name, (seconds() - t) * 1000);
+        bad += check(d, ref, failed);
+        if (d)
+            ph_free_datapoints(d, count);
+    }
+    printf("%d hashes differ\n", bad);
+
+    for (int i = 0; i < count; i++)
+        free(files[i]);
+    free(files);
+    return bad ? 1 : 0;
+}
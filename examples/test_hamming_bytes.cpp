@@ -0,0 +1,122 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "pHash.h"
+
+/* ph_hamming_bytes and ph_hamming_bytes_many against a ph_bitcount8 loop:
+ * checks both give the same distances, with and without max_dist, and times them
+ * usage: TestHammingBytes [number of hashes] */
+
+static double seconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int brute_force(const uint8_t *a, const uint8_t *b, int len) {
+    int d = 0;
+    for (int i = 0; i < len; i++) {
+        d += ph_bitcount8(a[i] ^ b[i]);
+    }
+    return d;
+}
+
+/* with max_dist the exact distance is only owed up to max_dist */
+static bool same(int got, int expect, int max_dist) {
+    if (max_dist < 0 || expect <= max_dist)
+        return got == expect;
+    return got > max_dist;
+}
+
+static int check(int len, int count, std::mt19937_64 &rng, bool timed) {
+    /* one byte in, so that no hash is 8 byte aligned */
+    std::vector<uint8_t> buf((size_t)(count + 1) * len + 1);
+    uint8_t *query = buf.data() + 1;
+    uint8_t *hashes = query + len;
+    for (int i = 0; i < len; i++) {
+        query[i] = (uint8_t)rng();
+    }
+    for (int m = 0; m < count; m++) {
+        uint8_t *h = hashes + (size_t)m * len;
+        /* from a copy of the query to fully random, so distances spread out */
+        const int flips = (int)(rng() % (8 * len + 1));
+        for (int i = 0; i < len; i++) {
+            h[i] = query[i];
+        }
+        for (int f = 0; f < flips; f++) {
+            const int bit = (int)(rng() % (8 * len));
+            h[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+        }
+    }
+
+    std::vector<int> expect(count);
+    double t0 = seconds();
+    for (int m = 0; m < count; m++) {
+        expect[m] = brute_force(query, hashes + (size_t)m * len, len);
+    }
+    double t_brute = seconds() - t0;
+
+    int errors = 0;
+    std::vector<int> dists(count);
+    const int limits[] = {-1, 0, 5, len, 4 * len, 8 * len};
+    double t_single = 0, t_many = 0;
+    for (size_t l = 0; l < sizeof(limits) / sizeof(limits[0]); l++) {
+        const int max_dist = limits[l];
+        t0 = seconds();
+        for (int m = 0; m < count; m++) {
+            if (!same(ph_hamming_bytes(query, hashes + (size_t)m * len, len, max_dist), expect[m], max_dist))
+                errors++;
+        }
+        double t1 = seconds();
+        if (ph_hamming_bytes_many(query, hashes, len, count, dists.data(), max_dist) != count)
+            errors++;
+        double t2 = seconds();
+        for (int m = 0; m < count; m++) {
+            if (!same(dists[m], expect[m], max_dist))
+                errors++;
+        }
+        if (max_dist < 0) {
+            t_single = t1 - t0;
+            t_many = t2 - t1;
+        }
+    }
+    if (timed)
+        printf("len %3d: bitcount8 %7.3f ms  ph_hamming_bytes %7.3f ms  ph_hamming_bytes_many %7.3f ms\n", len,
+               t_brute * 1e3, t_single * 1e3, t_many * 1e3);
+    return errors;
+}
+
+int main(int argc, char **argv) {
+    int count = (argc > 1) ? atoi(argv[1]) : 100000;
+    if (count <= 0) {
+        printf("usage: %s [number of hashes]\n", argv[0]);
+        return 1;
+    }
+
+    std::mt19937_64 rng(12345);
+    int errors = 0;
+
+    /* the specialised lengths: bmb, radial, mh */
+    errors += check(33, count, rng, true);
+    errors += check(40, count, rng, true);
+    errors += check(72, count, rng, true);
+
+    /* the generic kernel, around the word, early exit and 64 byte block sizes */
+    const int sizes[] = {1, 7, 8, 9, 31, 32, 63, 64, 65, 100, 128, 129, 200};
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        errors += check(sizes[s], count / 10 + 1, rng, sizes[s] == 200);
+    }
+
+    /* bad arguments, and no hashes */
+    uint8_t h[8] = {0};
+    int d;
+    if (ph_hamming_bytes(NULL, h, 8) != -1 || ph_hamming_bytes(h, h, 0) != -1 ||
+        ph_hamming_bytes_many(h, h, 8, -1, &d) != -1 || ph_hamming_bytes_many(h, h, 8, 0, &d) != 0)
+        errors++;
+
+    printf("%s\n", errors ? "results differ from brute force" : "results match brute force");
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,179 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "pHash.h"
+
+/* ph_hamming_scan and ph_hamming_topk against a ph_hamming_distance loop:
+ * checks both return the same ids, distances and order and times them
+ * usage: TestHammingScan [number of hashes] [number of queries] */
+
+static double seconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static ulong64 flip_bits(ulong64 h, int nbits, std::mt19937_64 &rng) {
+    for (int i = 0; i < nbits; i++) {
+        h ^= (ulong64)1 << (rng() % 64);
+    }
+    return h;
+}
+
+/* (distance, index) of every hash, sorted: the topk order */
+static void brute_force(const ulong64 *db, size_t n, ulong64 query, std::vector<std::pair<int, size_t> > &out) {
+    out.resize(n);
+    for (size_t i = 0; i < n; i++) {
+        out[i] = std::make_pair(ph_hamming_distance(query, db[i]), i);
+    }
+    std::sort(out.begin(), out.end());
+}
+
+static int check_scan(const ulong64 *db, size_t n, ulong64 query, int max_dist, int threads) {
+    std::vector<size_t> expect;
+    for (size_t i = 0; i < n; i++) {
+        if (ph_hamming_distance(query, db[i]) <= max_dist)
+            expect.push_back(i);
+    }
+
+    int errors = 0;
+    long long total = ph_hamming_scan(query, db, n, max_dist, NULL, NULL, (size_t)-1, threads);
+    if (total != (long long)expect.size())
+        errors++;
+
+    std::vector<size_t> ids(expect.size() + 1);
+    std::vector<int> dists(expect.size() + 1);
+    total = ph_hamming_scan(query, db, n, max_dist, ids.data(), dists.data(), (size_t)-1, threads);
+    if (total != (long long)expect.size())
+        errors++;
+    for (size_t j = 0; j < expect.size() && j < (size_t)total; j++) {
+        if (ids[j] != expect[j] || dists[j] != ph_hamming_distance(query, db[expect[j]]))
+            errors++;
+    }
+
+    /* a short output keeps the first capacity matches, the count is still the total */
+    const size_t caps[] = {0, 1, expect.size() / 2, expect.size() ? expect.size() - 1 : 0};
+    for (size_t c = 0; c < sizeof(caps) / sizeof(caps[0]); c++) {
+        const size_t cap = caps[c];
+        std::fill(ids.begin(), ids.end(), (size_t)-1);
+        total = ph_hamming_scan(query, db, n, max_dist, ids.data(), NULL, cap, threads);
+        if (total != (long long)expect.size())
+            errors++;
+        for (size_t j = 0; j < cap && j < expect.size(); j++) {
+            if (ids[j] != expect[j])
+                errors++;
+        }
+        if (cap < ids.size() && ids[cap] != (size_t)-1)
+            errors++;
+    }
+    return errors;
+}
+
+static int check_topk(const ulong64 *db, size_t n, ulong64 query, const std::vector<std::pair<int, size_t> > &expect,
+                      int k, int threads) {
+    std::vector<size_t> ids(k + 1);
+    std::vector<int> dists(k + 1);
+    int got = ph_hamming_topk(query, db, n, k, ids.data(), dists.data(), threads);
+    int errors = 0;
+    if (got != (int)std::min((size_t)k, n))
+        errors++;
+    for (int i = 0; i < got && i < (int)expect.size(); i++) {
+        if (ids[i] != expect[i].second || dists[i] != expect[i].first)
+            errors++;
+    }
+    return errors;
+}
+
+static int check(const std::vector<ulong64> &db, size_t n, const std::vector<ulong64> &queries) {
+    const int radii[] = {0, 3, 10, 32, 64};
+    const int ks[] = {1, 10, 100};
+    const int thread_counts[] = {1, 0, 4};
+    int errors = 0;
+    std::vector<std::pair<int, size_t> > expect;
+    for (size_t q = 0; q < queries.size(); q++) {
+        for (size_t t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); t++) {
+            for (size_t r = 0; r < sizeof(radii) / sizeof(radii[0]); r++) {
+                errors += check_scan(db.data(), n, queries[q], radii[r], thread_counts[t]);
+            }
+        }
+        brute_force(db.data(), n, queries[q], expect);
+        for (size_t t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); t++) {
+            for (size_t k = 0; k < sizeof(ks) / sizeof(ks[0]); k++) {
+                errors += check_topk(db.data(), n, queries[q], expect, ks[k], thread_counts[t]);
+            }
+        }
+    }
+    return errors;
+}
+
+int main(int argc, char **argv) {
+    int count = (argc > 1) ? atoi(argv[1]) : (1 << 22) + 37;
+    int nq = (argc > 2) ? atoi(argv[2]) : 4;
+    if (count <= 0 || nq <= 0) {
+        printf("usage: %s [number of hashes] [number of queries]\n", argv[0]);
+        return 1;
+    }
+
+    /* random hashes, a third of them near copies of an earlier one and a few
+     * exact copies, so that distances tie */
+    std::mt19937_64 rng(12345);
+    std::vector<ulong64> db(count);
+    for (int i = 0; i < count; i++) {
+        if (i > 0 && i % 7 == 0)
+            db[i] = db[rng() % i];
+        else if (i > 0 && i % 3 == 0)
+            db[i] = flip_bits(db[rng() % i], rng() % 13, rng);
+        else
+            db[i] = rng();
+    }
+    std::vector<ulong64> queries(nq);
+    for (int q = 0; q < nq; q++) {
+        queries[q] = flip_bits(db[rng() % std::min(count, 1000)], rng() % 8, rng);
+    }
+
+    int errors = 0;
+
+    /* short arrays: empty, around a scan block, and not a block multiple */
+    const int sizes[] = {0, 1, 63, 64, 65, 127, 129, 1000};
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        if (sizes[s] <= count)
+            errors += check(db, sizes[s], queries);
+    }
+
+    /* large enough to be split across threads on a machine that has them */
+    double t0 = seconds();
+    errors += check(db, count, std::vector<ulong64>(queries.begin(), queries.begin() + 1));
+    printf("checked %d hashes in %.2f s\n", count, seconds() - t0);
+
+    {
+        /* only time the rest, the full check is slow */
+        std::vector<size_t> ids(count);
+        double t1 = seconds();
+        long long total = 0;
+        for (int q = 0; q < nq; q++) {
+            total += ph_hamming_scan(queries[q], db.data(), count, 10, ids.data(), NULL);
+        }
+        double t2 = seconds();
+        std::vector<size_t> topk(10);
+        for (int q = 0; q < nq; q++) {
+            ph_hamming_topk(queries[q], db.data(), count, 10, topk.data(), NULL);
+        }
+        double t3 = seconds();
+        printf("n %d: scan radius 10 %9.3f ms (%.1f matches)  top 10 %9.3f ms  per query\n", count,
+               (t2 - t1) * 1e3 / nq, (double)total / nq, (t3 - t2) * 1e3 / nq);
+    }
+
+    /* bad arguments */
+    size_t id;
+    if (ph_hamming_scan(0, NULL, 1, 10, &id, NULL) != -1 || ph_hamming_topk(0, NULL, 1, 1, &id, NULL) != -1 ||
+        ph_hamming_topk(0, db.data(), 1, 1, NULL, NULL) != -1 || ph_hamming_scan(0, db.data(), 1, -1, &id, NULL) != 0)
+        errors++;
+
+    printf("%s\n", errors ? "results differ from brute force" : "results match brute force");
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,356 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "pHash.h"
+#include "ph_dct32.h"
+
+#ifndef RES_DIR_PATH
+#error ResourcesDir path not define! Need Modifiy CMakeLists.txt
+#endif
+
+/* the fast image hash paths against the CImg reference:
+ *  - every ph_dct32_lowfreq path against C * img * C^T on random 32x32 input
+ *  - _ph_dct_imagehash against the reference dct hash, and the fused
+ *    preprocessing against it
+ *  - the ImageView entry points against the CImg ones for the same pixels
+ *  - the file hashes of a png against those of a ppm of the same pixels
+ * on random images and on the decoded resources
+ * usage: TestImagePaths [image directory] */
+
+static int failures = 0;
+
+static void check(bool ok, const char *what, const char *name) {
+    if (!ok) {
+        printf("FAIL %s: %s\n", what, name);
+        failures++;
+    }
+}
+
+/* the 32x32 dct-II matrix the dct hash was defined with */
+static CImg<float> dct_matrix() {
+    const int N = 32;
+    CImg<float> matrix(N, N, 1, 1, 1 / sqrt((float)N));
+    const float c1 = sqrt(2.0 / N);
+    for (int x = 0; x < N; x++) {
+        for (int y = 1; y < N; y++) {
+            matrix(x, y) = c1 * cos((cimg::PI / 2 / N) * y * (2 * x + 1));
+        }
+    }
+    return matrix;
+}
+
+static ulong64 median_hash(const CImg<float> &subsec) {
+    const float median = subsec.median();
+    ulong64 hash = 0;
+    for (int i = 0; i < 64; i++, hash <<= 1) {
+        if (subsec(i) > median)
+            hash |= 0x01;
+    }
+    return hash;
+}
+
+/* the dct hash as computed before the fast paths */
+static ulong64 reference_dct_hash(const CImg<uint8_t> &src) {
+    static const CImg<float> C = dct_matrix();
+    CImg<float> meanfilter(7, 7, 1, 1, 1);
+    CImg<float> img;
+    if (src.spectrum() > 3) {
+        CImg<> rgb = src.get_shared_channels(0, 2);
+        img = rgb.RGBtoYCbCr().channel(0).get_convolve(meanfilter);
+    } else if (src.spectrum() == 3) {
+        img = src.get_RGBtoYCbCr().channel(0).get_convolve(meanfilter);
+    } else {
+        img = src.get_channel(0).get_convolve(meanfilter);
+    }
+    img.resize(32, 32);
+    CImg<float> dctImage = C * img * C.get_transpose();
+    return median_hash(dctImage.crop(1, 1, 8, 8).unroll('x'));
+}
+
+static void check_dct32(std::mt19937 &rng) {
+    static const CImg<float> C = dct_matrix();
+    std::uniform_real_distribution<float> pixel(0.0f, 255.0f);
+    const DCT32Path paths[] = {PH_DCT32_SCALAR, PH_DCT32_SSE2, PH_DCT32_AVX2};
+    const char *names[] = {"scalar", "sse2", "avx2"};
+    double max_err = 0;
+    int hash_diffs = 0;
+    for (int trial = 0; trial < 1000; trial++) {
+        CImg<float> img(32, 32);
+        cimg_forXY(img, x, y) img(x, y) = pixel(rng);
+        CImg<float> ref = (C * img * C.get_transpose()).crop(1, 1, 8, 8).unroll('x');
+
+        float first[64];
+        ph_dct32_lowfreq_path(PH_DCT32_SCALAR, img.data(), first);
+        for (int p = 0; p < 3; p++) {
+            float coeffs[64];
+            if (ph_dct32_lowfreq_path(paths[p], img.data(), coeffs) < 0)
+                continue;
+            check(!memcmp(coeffs, first, sizeof(first)), "dct32 path differs from scalar", names[p]);
+        }
+        float coeffs[64];
+        ph_dct32_lowfreq(img.data(), coeffs);
+        check(!memcmp(coeffs, first, sizeof(first)), "dct32 dispatch differs from scalar", "random");
+        for (int i = 0; i < 64; i++) {
+            max_err = std::max(max_err, (double)fabs(coeffs[i] - ref(i)));
+        }
+        if (median_hash(CImg<float>(coeffs, 64)) != median_hash(ref))
+            hash_diffs++;
+    }
+    /* the two products round differently, a coefficient at the median may flip */
+    printf("dct32: max |coeff - reference| %g on 0..255 input, %d/1000 hashes differ\n", max_err, hash_diffs);
+    check(max_err < 1e-2, "dct32 coefficients far from reference", "random");
+    check(hash_diffs <= 10, "dct32 hashes differ from reference", "random");
+}
+
+/* pixels of img interleaved as fmt, rows padded to stride bytes */
+static std::vector<uint8_t> interleave(const CImg<uint8_t> &img, PixelFormat fmt, int stride) {
+    std::vector<uint8_t> buf((size_t)stride * img.height(), 0xcd);
+    for (int y = 0; y < img.height(); y++) {
+        uint8_t *row = &buf[(size_t)y * stride];
+        for (int x = 0; x < img.width(); x++) {
+            switch (fmt) {
+                case PH_PIXEL_RGB24:
+                    row[3 * x] = img(x, y, 0, 0), row[3 * x + 1] = img(x, y, 0, 1), row[3 * x + 2] = img(x, y, 0, 2);
+                    break;
+                case PH_PIXEL_BGRA32:
+                    row[4 * x] = img(x, y, 0, 2), row[4 * x + 1] = img(x, y, 0, 1), row[4 * x + 2] = img(x, y, 0, 0);
+                    row[4 * x + 3] = 255;
+                    break;
+                default:
+                    row[x] = img(x, y, 0, 0);
+                    break;
+            }
+        }
+    }
+    return buf;
+}
+
+static bool same_bytes(const uint8_t *a, int na, const uint8_t *b, int nb) {
+    return a && b && na == nb && !memcmp(a, b, na);
+}
+
+/* every hash of the view against the same hash of img */
+static void check_view(const CImg<uint8_t> &img, PixelFormat fmt, int pad, const char *name) {
+    const int bpp = fmt == PH_PIXEL_RGB24 ? 3 : fmt == PH_PIXEL_BGRA32 ? 4 : 1;
+    const int stride = img.width() * bpp + pad;
+    std::vector<uint8_t> buf = interleave(img, fmt, stride);
+    ImageView view = {buf.data(), img.width(), img.height(), pad ? stride : 0, fmt};
+
+    ulong64 h1 = 0, h2 = 0;
+    _ph_dct_imagehash(img, h1);
+    ph_dct_imagehash_view(view, h2);
+    check(h1 == h2, "dct view", name);
+
+    int n1 = 0, n2 = 0;
+    uint8_t *m1 = _ph_mh_imagehash(img, n1);
+    uint8_t *m2 = ph_mh_imagehash_view(view, n2);
+    check(same_bytes(m1, n1, m2, n2), "mh view", name);
+    free(m1);
+    free(m2);
+
+    BMBHash b1, b2;
+    b1.hash = b2.hash = NULL;
+    b1.bytelength = b2.bytelength = 0;
+    _ph_bmb_imagehash(img, b1);
+    ph_bmb_imagehash_view(view, b2);
+    check(same_bytes(b1.hash, b1.bytelength, b2.hash, b2.bytelength), "bmb view", name);
+    if (b1.hash)
+        ph_bmb_free(b1);
+    if (b2.hash)
+        ph_bmb_free(b2);
+
+    Digest d1, d2;
+    d1.coeffs = d2.coeffs = NULL;
+    d1.size = d2.size = 0;
+    _ph_image_digest(img, 1.0, 1.0, d1);
+    ph_image_digest_view(view, 1.0, 1.0, d2);
+    check(same_bytes(d1.coeffs, d1.size, d2.coeffs, d2.size), "radial view", name);
+    free(d1.coeffs);
+    free(d2.coeffs);
+}
+
+/* crc-32 of the png chunks and adler-32 of the zlib stream */
+static uint32_t png_crc(uint32_t crc, const uint8_t *p, size_t n) {
+    crc = ~crc;
+    for (size_t i = 0; i < n; i++) {
+        crc ^= p[i];
+        for (int k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (0xedb88320u & (0u - (crc & 1)));
+    }
+    return ~crc;
+}
+
+static void put_be32(std::vector<uint8_t> &out, uint32_t v) {
+    const uint8_t b[4] = {(uint8_t)(v >> 24), (uint8_t)(v >> 16), (uint8_t)(v >> 8), (uint8_t)v};
+    out.insert(out.end(), b, b + 4);
+}
+
+static void png_chunk(FILE *f, const char *type, const std::vector<uint8_t> &data) {
+    std::vector<uint8_t> chunk;
+    put_be32(chunk, (uint32_t)data.size());
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+    put_be32(chunk, png_crc(0, chunk.data() + 4, chunk.size() - 4));
+    fwrite(chunk.data(), 1, chunk.size(), f);
+}
+
+/* 8 bit rgb png with stored (uncompressed) deflate blocks, readable by any
+ * decoder without needing one to write it */
+static bool save_png(const CImg<uint8_t> &img, const char *file) {
+    std::vector<uint8_t> raw;
+    for (int y = 0; y < img.height(); y++) {
+        raw.push_back(0); /* no filter */
+        for (int x = 0; x < img.width(); x++) {
+            for (int c = 0; c < 3; c++)
+                raw.push_back(img(x, y, 0, c));
+        }
+    }
+    std::vector<uint8_t> z = {0x78, 0x01};
+    for (size_t pos = 0; pos < raw.size();) {
+        const size_t n = std::min(raw.size() - pos, (size_t)65535);
+        z.push_back(pos + n == raw.size() ? 1 : 0);
+        z.push_back((uint8_t)n), z.push_back((uint8_t)(n >> 8));
+        z.push_back((uint8_t)~n), z.push_back((uint8_t)(~n >> 8));
+        z.insert(z.end(), raw.begin() + pos, raw.begin() + pos + n);
+        pos += n;
+    }
+    uint32_t a = 1, b = 0;
+    for (uint8_t v : raw) {
+        a = (a + v) % 65521;
+        b = (b + a) % 65521;
+    }
+    put_be32(z, (b << 16) | a);
+
+    std::vector<uint8_t> ihdr;
+    put_be32(ihdr, img.width());
+    put_be32(ihdr, img.height());
+    const uint8_t rest[5] = {8, 2, 0, 0, 0}; /* 8 bit rgb, deflate, no filter, no interlace */
+    ihdr.insert(ihdr.end(), rest, rest + 5);
+
+    FILE *f = fopen(file, "wb");
+    if (!f)
+        return false;
+    const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    fwrite(signature, 1, 8, f);
+    png_chunk(f, "IHDR", ihdr);
+    png_chunk(f, "IDAT", z);
+    png_chunk(f, "IEND", std::vector<uint8_t>());
+    return fclose(f) == 0;
+}
+
+/* lossless formats carry the same pixels, so every file hash must agree */
+static void check_png_ppm(const CImg<uint8_t> &img, const char *name) {
+    const char *png = "test_image_paths.png", *ppm = "test_image_paths.ppm";
+    img.save_pnm(ppm);
+    ulong64 h1 = 0, h2 = 0;
+    if (!save_png(img, png) || ph_dct_imagehash(png, h2) < 0) {
+        printf("no png decoder, skipping the png check of %s\n", name);
+        remove(png);
+        remove(ppm);
+        return;
+    }
+    ph_dct_imagehash(ppm, h1);
+    check(h1 == h2, "dct hash of png and ppm differ", name);
+
+    int n1 = 0, n2 = 0;
+    uint8_t *m1 = ph_mh_imagehash(ppm, n1);
+    uint8_t *m2 = ph_mh_imagehash(png, n2);
+    check(same_bytes(m1, n1, m2, n2), "mh hash of png and ppm differ", name);
+    free(m1);
+    free(m2);
+
+    BMBHash b1, b2;
+    b1.hash = b2.hash = NULL;
+    b1.bytelength = b2.bytelength = 0;
+    ph_bmb_imagehash(ppm, b1);
+    ph_bmb_imagehash(png, b2);
+    check(same_bytes(b1.hash, b1.bytelength, b2.hash, b2.bytelength), "bmb hash of png and ppm differ", name);
+    if (b1.hash)
+        ph_bmb_free(b1);
+    if (b2.hash)
+        ph_bmb_free(b2);
+
+    Digest d1, d2;
+    d1.coeffs = d2.coeffs = NULL;
+    d1.size = d2.size = 0;
+    ph_image_digest(ppm, 1.0, 1.0, d1);
+    ph_image_digest(png, 1.0, 1.0, d2);
+    check(same_bytes(d1.coeffs, d1.size, d2.coeffs, d2.size), "radial digest of png and ppm differ", name);
+    free(d1.coeffs);
+    free(d2.coeffs);
+    remove(png);
+    remove(ppm);
+}
+
+static void check_image(const CImg<uint8_t> &img, const char *name) {
+    ulong64 ref = reference_dct_hash(img), h = 0, fused = 0;
+    _ph_dct_imagehash(img, h);
+    check(h == ref, "dct hash differs from reference", name);
+    _ph_dct_imagehash(img, fused, DCT_PREPROCESS_FUSED_NEAREST);
+    check(fused == ref, "fused nearest dct hash differs from reference", name);
+
+    if (img.spectrum() == 3) {
+        check_view(img, PH_PIXEL_RGB24, 0, name);
+        check_view(img, PH_PIXEL_RGB24, 5, name);
+        check_view(img, PH_PIXEL_BGRA32, 8, name);
+    } else if (img.spectrum() == 1) {
+        check_view(img, PH_PIXEL_GRAY8, 0, name);
+        check_view(img, PH_PIXEL_GRAY8, 3, name);
+        check_view(img, PH_PIXEL_NV12, 0, name);
+    }
+}
+
+int main(int argc, char **argv) {
+    const char *dir = (argc > 1) ? argv[1] : RES_DIR_PATH;
+    std::mt19937 rng(2024);
+    check_dct32(rng);
+
+    /* random images: noise, smooth gradients, odd sizes */
+    int nimages = 0;
+    for (int i = 0; i < 24; i++) {
+        const int w = 33 + rng() % 600, h = 33 + rng() % 400;
+        const int spectrum = (i % 3 == 0) ? 1 : (i % 3 == 1) ? 3 : 4;
+        CImg<uint8_t> img(w, h, 1, spectrum);
+        if (i % 2) {
+            cimg_forXYC(img, x, y, c) img(x, y, 0, c) = (uint8_t)rng();
+        } else {
+            const int fx = 1 + rng() % 7, fy = 1 + rng() % 7;
+            cimg_forXYC(img, x, y, c) img(x, y, 0, c) =
+                (uint8_t)(127 + 120 * sin(fx * x / (double)w * 6.28 + c) * cos(fy * y / (double)h * 6.28));
+        }
+        char name[64];
+        snprintf(name, sizeof(name), "random %d (%dx%dx%d)", i, w, h, spectrum);
+        check_image(img, name);
+        if (spectrum == 3)
+            check_png_ppm(img, name);
+        nimages++;
+    }
+
+    int count = 0;
+    char **files = ph_readfilenames(dir, count);
+    for (int i = 0; i < count; i++) {
+        CImg<uint8_t> img;
+        try {
+            img.load(files[i]);
+        } catch (CImgException &) {
+            free(files[i]);
+            continue;
+        }
+        check_image(img, files[i]);
+        if (img.spectrum() == 3)
+            check_image(img.get_RGBtoYCbCr().channel(0), files[i]);
+        nimages++;
+        free(files[i]);
+    }
+    free(files);
+
+    printf("%d images checked, %d failures\n", nimages, failures);
+    return failures ? 1 : 0;
+}
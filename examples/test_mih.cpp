@@ -0,0 +1,130 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "pHash.h"
+
+/* multi-index hash index against a brute force ph_hamming_distance scan:
+ * checks both return the same ids and times them
+ * usage: TestMIH [number of hashes] [number of queries] [substrings] */
+
+static double seconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static ulong64 flip_bits(ulong64 h, int nbits, std::mt19937_64 &rng) {
+    for (int i = 0; i < nbits; i++) {
+        h ^= (ulong64)1 << (rng() % 64);
+    }
+    return h;
+}
+
+static bool match_less(const MIHMatch &a, const MIHMatch &b) {
+    return (a.distance != b.distance) ? (a.distance < b.distance) : (a.id < b.id);
+}
+
+static void brute_force(const std::vector<ulong64> &db, const std::vector<uint8_t> &live, ulong64 query, int radius,
+                        std::vector<MIHMatch> &out) {
+    out.clear();
+    for (size_t i = 0; i < db.size(); i++) {
+        if (!live[i])
+            continue;
+        int d = ph_hamming_distance(query, db[i]);
+        if (d <= radius) {
+            MIHMatch m = {(uint32_t)i, d};
+            out.push_back(m);
+        }
+    }
+    std::sort(out.begin(), out.end(), match_less);
+}
+
+int main(int argc, char **argv) {
+    int count = (argc > 1) ? atoi(argv[1]) : 1000000;
+    int nq = (argc > 2) ? atoi(argv[2]) : 100;
+    int m = (argc > 3) ? atoi(argv[3]) : 0;
+    if (count <= 0 || nq <= 0) {
+        printf("usage: %s [number of hashes] [number of queries] [substrings]\n", argv[0]);
+        return 1;
+    }
+
+    /* random hashes, a third of them near copies of an earlier one */
+    std::mt19937_64 rng(12345);
+    std::vector<ulong64> db(count);
+    for (int i = 0; i < count; i++) {
+        db[i] = (i > 0 && i % 3 == 0) ? flip_bits(db[rng() % i], rng() % 13, rng) : rng();
+    }
+    std::vector<uint8_t> live(count, 1);
+
+    MIHIndex *index = ph_mih_create(m);
+    if (!index) {
+        printf("unable to create index\n");
+        return 1;
+    }
+    double t0 = seconds();
+    ph_mih_insert_many(index, db.data(), count, NULL);
+    printf("inserted %d hashes in %.2f s\n", ph_mih_size(index), seconds() - t0);
+
+    /* delete a few, the brute force scan skips them too */
+    for (int i = 0; i < count / 100; i++) {
+        uint32_t id = (uint32_t)(rng() % count);
+        if (live[id] && ph_mih_delete(index, id) == 0)
+            live[id] = 0;
+    }
+
+    std::vector<ulong64> queries(nq);
+    for (int q = 0; q < nq; q++) {
+        queries[q] = flip_bits(db[rng() % count], rng() % 8, rng);
+    }
+
+    int errors = 0;
+    std::vector<MIHMatch> expect;
+    std::vector<MIHMatch> got;
+    const int radii[] = {0, 2, 4, 6, 8, 10, 12};
+    for (size_t r = 0; r < sizeof(radii) / sizeof(radii[0]); r++) {
+        const int radius = radii[r];
+        double t_mih = 0, t_brute = 0;
+        long total = 0;
+        for (int q = 0; q < nq; q++) {
+            t0 = seconds();
+            int n = ph_mih_query(index, queries[q], radius, NULL, 0);
+            got.resize(n);
+            ph_mih_query(index, queries[q], radius, got.data(), n);
+            double t1 = seconds();
+            brute_force(db, live, queries[q], radius, expect);
+            double t2 = seconds();
+            t_mih += t1 - t0;
+            t_brute += t2 - t1;
+            total += n;
+            if (got.size() != expect.size() ||
+                !std::equal(got.begin(), got.end(), expect.begin(),
+                            [](const MIHMatch &a, const MIHMatch &b) { return a.id == b.id && a.distance == b.distance; }))
+                errors++;
+        }
+        printf("radius %2d: %8.1f matches/query  mih %9.3f ms  brute force %9.3f ms  per query\n", radius,
+               (double)total / nq, t_mih * 1e3 / nq, t_brute * 1e3 / nq);
+    }
+
+    const int k = 10;
+    std::vector<MIHMatch> topk((size_t)nq * k);
+    std::vector<int> counts(nq);
+    t0 = seconds();
+    ph_mih_topk_batch(index, queries.data(), nq, k, topk.data(), counts.data());
+    double t_topk = seconds() - t0;
+    for (int q = 0; q < nq; q++) {
+        brute_force(db, live, queries[q], 64, expect);
+        for (int i = 0; i < k && i < (int)expect.size(); i++) {
+            if (counts[q] != k || topk[(size_t)q * k + i].id != expect[i].id)
+                errors++;
+        }
+    }
+    printf("top %d: mih %.3f ms per query\n", k, t_topk * 1e3 / nq);
+
+    ph_mih_free(index);
+    printf("%s\n", errors ? "results differ from brute force" : "results match brute force");
+    return errors ? 1 : 0;
+}
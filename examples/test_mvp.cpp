@@ -0,0 +1,329 @@
+#include <float.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "pHash.h"
+#include "pHash_mvp.h"
+#include "pHash_mvptree.h"
+#include "sqlite3/sqlite3.h"
+
+/* mvp database queries against a brute force ph_hamming_distance scan:
+ *  - radius and k nearest queries through the tree index, and through the
+ *    substring indexes of the database (hammingdistance is pushed down)
+ *  - the same points split over shards and added through a handle
+ *  - a version 0 database, JSON text hashes without substring columns,
+ *    migrated when opened and then indexed
+ *  - a tree index left behind by rows added without it, and its rebuild
+ * usage: TestMvp [number of hashes] [number of queries] [directory] */
+
+static double seconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static ulong64 flip_bits(ulong64 h, int nbits, std::mt19937_64 &rng) {
+    for (int i = 0; i < nbits; i++) {
+        h ^= (ulong64)1 << (rng() % 64);
+    }
+    return h;
+}
+
+/* any metric but hammingdistance itself is answered by the tree index */
+static float tree_distance(DP *a, DP *b) {
+    return hammingdistance(a, b);
+}
+
+/* the points of a database, ids "h<index>" */
+typedef struct points {
+    std::vector<ulong64> hashes;
+    std::vector<std::string> ids;
+    std::vector<std::string> paths;
+    std::vector<DP> dps;
+    std::vector<DP *> list;
+} Points;
+
+static void add_points(Points &p, int count, std::mt19937_64 &rng) {
+    for (int i = 0; i < count; i++) {
+        const size_t n = p.hashes.size();
+        p.hashes.push_back((n > 0 && n % 3 == 0) ? flip_bits(p.hashes[rng() % n], rng() % 13, rng) : rng());
+        p.ids.push_back("h" + std::to_string(n));
+        p.paths.push_back("path/" + std::to_string(n) + ".jpg");
+    }
+    /* the strings and hashes may have moved */
+    p.dps.resize(p.hashes.size());
+    p.list.resize(p.hashes.size());
+    for (size_t i = 0; i < p.hashes.size(); i++) {
+        DP dp = {(char *)p.ids[i].c_str(), &p.hashes[i], (char *)p.paths[i].c_str(), 1, UINT64ARRAY, IMAGE};
+        p.dps[i] = dp;
+        p.list[i] = &p.dps[i];
+    }
+}
+
+static int index_of(const char *id) {
+    return atoi(id + 1);
+}
+
+static std::vector<int> brute_force(const std::vector<ulong64> &hashes, ulong64 query) {
+    std::vector<int> d(hashes.size());
+    for (size_t i = 0; i < hashes.size(); i++) {
+        d[i] = ph_hamming_distance(query, hashes[i]);
+    }
+    return d;
+}
+
+static void remove_database(const std::string &base, int shards) {
+    const char *ext[] = {".db", ".mvp", ".db-wal", ".db-shm"};
+    for (int i = -1; i < shards; i++) {
+        const std::string name = (i < 0) ? base : base + "." + std::to_string(i);
+        for (size_t e = 0; e < sizeof(ext) / sizeof(ext[0]); e++) {
+            remove((name + ext[e]).c_str());
+        }
+    }
+}
+
+/* radius and k nearest queries of a handle against brute force */
+static int check_queries(MVPHandle *h, const Points &p, const std::vector<ulong64> &queries, const char *what) {
+    int errors = 0;
+    double t_query = 0, t_topk = 0;
+    const float thresholds[] = {1, 5, 9, 13, 17, 25};
+    const int ks[] = {1, 10, 50};
+    std::vector<MVPResult> results(50);
+    for (size_t q = 0; q < queries.size(); q++) {
+        ulong64 qh = queries[q];
+        DP query = {(char *)"query", &qh, NULL, 1, UINT64ARRAY, IMAGE};
+        std::vector<int> dist = brute_force(p.hashes, qh);
+
+        for (size_t t = 0; t < sizeof(thresholds) / sizeof(thresholds[0]); t++) {
+            DP **found = NULL;
+            int count = 0;
+            double t0 = seconds();
+            if (ph_mvp_query(h, &query, thresholds[t], found, count) != PH_SUCCESS)
+                errors++;
+            t_query += seconds() - t0;
+            std::vector<int> got, expect;
+            for (int i = 0; i < count; i++) {
+                got.push_back(index_of(found[i]->id));
+                free(found[i]->id);
+                free(found[i]->path);
+                free(found[i]->hash);
+                free(found[i]);
+            }
+            free(found);
+            for (size_t i = 0; i < dist.size(); i++) {
+                if (dist[i] < thresholds[t])
+                    expect.push_back((int)i);
+            }
+            std::sort(got.begin(), got.end());
+            if (got != expect)
+                errors++;
+        }
+
+        std::vector<int> sorted = dist;
+        std::sort(sorted.begin(), sorted.end());
+        for (size_t k = 0; k < sizeof(ks) / sizeof(ks[0]); k++) {
+            for (int limited = 0; limited < 2; limited++) {
+                const float threshold = limited ? 10 : FLT_MAX;
+                int count = 0;
+                double t0 = seconds();
+                if (ph_mvp_query_topk(h, &query, ks[k], threshold, results.data(), count) != PH_SUCCESS)
+                    errors++;
+                t_topk += seconds() - t0;
+                /* ties make the ids ambiguous, the distances are not */
+                int expect = 0;
+                while (expect < ks[k] && expect < (int)sorted.size() && sorted[expect] < threshold)
+                    expect++;
+                if (count != expect)
+                    errors++;
+                for (int i = 0; i < count && i < expect; i++) {
+                    const int idx = index_of(results[i].id);
+                    if ((int)results[i].distance != sorted[i] || idx < 0 || idx >= (int)dist.size() ||
+                        dist[idx] != sorted[i])
+                        errors++;
+                }
+                ph_mvp_free_results(results.data(), count);
+            }
+        }
+    }
+    printf("%-28s radius %8.3f ms  top k %8.3f ms  per query%s\n", what, t_query * 1e3 / queries.size(),
+           t_topk * 1e3 / queries.size(), errors ? "  DIFFERS" : "");
+    return errors;
+}
+
+static int check_handle(MVPFile *m, const MVPOptions *options, const Points &p, const std::vector<ulong64> &queries,
+                        const char *what) {
+    MVPHandle *h;
+    if (ph_mvp_open(m, options, &h) != PH_SUCCESS) {
+        printf("%s: unable to open %s\n", what, m->filename);
+        return 1;
+    }
+    int errors = check_queries(h, p, queries, what);
+    ph_mvp_close(h);
+    return errors;
+}
+
+/* points in the tree index of a database, -1 without one */
+static int64_t tree_points(const std::string &base) {
+    MVPTree *tree = ph_mvptree_open((base + ".mvp").c_str(), 0);
+    if (!tree)
+        return -1;
+    int64_t n = (int64_t)ph_mvptree_size(tree);
+    ph_mvptree_close(tree);
+    return n;
+}
+
+/* a database as written before hashes were BLOBs */
+static int write_version0(const std::string &base, const Points &p) {
+    sqlite3 *db;
+    if (sqlite3_open((base + ".db").c_str(), &db) != SQLITE_OK)
+        return -1;
+    int rc = sqlite3_exec(db,
+                          "CREATE TABLE image_hashes (id TEXT PRIMARY KEY, hash TEXT, path TEXT, hash_length INTEGER,"
+                          " hash_datatype INTEGER); BEGIN TRANSACTION;",
+                          NULL, NULL, NULL);
+    sqlite3_stmt *stmt = NULL;
+    if (rc == SQLITE_OK)
+        rc = sqlite3_prepare_v2(db, "INSERT INTO image_hashes VALUES (?, ?, ?, 1, 8);", -1, &stmt, NULL);
+    for (size_t i = 0; rc == SQLITE_OK && i < p.hashes.size(); i++) {
+        const std::string json = "{\"hash\":[" + std::to_string(p.hashes[i]) + "]}";
+        sqlite3_bind_text(stmt, 1, p.ids[i].c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, 2, json.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, 3, p.paths[i].c_str(), -1, SQLITE_TRANSIENT);
+        if (sqlite3_step(stmt) != SQLITE_DONE)
+            rc = SQLITE_ERROR;
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+    sqlite3_close(db);
+    return rc == SQLITE_OK ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+    int count = (argc > 1) ? atoi(argv[1]) : 20000;
+    int nq = (argc > 2) ? atoi(argv[2]) : 20;
+    const std::string dir = (argc > 3) ? std::string(argv[3]) + "/" : std::string();
+    if (count <= 0 || nq <= 0) {
+        printf("usage: %s [number of hashes] [number of queries] [directory]\n", argv[0]);
+        return 1;
+    }
+
+    /* random hashes, a third of them near copies of an earlier one */
+    std::mt19937_64 rng(4242);
+    Points p;
+    add_points(p, count, rng);
+    std::vector<ulong64> queries(nq);
+    for (int q = 0; q < nq; q++) {
+        queries[q] = flip_bits(p.hashes[rng() % count], rng() % 8, rng);
+    }
+
+    int errors = 0;
+    const MVPOptions defaults = {0, 0, 0, 0, 0, 0, 0};
+    const MVPOptions readonly = {0, 1, 0, 0, 0, 0, 0};
+
+    /* one file, the tree built in bulk */
+    const std::string single = dir + "test_mvp";
+    remove_database(single, 0);
+    MVPFile tree = {(char *)single.c_str(), IMAGE, UINT64ARRAY, tree_distance};
+    MVPFile sql = {(char *)single.c_str(), IMAGE, UINT64ARRAY, hammingdistance};
+    double t0 = seconds();
+    if (ph_create_mvptree(&tree, p.list.data(), count) != PH_SUCCESS) {
+        printf("unable to create %s\n", single.c_str());
+        return 1;
+    }
+    printf("created %d points in %.2f s\n", count, seconds() - t0);
+    errors += check_handle(&tree, &readonly, p, queries, "tree");
+    errors += check_handle(&sql, &readonly, p, queries, "sql substrings");
+
+    /* rows added without a metric leave the tree behind: it is not used
+     * until ph_create_mvptree rebuilds it from every row */
+    MVPFile rows = {(char *)single.c_str(), IMAGE, UINT64ARRAY, NULL};
+    MVPHandle *h;
+    int saved = 0;
+    const int extra = count / 10 + 1;
+    add_points(p, extra, rng);
+    if (ph_mvp_open(&rows, &defaults, &h) != PH_SUCCESS ||
+        ph_mvp_add(h, p.list.data() + count, extra, saved) != PH_SUCCESS || saved != extra) {
+        printf("unable to add rows to %s\n", single.c_str());
+        errors++;
+    }
+    ph_mvp_close(h);
+    errors += check_handle(&tree, &readonly, p, queries, "stale tree, scan");
+    if (ph_create_mvptree(&tree) != PH_SUCCESS || tree_points(single) != (int64_t)p.hashes.size()) {
+        printf("tree index not rebuilt from the rows\n");
+        errors++;
+    }
+    errors += check_handle(&tree, &readonly, p, queries, "rebuilt tree");
+    remove_database(single, 0);
+
+    /* shards, the trees grown one point at a time, by batch then alone */
+    const std::string sharded = dir + "test_mvp_shards";
+    remove_database(sharded, 4);
+    MVPFile shard_tree = {(char *)sharded.c_str(), IMAGE, UINT64ARRAY, tree_distance};
+    MVPFile shard_sql = {(char *)sharded.c_str(), IMAGE, UINT64ARRAY, hammingdistance};
+    const MVPOptions create_shards = {1, 0, 0, 0, 0, 4, 0};
+    const int batch = (int)p.list.size() - std::min((int)p.list.size(), 10);
+    if (ph_mvp_open(&shard_tree, &create_shards, &h) != PH_SUCCESS ||
+        (batch > 0 && (ph_mvp_add(h, p.list.data(), batch, saved) != PH_SUCCESS || saved != batch))) {
+        printf("unable to add points to %s\n", sharded.c_str());
+        return 1;
+    }
+    for (size_t i = batch; i < p.list.size(); i++) {
+        if (ph_mvp_add(h, p.list[i]) != PH_SUCCESS)
+            errors++;
+    }
+    /* a duplicate id is refused, and not indexed either */
+    if (ph_mvp_add(h, p.list[0]) == PH_SUCCESS)
+        errors++;
+    ph_mvp_close(h);
+    for (int i = 0; i < 4; i++) {
+        if (tree_points(sharded + "." + std::to_string(i)) <= 0)
+            errors++;
+    }
+    errors += check_handle(&shard_tree, &readonly, p, queries, "4 shards, tree");
+    errors += check_handle(&shard_sql, &readonly, p, queries, "4 shards, sql substrings");
+    remove_database(sharded, 4);
+
+    /* version 0: migrated to BLOBs and substrings by the first writer */
+    const std::string old = dir + "test_mvp_v0";
+    remove_database(old, 0);
+    Points v0;
+    add_points(v0, std::min(count, 2000), rng);
+    std::vector<ulong64> v0_queries(nq);
+    for (int q = 0; q < nq; q++) {
+        v0_queries[q] = flip_bits(v0.hashes[rng() % v0.hashes.size()], rng() % 8, rng);
+    }
+    if (write_version0(old, v0) < 0) {
+        printf("unable to write %s\n", old.c_str());
+        return 1;
+    }
+    MVPFile old_tree = {(char *)old.c_str(), IMAGE, UINT64ARRAY, tree_distance};
+    MVPFile old_sql = {(char *)old.c_str(), IMAGE, UINT64ARRAY, hammingdistance};
+    errors += check_handle(&old_sql, &readonly, v0, v0_queries, "version 0, json scan");
+    errors += check_handle(&old_sql, &defaults, v0, v0_queries, "version 0, migrated");
+    DP by_id;
+    if (ph_query_mvptree(&old_sql, v0.ids[1].c_str(), &by_id) != PH_SUCCESS ||
+        *(ulong64 *)by_id.hash != v0.hashes[1]) {
+        printf("migrated hash differs\n");
+        errors++;
+    } else {
+        free(by_id.id);
+        free(by_id.path);
+        free(by_id.hash);
+    }
+    if (ph_create_mvptree(&old_tree) != PH_SUCCESS || tree_points(old) != (int64_t)v0.hashes.size()) {
+        printf("tree index not built from the migrated rows\n");
+        errors++;
+    }
+    errors += check_handle(&old_tree, &readonly, v0, v0_queries, "version 0, tree");
+    remove_database(old, 0);
+
+    printf("%s\n", errors ? "results differ from brute force" : "results match brute force");
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,179 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "pHash.h"
+
+/* ph_crosscorr_many against a ph_crosscorr loop, with and without early_out:
+ * checks both give the same peaks, shifts and matches and times them
+ * usage: TestXcorr [number of candidates] */
+
+static double seconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* the shift ph_crosscorr peaks at, and the gap to the runner up so that
+ * shifts are only compared where float rounding can not swap them */
+static int peak_shift(const Digest &x, const Digest &y, double &gap) {
+    const int N = y.size;
+    double meanx = 0.0, meany = 0.0;
+    for (int i = 0; i < N; i++) {
+        meanx += x.coeffs[i];
+        meany += y.coeffs[i];
+    }
+    meanx /= N;
+    meany /= N;
+    double best = -2.0, second = -2.0;
+    int d_best = 0;
+    for (int d = 0; d < N; d++) {
+        double num = 0.0;
+        for (int i = 0; i < N; i++) {
+            num += (x.coeffs[i] - meanx) * (y.coeffs[(N + i - d) % N] - meany);
+        }
+        if (num > best) {
+            second = best;
+            best = num;
+            d_best = d;
+        } else if (num > second) {
+            second = num;
+        }
+    }
+    gap = best - second;
+    return d_best;
+}
+
+static void random_digest(Digest &dig, int N, std::mt19937_64 &rng) {
+    dig.id = NULL;
+    dig.size = N;
+    dig.coeffs = (uint8_t *)malloc(N);
+    for (int i = 0; i < N; i++) {
+        dig.coeffs[i] = (uint8_t)rng();
+    }
+}
+
+/* a circular shift of src with a little noise, correlates well with it */
+static void near_digest(Digest &dig, const Digest &src, std::mt19937_64 &rng) {
+    const int N = src.size;
+    const int s = (int)(rng() % N);
+    const int noise = 1 + (int)(rng() % 80);
+    random_digest(dig, N, rng);
+    for (int i = 0; i < N; i++) {
+        int v = src.coeffs[(i + s) % N] + (int)(rng() % (2 * noise + 1)) - noise;
+        dig.coeffs[i] = (uint8_t)((v < 0) ? 0 : (v > 255) ? 255 : v);
+    }
+}
+
+static int check(int N, int count, double threshold, std::mt19937_64 &rng) {
+    Digest query;
+    random_digest(query, N, rng);
+    std::vector<Digest> cands(count);
+    for (int m = 0; m < count; m++) {
+        if (m % 5 == 0) {
+            /* a constant digest, both give it 0 */
+            random_digest(cands[m], N, rng);
+            for (int i = 0; i < N; i++) {
+                cands[m].coeffs[i] = cands[m].coeffs[0];
+            }
+        } else if (m % 2 == 0) {
+            near_digest(cands[m], query, rng);
+        } else {
+            random_digest(cands[m], N, rng);
+        }
+    }
+
+    double t0 = seconds();
+    std::vector<double> expect(count);
+    int expect_matches = 0;
+    for (int m = 0; m < count; m++) {
+        expect_matches += ph_crosscorr(query, cands[m], expect[m], threshold);
+    }
+    double t_single = seconds() - t0;
+
+    NormDigest nq;
+    std::vector<NormDigest> norms(count);
+    if (ph_normalize_digest(query, nq) < 0) {
+        printf("unable to normalize digest\n");
+        return 1;
+    }
+    for (int m = 0; m < count; m++) {
+        ph_normalize_digest(cands[m], norms[m]);
+    }
+
+    int errors = 0;
+    std::vector<double> pcc(count);
+    std::vector<int> shift(count);
+    for (int early_out = 0; early_out <= 1; early_out++) {
+        t0 = seconds();
+        int matches = ph_crosscorr_many(nq, norms.data(), count, pcc.data(), shift.data(), threshold, early_out);
+        double t_many = seconds() - t0;
+
+        int borderline = 0;
+        for (int m = 0; m < count; m++) {
+            if (fabs(expect[m] - threshold) < 1e-4)
+                borderline++;
+            if (shift[m] < 0) {
+                /* dropped early, it must not have reached threshold */
+                if (!early_out || expect[m] > threshold + 1e-4)
+                    errors++;
+                continue;
+            }
+            /* ph_crosscorr floors the peak at 0 */
+            if (fabs((pcc[m] > 0.0 ? pcc[m] : 0.0) - expect[m]) > 1e-4)
+                errors++;
+            double gap;
+            int d = peak_shift(query, cands[m], gap);
+            if (gap > 1e-3 * N * 255.0 && d != shift[m])
+                errors++;
+        }
+        if (matches < expect_matches - borderline || matches > expect_matches + borderline)
+            errors++;
+        printf("N %3d early_out %d: %5d of %5d match  ph_crosscorr %9.3f ms  ph_crosscorr_many %9.3f ms\n", N,
+               early_out, matches, count, t_single * 1e3, t_many * 1e3);
+    }
+
+    ph_free_normalized_digest(nq);
+    for (int m = 0; m < count; m++) {
+        ph_free_normalized_digest(norms[m]);
+        free(cands[m].coeffs);
+    }
+    free(query.coeffs);
+    return errors;
+}
+
+int main(int argc, char **argv) {
+    int count = (argc > 1) ? atoi(argv[1]) : 2000;
+    if (count <= 0) {
+        printf("usage: %s [number of candidates]\n", argv[0]);
+        return 1;
+    }
+
+    std::mt19937_64 rng(12345);
+    int errors = 0;
+
+    /* sizes around the simd widths and the default digest size */
+    const int sizes[] = {1, 3, 7, 8, 9, 40, 180};
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        errors += check(sizes[s], count, 0.90, rng);
+    }
+    errors += check(180, count, 0.50, rng);
+
+    /* no candidates and bad arguments */
+    Digest query;
+    random_digest(query, 180, rng);
+    NormDigest nq;
+    ph_normalize_digest(query, nq);
+    if (ph_crosscorr_many(nq, NULL, 0, NULL, NULL) != 0)
+        errors++;
+    if (ph_crosscorr_many(nq, NULL, 1, NULL, NULL) >= 0)
+        errors++;
+    ph_free_normalized_digest(nq);
+    free(query.coeffs);
+
+    printf("%s\n", errors ? "results differ from ph_crosscorr" : "results match ph_crosscorr");
+    return errors ? 1 : 0;
+}
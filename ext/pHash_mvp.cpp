@@ -1,11 +1,27 @@
 #include "pHash_mvp.h"
+#include "pHash_mvptree.h"
+#include "ph_pool.h"
+#include <math.h>
+#include <algorithm>
+#include <atomic>
 #include <fstream>
+#include <mutex>
 #include <string>
+#include <vector>
 #include "sqlite3/sqlite3.h"
 #include "nlohmann/json.hpp"
 
 using json = nlohmann::json;
 
+/* database user_version: 0 stored hashes as JSON text, 1 as BLOBs without the
+ * image substring columns */
+#define PH_MVP_SCHEMA_VERSION 2
+
+/* image_hashes keeps the four 16-bit substrings of 64-bit hashes in indexed
+ * columns h0..h3 (NULL for other hashes) for radius queries */
+#define PH_MVP_SUBSTRINGS 4
+#define PH_MVP_MAX_SUBSTRING_BITS 2 /* widest per substring neighbourhood searched through the indexes */
+
 float hammingdistance(DP *pntA, DP *pntB) {
     HashDataType hdataTypeA = pntA->hash_datatype;
     HashDataType hdataTypeB = pntB->hash_datatype;
@@ -26,6 +42,67 @@ static bool ph_file_exists(const std::string& filename) {
     return file.good();
 }
 
+// tree index kept next to the database, see pHash_mvptree.h
+static std::string ph_mvp_tree_name(const std::string &base) {
+    return base + ".mvp";
+}
+
+typedef struct ph_mvp_collect {
+    DP **results;
+    int count;
+    int capacity;
+    bool failed; // out of memory, results holds what was collected before
+} MVPCollect;
+
+static void ph_mvp_free_dp(DP *dp) {
+    free(dp->id);
+    free(dp->path);
+    free(dp->hash);
+    free(dp);
+}
+
+// malloc'd copy of a point borrowed from the tree mapping or a query row,
+// NULL when out of memory
+static DP *ph_mvp_copy_dp(const DP *dp) {
+    DP *copy = (DP *)calloc(1, sizeof(DP));
+    if (!copy)
+        return nullptr;
+    copy->hash_length = dp->hash_length;
+    copy->hash_datatype = dp->hash_datatype;
+    copy->hash_type = dp->hash_type;
+    const size_t hashBytes = (size_t)dp->hash_length * dp->hash_datatype;
+    copy->id = strdup(dp->id);
+    copy->path = dp->path ? strdup(dp->path) : NULL;
+    copy->hash = malloc(hashBytes);
+    if (!copy->id || (dp->path && !copy->path) || !copy->hash) {
+        ph_mvp_free_dp(copy);
+        return nullptr;
+    }
+    memcpy(copy->hash, dp->hash, hashBytes);
+    return copy;
+}
+
+static int ph_mvp_collect_point(const DP *dp, float /* distance */, void *ctx) {
+    MVPCollect *c = (MVPCollect *)ctx;
+    if (c->count == c->capacity) {
+        const int capacity = c->capacity ? 2 * c->capacity : 16;
+        DP **results = (DP **)realloc(c->results, capacity * sizeof(DP *));
+        if (!results) {
+            c->failed = true;
+            return 1;
+        }
+        c->results = results;
+        c->capacity = capacity;
+    }
+    DP *copy = ph_mvp_copy_dp(dp);
+    if (!copy) {
+        c->failed = true;
+        return 1;
+    }
+    c->results[c->count++] = copy;
+    return 0;
+}
+
 static std::string ph_db_table_name(const HashType hash_type) {
     std::string tableName;
     switch (hash_type) {
@@ -47,40 +124,28 @@ static std::string ph_db_table_name(const HashType hash_type) {
     return tableName;
 }
 
-// Serialize array data to JSON strings
-std::string serializeArray(const void *array, uint32_t length, HashDataType datatype) {
-    json jsonData;
-    switch (datatype) {
-        case BYTEARRAY: {
-            const uint8_t *byteArray = static_cast<const uint8_t *>(array);
-            jsonData["hash"] = std::vector<uint8_t>(byteArray, byteArray + length);
-            break;
-        }
-        case UINT16ARRAY: {
-            const uint16_t *uint16Array = static_cast<const uint16_t *>(array);
-            jsonData["hash"] = std::vector<uint16_t>(uint16Array, uint16Array + length);
-            break;
-        }
-        case UINT32ARRAY: {
-            const uint32_t *uint32Array = static_cast<const uint32_t *>(array);
-            jsonData["hash"] = std::vector<uint32_t>(uint32Array, uint32Array + length);
-            break;
-        }
-        case UINT64ARRAY: {
-            const uint64_t *uint64Array = static_cast<const uint64_t *>(array);
-            jsonData["hash"] = std::vector<uint64_t>(uint64Array, uint64Array + length);
-            break;
-        }
-        default: {
-            // Handle the case when datatype is not recognized
-            fprintf(stderr, "Unsupported HashDataType(%d)\n", datatype);
-            break;
-        }
+static inline bool ph_host_little_endian() {
+    const uint16_t one = 1;
+    return *(const uint8_t *)&one == 1;
+}
+
+// hashes are stored as little-endian BLOBs, elements of datatype bytes
+static void ph_hash_le_copy(void *dst, const void *src, uint32_t length, HashDataType datatype) {
+    const size_t size = datatype;
+    if (ph_host_little_endian() || size == 1) {
+        memcpy(dst, src, length * size);
+        return;
+    }
+    const uint8_t *s = (const uint8_t *)src;
+    uint8_t *d = (uint8_t *)dst;
+    for (uint32_t i = 0; i < length; i++, s += size, d += size) {
+        for (size_t k = 0; k < size; k++)
+            d[k] = s[size - 1 - k];
     }
-    return jsonData.dump();
 }
 
-// Deserialize JSON strings into arrays of data
+// Deserialize JSON strings into arrays of data, for databases written before
+// hashes were stored as BLOBs
 static void deserializeArray(const std::string &jsonString, void **array, uint32_t length, HashDataType datatype) {
     json jsonData = json::parse(jsonString);
     switch (datatype) {
@@ -116,472 +181,1195 @@ static void deserializeArray(const std::string &jsonString, void **array, uint32
     }
 }
 
-MVPRetCode ph_sizeof_mvptree(MVPFile *m, int64_t &result) {
-    if (!m)
-        return PH_ERRNULLARG;
+// hamming(a, b): differing bits of two equal length blobs, NULL otherwise
+static void ph_sql_hamming(sqlite3_context *ctx, int /* argc */, sqlite3_value **argv) {
+    const int len = sqlite3_value_bytes(argv[0]);
+    if (sqlite3_value_type(argv[0]) != SQLITE_BLOB || sqlite3_value_type(argv[1]) != SQLITE_BLOB ||
+        len != sqlite3_value_bytes(argv[1])) {
+        sqlite3_result_null(ctx);
+        return;
+    }
+    const uint8_t *a = (const uint8_t *)sqlite3_value_blob(argv[0]);
+    const uint8_t *b = (const uint8_t *)sqlite3_value_blob(argv[1]);
+    sqlite3_result_int(ctx, ph_hamming_bytes(a, b, len));
+}
 
-    char mainSqlite[MAX_PATH];
-    snprintf(mainSqlite, sizeof(mainSqlite), "%s.db", m->filename);
-    if (!ph_file_exists(mainSqlite)) {
-        fprintf(stderr, "File %s does not exist!\n", mainSqlite);
-        return PH_ERRFILEEXIST;
+// hamming_le(a, b, k): 1 when two equal length blobs differ in at most k bits
+static void ph_sql_hamming_le(sqlite3_context *ctx, int /* argc */, sqlite3_value **argv) {
+    const int len = sqlite3_value_bytes(argv[0]);
+    const int k = sqlite3_value_int(argv[2]);
+    if (sqlite3_value_type(argv[0]) != SQLITE_BLOB || sqlite3_value_type(argv[1]) != SQLITE_BLOB ||
+        len != sqlite3_value_bytes(argv[1]) || k < 0) {
+        sqlite3_result_int(ctx, 0);
+        return;
     }
+    const uint8_t *a = (const uint8_t *)sqlite3_value_blob(argv[0]);
+    const uint8_t *b = (const uint8_t *)sqlite3_value_blob(argv[1]);
+    sqlite3_result_int(ctx, ph_hamming_bytes(a, b, len, k) <= k);
+}
 
-    sqlite3 *db;
-    int rc = sqlite3_open(mainSqlite, &db);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(db));
-        return PH_ERRFILEOPEN;
+static int ph_mvp_register_functions(sqlite3 *db) {
+    const int flags = SQLITE_UTF8 | SQLITE_DETERMINISTIC;
+    int rc = sqlite3_create_function_v2(db, "hamming", 2, flags, nullptr, ph_sql_hamming, nullptr, nullptr, nullptr);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_create_function_v2(db, "hamming_le", 3, flags, nullptr, ph_sql_hamming_le, nullptr, nullptr,
+                                        nullptr);
+    return rc;
+}
+
+static inline int ph_hash_substring(ulong64 hash, int i) {
+    return (int)((hash >> (16 * i)) & 0xffff);
+}
+
+// the image hashes with substring columns are the single 64-bit ones
+static inline bool ph_has_substrings(const DP *dp) {
+    return dp->hash_datatype == UINT64ARRAY && dp->hash_length == 1;
+}
+
+static std::string ph_mvp_substring_indexes(const std::string &table) {
+    std::string sql;
+    for (int i = 0; i < PH_MVP_SUBSTRINGS; i++) {
+        const std::string col = "h" + std::to_string(i);
+        sql += "CREATE INDEX IF NOT EXISTS " + table + "_" + col + " ON " + table + " (" + col + ");";
     }
+    return sql;
+}
 
-    const char *querySql = "SELECT page_count * page_size FROM pragma_page_count(), pragma_page_size();";
-    sqlite3_stmt *stmt;
-    rc = sqlite3_prepare_v2(db, querySql, -1, &stmt, nullptr);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Sqlite3 Prepare failed: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
-        sqlite3_close(db);
-        return PH_ERRPREPARE;
+// one database file and its tree index, used by one thread at a time
+typedef struct ph_mvp_shard {
+    const MVPFile *file; /* the handle's */
+    std::string table;
+    std::string base; /* file name without the .db / .mvp extension */
+    sqlite3 *db;
+    /* prepared on first use, then reset and rebound for every call */
+    sqlite3_stmt *insert;
+    sqlite3_stmt *select_id;
+    sqlite3_stmt *select_all;
+    sqlite3_stmt *db_size;
+    sqlite3_stmt *near[PH_MVP_MAX_SUBSTRING_BITS + 1]; /* radius queries by substrings within 0, 1, 2 bits */
+    sqlite3_stmt *near_scan;                          /* wider radius queries, filtered in the engine */
+    sqlite3_stmt *nearest;                            /* k nearest, sorted by the engine */
+    int substrings;                                   /* the table has the h0..h3 columns */
+    MVPTree *tree;                 /* NULL without a tree index */
+    std::vector<uint64_t> scratch; /* hash in host order when a row's can't be used in place */
+} MVPShard;
+
+struct ph_mvp_handle {
+    MVPFile file; /* filename owned by the handle */
+    std::vector<MVPShard *> shards;
+    int threads; /* for running the shards at once */
+};
+
+static sqlite3_stmt *ph_mvp_statement(MVPShard *h, sqlite3_stmt **stmt, const std::string &sql) {
+    if (!*stmt && sqlite3_prepare_v3(h->db, sql.c_str(), -1, SQLITE_PREPARE_PERSISTENT, stmt, nullptr) != SQLITE_OK) {
+        fprintf(stderr, "Sqlite3 Prepare failed: %s\n", sqlite3_errmsg(h->db));
+        sqlite3_finalize(*stmt);
+        *stmt = nullptr;
     }
+    return *stmt;
+}
 
-    MVPRetCode ret = PH_SUCCESS;
-    result = 0;
+// borrowed view of an (id, hash, path, hash_length, hash_datatype) row, valid
+// until the next step; the hash points into the row when it is aligned and in
+// host order, into the handle's scratch buffer otherwise
+static bool ph_mvp_row_view(MVPShard *h, sqlite3_stmt *stmt, DP *dp) {
+    dp->id = (char *)sqlite3_column_text(stmt, 0);
+    dp->path = (char *)sqlite3_column_text(stmt, 2);
+    dp->hash_length = sqlite3_column_int(stmt, 3);
+    dp->hash_datatype = static_cast<HashDataType>(sqlite3_column_int(stmt, 4));
+    dp->hash_type = h->file->hash_type;
+    if (dp->hash_datatype != BYTEARRAY && dp->hash_datatype != UINT16ARRAY && dp->hash_datatype != UINT32ARRAY &&
+        dp->hash_datatype != UINT64ARRAY)
+        return false;
+
+    const size_t hashBytes = (size_t)dp->hash_length * dp->hash_datatype;
+    h->scratch.resize((hashBytes + 7) / 8);
+    if (sqlite3_column_type(stmt, 1) == SQLITE_TEXT) {
+        void *hash = nullptr;
+        deserializeArray((const char *)sqlite3_column_text(stmt, 1), &hash, dp->hash_length, dp->hash_datatype);
+        if (!hash)
+            return false;
+        memcpy(h->scratch.data(), hash, hashBytes);
+        free(hash);
+        dp->hash = h->scratch.data();
+        return true;
+    }
 
-    rc = sqlite3_step(stmt);
-    if (rc == SQLITE_ROW) {
-        result = sqlite3_column_int64(stmt, 0);
+    const void *blob = sqlite3_column_blob(stmt, 1);
+    if ((size_t)sqlite3_column_bytes(stmt, 1) != hashBytes)
+        return false;
+    if (ph_host_little_endian() && ((uintptr_t)blob % dp->hash_datatype) == 0) {
+        dp->hash = (void *)blob;
     } else {
-        ret = PH_ERRDPFOUND;
+        ph_hash_le_copy(h->scratch.data(), blob, dp->hash_length, dp->hash_datatype);
+        dp->hash = h->scratch.data();
     }
+    return true;
+}
 
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
-
-    return ret;
+static std::string ph_mvp_insert_sql(MVPShard *h) {
+    if (h->substrings)
+        return "INSERT INTO " + h->table +
+               " (id, hash, path, hash_length, hash_datatype, h0, h1, h2, h3) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)";
+    return "INSERT INTO " + h->table + " (id, hash, path, hash_length, hash_datatype) VALUES (?, ?, ?, ?, ?)";
 }
 
-MVPRetCode ph_query_mvptree(MVPFile *m, const char *id, DP *result) {
-    if (!m || !id) {
-        return PH_ERRNULLARG;
-    }
+static int ph_mvp_insert_row(MVPShard *h, sqlite3_stmt *stmt, DP *dp) {
+    sqlite3_bind_text(stmt, 1, dp->id, -1, SQLITE_STATIC);
 
-    char mainSqlite[MAX_PATH];
-    snprintf(mainSqlite, sizeof(mainSqlite), "%s.db", m->filename);
-    if (!ph_file_exists(mainSqlite)) {
-        fprintf(stderr, "File %s does not exist!\n", mainSqlite);
-        return PH_ERRFILEEXIST;
+    const size_t hashBytes = (size_t)dp->hash_length * dp->hash_datatype;
+    const void *hash = dp->hash;
+    if (!ph_host_little_endian()) {
+        h->scratch.resize((hashBytes + 7) / 8);
+        ph_hash_le_copy(h->scratch.data(), dp->hash, dp->hash_length, dp->hash_datatype);
+        hash = h->scratch.data();
     }
+    sqlite3_bind_blob(stmt, 2, hash, (int)hashBytes, SQLITE_STATIC);
 
-    sqlite3 *db;
-    int rc = sqlite3_open(mainSqlite, &db);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(db));
-        return PH_ERRFILEOPEN;
+    if (dp->path == nullptr)
+        sqlite3_bind_text(stmt, 3, "NO INPUT", -1, SQLITE_STATIC);
+    else
+        sqlite3_bind_text(stmt, 3, dp->path, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 4, dp->hash_length);
+    sqlite3_bind_int(stmt, 5, dp->hash_datatype);
+    for (int i = 0; h->substrings && i < PH_MVP_SUBSTRINGS; i++) {
+        if (ph_has_substrings(dp))
+            sqlite3_bind_int(stmt, 6 + i, ph_hash_substring(*(ulong64 *)dp->hash, i));
+        else
+            sqlite3_bind_null(stmt, 6 + i);
     }
 
+    int rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    return rc;
+}
+
+static bool ph_mvp_has_column(sqlite3 *db, const std::string &table, const char *column) {
     sqlite3_stmt *stmt;
-    std::string selectQuery = "SELECT * FROM " + ph_db_table_name(m->hash_type) + " WHERE id = ?;";
-    rc = sqlite3_prepare_v2(db, selectQuery.c_str(), -1, &stmt, nullptr);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Sqlite3 Prepare failed: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
-        sqlite3_close(db);
-        return PH_ERRPREPARE;
+    bool found = false;
+    if (sqlite3_prepare_v2(db, ("PRAGMA table_info(" + table + ");").c_str(), -1, &stmt, nullptr) == SQLITE_OK) {
+        while (!found && sqlite3_step(stmt) == SQLITE_ROW)
+            found = strcmp((const char *)sqlite3_column_text(stmt, 1), column) == 0;
     }
+    sqlite3_finalize(stmt);
+    return found;
+}
 
+// version 0 to 1: JSON text hashes become BLOBs
+static MVPRetCode ph_mvp_migrate_blobs(sqlite3 *db, int64_t &converted) {
     MVPRetCode ret = PH_SUCCESS;
+    const HashType types[] = {IMAGE, AUDIO, VIDEO, TEXT};
+    for (HashType type : types) {
+        const std::string table = ph_db_table_name(type);
+        sqlite3_stmt *select, *update;
+        if (sqlite3_prepare_v2(db, ("SELECT id, hash, hash_length, hash_datatype FROM " + table +
+                                    " WHERE typeof(hash) = 'text';").c_str(), -1, &select, nullptr) != SQLITE_OK) {
+            sqlite3_finalize(select);
+            continue; /* no such table */
+        }
+        if (sqlite3_prepare_v2(db, ("UPDATE " + table + " SET hash = ? WHERE id = ?;").c_str(), -1, &update,
+                               nullptr) != SQLITE_OK) {
+            fprintf(stderr, "Sqlite3 Prepare failed: %s\n", sqlite3_errmsg(db));
+            sqlite3_finalize(select);
+            sqlite3_finalize(update);
+            ret = PH_ERRPREPARE;
+            break;
+        }
+        while (ret == PH_SUCCESS && sqlite3_step(select) == SQLITE_ROW) {
+            const uint32_t length = sqlite3_column_int(select, 2);
+            const HashDataType datatype = static_cast<HashDataType>(sqlite3_column_int(select, 3));
+            void *hash = nullptr;
+            deserializeArray((const char *)sqlite3_column_text(select, 1), &hash, length, datatype);
+            if (!hash)
+                continue;
+            std::vector<uint8_t> blob((size_t)length * datatype);
+            ph_hash_le_copy(blob.data(), hash, length, datatype);
+            free(hash);
+
+            sqlite3_bind_blob(update, 1, blob.data(), (int)blob.size(), SQLITE_STATIC);
+            sqlite3_bind_text(update, 2, (const char *)sqlite3_column_text(select, 0), -1, SQLITE_STATIC);
+            if (sqlite3_step(update) != SQLITE_DONE) {
+                fprintf(stderr, "Hash migration failed: %s\n", sqlite3_errmsg(db));
+                ret = PH_ERRINSERT;
+            }
+            sqlite3_reset(update);
+            converted++;
+        }
+        sqlite3_finalize(select);
+        sqlite3_finalize(update);
+    }
+    return ret;
+}
 
-    sqlite3_bind_text(stmt, 1, id, -1, SQLITE_STATIC);
-    rc = sqlite3_step(stmt);
-    if (rc == SQLITE_ROW) {
-        const char *retrievedId = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
-        size_t idLength = std::strlen(retrievedId);
-        result->id = (char*)malloc((idLength + 1) * sizeof(char));
-        std::strcpy(result->id, retrievedId);
-
-        const char *retrievedPath = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 2));
-        size_t pathLength = std::strlen(retrievedPath);
-        result->path = (char*)malloc((pathLength + 1) * sizeof(char));
-
-        std::strcpy(result->path, retrievedPath);
+// version 1 to 2: image_hashes gets the indexed substring columns
+static MVPRetCode ph_mvp_migrate_substrings(sqlite3 *db) {
+    const std::string table = ph_db_table_name(IMAGE);
+    sqlite3_stmt *select;
+    if (sqlite3_prepare_v2(db, ("SELECT id, hash FROM " + table + " WHERE hash_datatype = " +
+                                std::to_string(UINT64ARRAY) + " AND hash_length = 1;").c_str(), -1, &select,
+                           nullptr) != SQLITE_OK) {
+        sqlite3_finalize(select);
+        return PH_SUCCESS; /* no such table */
+    }
 
-        result->hash_length = sqlite3_column_int(stmt, 3);
-        result->hash_datatype = static_cast<HashDataType>(sqlite3_column_int(stmt, 4));
+    std::string alter;
+    for (int i = 0; i < PH_MVP_SUBSTRINGS; i++) {
+        const std::string col = "h" + std::to_string(i);
+        if (!ph_mvp_has_column(db, table, col.c_str()))
+            alter += "ALTER TABLE " + table + " ADD COLUMN " + col + " INTEGER;";
+    }
+    sqlite3_stmt *update = nullptr;
+    if (sqlite3_exec(db, alter.c_str(), 0, 0, 0) != SQLITE_OK ||
+        sqlite3_prepare_v2(db, ("UPDATE " + table + " SET h0 = ?, h1 = ?, h2 = ?, h3 = ? WHERE id = ?;").c_str(), -1,
+                           &update, nullptr) != SQLITE_OK) {
+        fprintf(stderr, "Substring migration failed: %s\n", sqlite3_errmsg(db));
+        sqlite3_finalize(select);
+        sqlite3_finalize(update);
+        return PH_ERRTABLECREATE;
+    }
 
-        const unsigned char *retrievedHashJson = sqlite3_column_text(stmt, 1);
-        std::string hashJson(reinterpret_cast<const char *>(retrievedHashJson));
-        deserializeArray(hashJson, &(result->hash), result->hash_length, result->hash_datatype);
-    } else {
-        ret = PH_ERRDPFOUND;
+    MVPRetCode ret = PH_SUCCESS;
+    while (ret == PH_SUCCESS && sqlite3_step(select) == SQLITE_ROW) {
+        if (sqlite3_column_type(select, 1) != SQLITE_BLOB || sqlite3_column_bytes(select, 1) != sizeof(ulong64))
+            continue;
+        ulong64 hash;
+        ph_hash_le_copy(&hash, sqlite3_column_blob(select, 1), 1, UINT64ARRAY);
+        for (int i = 0; i < PH_MVP_SUBSTRINGS; i++)
+            sqlite3_bind_int(update, 1 + i, ph_hash_substring(hash, i));
+        sqlite3_bind_text(update, 5, (const char *)sqlite3_column_text(select, 0), -1, SQLITE_STATIC);
+        if (sqlite3_step(update) != SQLITE_DONE) {
+            fprintf(stderr, "Substring migration failed: %s\n", sqlite3_errmsg(db));
+            ret = PH_ERRINSERT;
+        }
+        sqlite3_reset(update);
     }
+    sqlite3_finalize(select);
+    sqlite3_finalize(update);
 
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
+    if (ret == PH_SUCCESS && sqlite3_exec(db, ph_mvp_substring_indexes(table).c_str(), 0, 0, 0) != SQLITE_OK) {
+        fprintf(stderr, "Substring index failed: %s\n", sqlite3_errmsg(db));
+        ret = PH_ERRTABLECREATE;
+    }
     return ret;
 }
 
-MVPRetCode ph_query_mvptree(MVPFile *m, DP *query, float threshold, DP **results, int *count) {
-    if (!m || !query || !results || !count) {
-        return PH_ERRNULLARG;
-    }
-
-    if (m->hash_type != query->hash_type)
-        return PH_ERRHASHTYPE;
-
-    hash_compareCB hashdist = m->hashdist;
-    if (!hashdist)
-        return PH_ERRNULLARG;
+// bring databases from before PH_MVP_SCHEMA_VERSION up to date, once
+static MVPRetCode ph_mvp_migrate(sqlite3 *db) {
+    sqlite3_stmt *stmt;
+    int version = 0;
+    if (sqlite3_prepare_v2(db, "PRAGMA user_version;", -1, &stmt, nullptr) == SQLITE_OK &&
+        sqlite3_step(stmt) == SQLITE_ROW)
+        version = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+    if (version >= PH_MVP_SCHEMA_VERSION)
+        return PH_SUCCESS;
 
-    char mainSqlite[MAX_PATH];
-    snprintf(mainSqlite, sizeof(mainSqlite), "%s.db", m->filename);
-    if (!ph_file_exists(mainSqlite)) {
-        fprintf(stderr, "File %s does not exist!\n", mainSqlite);
-        return PH_ERRFILEEXIST;
+    if (sqlite3_exec(db, "BEGIN TRANSACTION", 0, 0, 0) != SQLITE_OK) {
+        fprintf(stderr, "Failed to start transaction.\n");
+        return PH_ERRTABLECREATE;
     }
 
-    // Open the database
-    sqlite3 *db;
-    int rc = sqlite3_open(mainSqlite, &db);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(db));
-        return PH_ERRFILEOPEN;
+    int64_t converted = 0;
+    MVPRetCode ret = PH_SUCCESS;
+    if (version < 1)
+        ret = ph_mvp_migrate_blobs(db, converted);
+    if (ret == PH_SUCCESS && version < 2)
+        ret = ph_mvp_migrate_substrings(db);
+
+    if (ret == PH_SUCCESS)
+        sqlite3_exec(db, ("PRAGMA user_version = " + std::to_string(PH_MVP_SCHEMA_VERSION) + ";").c_str(), 0, 0, 0);
+    if (sqlite3_exec(db, ret == PH_SUCCESS ? "COMMIT" : "ROLLBACK", 0, 0, 0) != SQLITE_OK) {
+        fprintf(stderr, "Failed to commit transaction.\n");
+        return PH_ERRSUBMIT;
     }
+    // give the space of the text hashes back
+    if (ret == PH_SUCCESS && converted > 0)
+        sqlite3_exec(db, "VACUUM;", 0, 0, 0);
+    return ret;
+}
 
-    // Prepare the query statement
-    std::string querySql = "SELECT * FROM ";
-    querySql += ph_db_table_name(m->hash_type);
+// a tree index missing points is not used again by this handle, and no
+// longer matches the row count when the database is next opened
+static void ph_mvp_drop_tree(MVPShard *h) {
+    ph_mvptree_close(h->tree);
+    h->tree = nullptr;
+}
 
-    sqlite3_stmt *stmt;
-    rc = sqlite3_prepare_v2(db, querySql.c_str(), -1, &stmt, nullptr);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Sqlite3 Prepare failed: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
-        sqlite3_close(db);
+// insert the valid points in one transaction, saved gets the ones stored;
+// with index, each row is also added to the tree index before the commit
+static MVPRetCode ph_mvp_insert_rows(MVPShard *h, DP **points, int nbpoints, bool index, std::vector<DP *> &saved) {
+    sqlite3_stmt *stmt = ph_mvp_statement(h, &h->insert, ph_mvp_insert_sql(h));
+    if (!stmt)
         return PH_ERRPREPARE;
-    }
 
-    // Execute the query and process the results
-    int resultCount = 0;
-    DP **queryResults = nullptr;
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        // Create a DP struct to hold the retrieved data
-        DP *dp = (DP *)malloc(sizeof(DP));
-
-        const unsigned char *id = sqlite3_column_text(stmt, 0);
-        dp->id = strdup((const char *)id);
+    // start transaction
+    int rc = sqlite3_exec(h->db, "BEGIN TRANSACTION", 0, 0, 0);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to start transaction.\n");
+        return PH_ERRTABLECREATE;
+    }
 
-        const unsigned char *path = sqlite3_column_text(stmt, 2);
-        dp->path = strdup((const char *)path);
+    for (int i = 0; i < nbpoints; ++i) {
+        DP *dp = points[i];
+        if (dp->hash_type != h->file->hash_type) {
+            fprintf(stderr, "Failed to insert data point. Input points[%d]->hash_type != MVPFile->hash_type.\n", i);
+            continue;
+        }
 
-        dp->hash_length = sqlite3_column_int(stmt, 3);
-        dp->hash_datatype = static_cast<HashDataType>(sqlite3_column_int(stmt, 4));
+        if (dp->id == nullptr) {
+            fprintf(stderr, "Failed to insert data point. Input points[%d]->id is NULL.\n", i);
+            continue;
+        }
 
-        // hash code
-        const unsigned char *retrievedHashJson = sqlite3_column_text(stmt, 1);
-        std::string hashJson(reinterpret_cast<const char *>(retrievedHashJson));
-        deserializeArray(hashJson, &dp->hash, dp->hash_length, dp->hash_datatype);
+        if (dp->hash == nullptr) {
+            fprintf(stderr, "Failed to insert data point. Input points[%d]->hash is NULL.\n", i);
+            continue;
+        }
 
-        // Compare the query DP with the retrieved DP using the comparison function
-        if (hashdist(query, dp) < threshold) {
-            // DP matches the query criteria, add it to the results array
-            queryResults = (DP **)realloc(queryResults, (resultCount + 1) * sizeof(DP *));
-            queryResults[resultCount] = dp;
-            resultCount++;
-        } else {
-            // DP doesn't match, free the allocated memory
-            free(dp->id);
-            free(dp->hash);
-            free(dp->path);
-            free(dp);
+        if (ph_mvp_insert_row(h, stmt, dp) != SQLITE_DONE) {
+            fprintf(stderr, "Failed to insert data point %d: %s\n", i, sqlite3_errmsg(h->db));
+            continue;
+        }
+        saved.push_back(dp);
+        if (index && h->tree && ph_mvptree_insert(h->tree, const_cast<MVPFile *>(h->file), dp) != PH_SUCCESS) {
+            fprintf(stderr, "Failed to index data point %s, queries scan until the tree is rebuilt.\n", dp->id);
+            ph_mvp_drop_tree(h);
         }
     }
 
-    // Finalize the query statement
-    sqlite3_finalize(stmt);
+    // commit transaction
+    rc = sqlite3_exec(h->db, "COMMIT", 0, 0, 0);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to commit transaction.\n");
+        sqlite3_exec(h->db, "ROLLBACK", 0, 0, 0);
+        if (index && !saved.empty())
+            ph_mvp_drop_tree(h);
+        saved.clear();
+        return PH_ERRSUBMIT;
+    }
+    return PH_SUCCESS;
+}
 
-    // Close the database
-    sqlite3_close(db);
+static int ph_mvp_pragma_int(sqlite3 *db, const char *pragma) {
+    sqlite3_stmt *stmt;
+    int value = 0;
+    if (sqlite3_prepare_v2(db, ("PRAGMA " + std::string(pragma) + ";").c_str(), -1, &stmt, nullptr) == SQLITE_OK &&
+        sqlite3_step(stmt) == SQLITE_ROW)
+        value = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+    return value;
+}
 
-    // Assign the results and count to the output parameters
-    results = queryResults;
-    *count = resultCount;
+static void ph_mvp_close_shard(MVPShard *h) {
+    if (!h)
+        return;
+    sqlite3_finalize(h->insert);
+    sqlite3_finalize(h->select_id);
+    sqlite3_finalize(h->select_all);
+    sqlite3_finalize(h->db_size);
+    for (int i = 0; i <= PH_MVP_MAX_SUBSTRING_BITS; i++)
+        sqlite3_finalize(h->near[i]);
+    sqlite3_finalize(h->near_scan);
+    sqlite3_finalize(h->nearest);
+    sqlite3_close(h->db);
+    ph_mvptree_close(h->tree);
+    delete h;
+}
 
-    return PH_SUCCESS;
+static int64_t ph_mvp_row_count(MVPShard *h) {
+    sqlite3_stmt *stmt;
+    int64_t count = -1;
+    if (sqlite3_prepare_v2(h->db, ("SELECT count(*) FROM " + h->table + ";").c_str(), -1, &stmt, nullptr) ==
+            SQLITE_OK &&
+        sqlite3_step(stmt) == SQLITE_ROW)
+        count = sqlite3_column_int64(stmt, 0);
+    sqlite3_finalize(stmt);
+    return count;
 }
 
+// write the tree index of every row of the shard, replacing the old one
+static MVPRetCode ph_mvp_rebuild_tree(MVPShard *h, int branchfactor, int leafcapacity) {
+    ph_mvptree_close(h->tree);
+    h->tree = nullptr;
 
-MVPRetCode ph_create_mvptree(MVPFile *m) {
-    if (!m) {
-        return PH_ERRARG;
+    sqlite3_stmt *stmt =
+        ph_mvp_statement(h, &h->select_all, "SELECT id, hash, path, hash_length, hash_datatype FROM " + h->table);
+    if (!stmt)
+        return PH_ERRPREPARE;
+    std::vector<DP *> points;
+    MVPRetCode ret = PH_SUCCESS;
+    DP dp;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        if (!ph_mvp_row_view(h, stmt, &dp))
+            continue;
+        DP *copy = ph_mvp_copy_dp(&dp);
+        if (!copy) {
+            ret = PH_ERRMEMALLOC;
+            break;
+        }
+        points.push_back(copy);
     }
+    sqlite3_reset(stmt);
+
+    const std::string treeFile = ph_mvp_tree_name(h->base);
+    if (ret == PH_SUCCESS)
+        ret = ph_mvptree_build(treeFile.c_str(), const_cast<MVPFile *>(h->file), points.data(), (int)points.size(),
+                               branchfactor, leafcapacity);
+    for (DP *p : points)
+        ph_mvp_free_dp(p);
+    if (ret == PH_SUCCESS)
+        h->tree = ph_mvptree_open(treeFile.c_str(), 1);
+    return ret;
+}
 
-    char mainSqlite[MAX_PATH];
-    snprintf(mainSqlite, sizeof(mainSqlite), "%s.db", m->filename);
+// the tree is only used while it holds every row, queries scan otherwise
+static void ph_mvp_check_tree(MVPShard *h) {
+    if (h->tree && (int64_t)ph_mvptree_size(h->tree) != ph_mvp_row_count(h)) {
+        fprintf(stderr, "%s is out of date, not using it\n", ph_mvp_tree_name(h->base).c_str());
+        ph_mvp_drop_tree(h);
+    }
+}
 
+static MVPRetCode ph_mvp_open_shard(const MVPFile *m, const std::string &base, const MVPOptions *options,
+                                    MVPShard **shard) {
+    const std::string table = ph_db_table_name(m->hash_type);
+    const std::string mainSqlite = base + ".db";
+
+    int flags = SQLITE_OPEN_READONLY;
+    if (!options->readonly)
+        flags = SQLITE_OPEN_READWRITE | (options->create ? SQLITE_OPEN_CREATE : 0);
     sqlite3 *db;
-    int rc = sqlite3_open_v2(mainSqlite, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr);
+    int rc = sqlite3_open_v2(mainSqlite.c_str(), &db, flags, nullptr);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(db));
+        sqlite3_close(db);
         return PH_ERRFILEOPEN;
     }
 
-    std::string createTableQuery = "CREATE TABLE IF NOT EXISTS ";
-    createTableQuery += ph_db_table_name(m->hash_type);
-    createTableQuery += " (id TEXT PRIMARY KEY, hash TEXT, path TEXT, hash_length INTEGER, hash_datatype INTEGER);";
+    if (ph_mvp_register_functions(db) != SQLITE_OK) {
+        fprintf(stderr, "Can't register hamming functions: %s\n", sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return PH_ERRFILEOPEN;
+    }
+
+    std::string setup;
+    if (options->wal)
+        setup += "PRAGMA journal_mode=WAL;";
+    if (options->mmap_size > 0)
+        setup += "PRAGMA mmap_size=" + std::to_string(options->mmap_size) + ";";
+    if (options->cache_size != 0)
+        setup += "PRAGMA cache_size=" + std::to_string(options->cache_size) + ";";
+    // no file grows past MaxFileSize, inserts then fail with SQLITE_FULL
+    const int pageSize = ph_mvp_pragma_int(db, "page_size");
+    if (!options->readonly && pageSize > 0)
+        setup += "PRAGMA max_page_count=" + std::to_string(MaxFileSize / pageSize) + ";";
 
     char *errMsg = nullptr;
-    rc = sqlite3_exec(db, createTableQuery.c_str(), nullptr, nullptr, &errMsg);
+    rc = sqlite3_exec(db, setup.c_str(), nullptr, nullptr, &errMsg);
+    if (rc == SQLITE_OK && !options->readonly) {
+        MVPRetCode ret = ph_mvp_migrate(db);
+        if (ret != PH_SUCCESS) {
+            sqlite3_close(db);
+            return ret;
+        }
+    }
+
+    if (rc == SQLITE_OK && options->create) {
+        if (m->hash_type == IMAGE)
+            setup = "CREATE TABLE IF NOT EXISTS " + table +
+                    " (id TEXT PRIMARY KEY, hash BLOB, path TEXT, hash_length INTEGER, hash_datatype INTEGER,"
+                    " h0 INTEGER, h1 INTEGER, h2 INTEGER, h3 INTEGER);" +
+                    ph_mvp_substring_indexes(table);
+        else
+            setup = "CREATE TABLE IF NOT EXISTS " + table +
+                    " (id TEXT PRIMARY KEY, hash BLOB, path TEXT, hash_length INTEGER, hash_datatype INTEGER);";
+        rc = sqlite3_exec(db, setup.c_str(), nullptr, nullptr, &errMsg);
+    }
     if (rc != SQLITE_OK) {
-        fprintf(stderr, "Create table failed: %s\n", errMsg);
+        fprintf(stderr, "Database setup failed: %s\n", errMsg);
         sqlite3_free(errMsg);
         sqlite3_close(db);
         return PH_ERRTABLECREATE;
     }
 
-    sqlite3_close(db);
+    MVPShard *h = new MVPShard();
+    h->file = m;
+    h->table = table;
+    h->base = base;
+    h->db = db;
+    h->substrings = m->hash_type == IMAGE && ph_mvp_has_column(db, table, "h3");
+
+    // without a metric the tree can neither be queried nor kept up to date;
+    // a missing or out of date one is built from the rows on create
+    if (m->hashdist) {
+        h->tree = ph_mvptree_open(ph_mvp_tree_name(base).c_str(), !options->readonly);
+        ph_mvp_check_tree(h);
+    }
+    if (!h->tree && options->create && !options->readonly && m->hashdist) {
+        MVPRetCode ret = ph_mvp_rebuild_tree(h, 0, 0);
+        if (ret != PH_SUCCESS) {
+            ph_mvp_close_shard(h);
+            return ret;
+        }
+    }
+
+    *shard = h;
     return PH_SUCCESS;
 }
 
-MVPRetCode ph_create_mvptree(MVPFile *m, DP **points, int nbpoints) {
-    if ((!m) || (!points)) {
-        return PH_ERRARG;
-    }
+// <filename>.db alone, or shards <filename>.0.db, <filename>.1.db, ...
+static std::string ph_mvp_shard_base(const char *filename, int shard, int count) {
+    return count > 1 ? std::string(filename) + "." + std::to_string(shard) : std::string(filename);
+}
 
-    MVPRetCode ret = ph_create_mvptree(m);
-    if (ret != PH_SUCCESS) {
-        return ret;
+static int ph_mvp_shard_count(const char *filename) {
+    if (ph_file_exists(std::string(filename) + ".db"))
+        return 1;
+    int count = 0;
+    while (ph_file_exists(ph_mvp_shard_base(filename, count, 2) + ".db"))
+        count++;
+    return count;
+}
+
+// shard holding an id, FNV-1a so the layout is the same on every platform
+static MVPShard *ph_mvp_shard_of(MVPHandle *h, const char *id) {
+    uint64_t x = 14695981039346656037ULL;
+    for (const unsigned char *p = (const unsigned char *)id; *p; p++) {
+        x ^= *p;
+        x *= 1099511628211ULL;
     }
+    return h->shards[x % h->shards.size()];
+}
 
-    char mainSqlite[MAX_PATH];
-    snprintf(mainSqlite, sizeof(mainSqlite), "%s.db", m->filename);
+// points by shard, those without an id go to the first for the error report
+static std::vector<std::vector<DP *>> ph_mvp_route(MVPHandle *h, DP **points, int nbpoints) {
+    std::vector<std::vector<DP *>> routed(h->shards.size());
+    for (int i = 0; i < nbpoints; i++) {
+        size_t shard = 0;
+        if (points[i]->id) {
+            MVPShard *s = ph_mvp_shard_of(h, points[i]->id);
+            shard = std::find(h->shards.begin(), h->shards.end(), s) - h->shards.begin();
+        }
+        routed[shard].push_back(points[i]);
+    }
+    return routed;
+}
 
-    sqlite3 *db;
-    int rc = sqlite3_open(mainSqlite, &db);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(db));
-        return PH_ERRFILEOPEN;
+// run fn(shard, index) on every shard, on up to h->threads threads of the
+// library pool; returns the first error
+template <typename Fn>
+static MVPRetCode ph_mvp_scatter(MVPHandle *h, Fn fn) {
+    std::vector<MVPRetCode> rets(h->shards.size(), PH_SUCCESS);
+    ph_parallel_for((int)h->shards.size(), h->threads, [&](int i) { rets[i] = fn(h->shards[i], i); });
+    for (MVPRetCode ret : rets) {
+        if (ret != PH_SUCCESS)
+            return ret;
     }
+    return PH_SUCCESS;
+}
 
-    // add points
-    std::string insertQuery = "INSERT INTO ";
-    insertQuery += ph_db_table_name(m->hash_type);
-    insertQuery += " (id, hash, path, hash_length, hash_datatype) VALUES (?, ?, ?, ?, ?)";
+MVPRetCode ph_mvp_open(MVPFile *m, const MVPOptions *options, MVPHandle **handle) {
+    if (!m || !m->filename || !handle)
+        return PH_ERRNULLARG;
+    *handle = nullptr;
 
-    sqlite3_stmt *statement;
-    rc = sqlite3_prepare_v2(db, insertQuery.c_str(), -1, &statement, nullptr);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Sqlite3 Prepare failed: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(statement);
-        sqlite3_close(db);
-        return PH_ERRPREPARE;
-    }
+    const MVPOptions defaults = {0, 0, 0, 0, 0, 0, 0};
+    if (!options)
+        options = &defaults;
 
-    // Bind data
-    for (int i = 0; i < nbpoints; ++i) {
-        DP *dp = points[i];
-        if (dp->hash_type != m->hash_type) {
-            fprintf(stderr, "Failed to insert data point. Input points[%d]->hash_type != MVPFile->hash_type.\n", i);
-            continue;
+    if (ph_db_table_name(m->hash_type).empty())
+        return PH_ERRHASHTYPE;
+
+    int count = ph_mvp_shard_count(m->filename);
+    if (count == 0) {
+        if (!options->create) {
+            fprintf(stderr, "File %s.db does not exist!\n", m->filename);
+            return PH_ERRFILEEXIST;
         }
+        count = options->shards > 1 ? options->shards : 1;
+    } else if (options->shards > 1 && options->shards != count) {
+        fprintf(stderr, "%s has %d shards, not %d\n", m->filename, count, options->shards);
+        return PH_ERRARG;
+    }
 
-        if (dp->id == nullptr)
-        {
-            fprintf(stderr, "Failed to insert data point. Input points[%d]->id is NULL.\n", i);
-            continue;
+    MVPHandle *h = new MVPHandle();
+    h->file = *m;
+    h->file.filename = strdup(m->filename);
+    h->threads = options->threads;
+    for (int i = 0; i < count; i++) {
+        MVPShard *shard;
+        MVPRetCode ret = ph_mvp_open_shard(&h->file, ph_mvp_shard_base(m->filename, i, count), options, &shard);
+        if (ret != PH_SUCCESS) {
+            ph_mvp_close(h);
+            return ret;
         }
+        h->shards.push_back(shard);
+    }
 
-        if (dp->hash == nullptr) {
-            fprintf(stderr, "Failed to insert data point. Input points[%d]->hash is NULL.\n", i);
-            continue;
+    *handle = h;
+    return PH_SUCCESS;
+}
+
+void ph_mvp_close(MVPHandle *h) {
+    if (!h)
+        return;
+    for (MVPShard *shard : h->shards)
+        ph_mvp_close_shard(shard);
+    free(h->file.filename);
+    delete h;
+}
+
+MVPRetCode ph_mvp_size(MVPHandle *h, int64_t &result) {
+    if (!h)
+        return PH_ERRNULLARG;
+
+    result = 0;
+    for (MVPShard *s : h->shards) {
+        sqlite3_stmt *stmt = ph_mvp_statement(
+            s, &s->db_size, "SELECT page_count * page_size FROM pragma_page_count(), pragma_page_size();");
+        if (!stmt)
+            return PH_ERRPREPARE;
+
+        MVPRetCode ret = PH_SUCCESS;
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            result += sqlite3_column_int64(stmt, 0);
+        } else {
+            ret = PH_ERRDPFOUND;
         }
+        sqlite3_reset(stmt);
+        if (ret != PH_SUCCESS)
+            return ret;
+    }
+    return PH_SUCCESS;
+}
 
-        sqlite3_bind_text(statement, 1, dp->id, -1, SQLITE_STATIC);
+MVPRetCode ph_mvp_query(MVPHandle *h, const char *id, DP *result) {
+    if (!h || !id || !result)
+        return PH_ERRNULLARG;
 
-        // Serialize hash arrays to JSON strings
-        std::string hashJson = serializeArray(dp->hash, dp->hash_length, dp->hash_datatype);
-        sqlite3_bind_text(statement, 2, hashJson.c_str(), -1, SQLITE_STATIC);
+    MVPShard *s = ph_mvp_shard_of(h, id);
+    sqlite3_stmt *stmt = ph_mvp_statement(
+        s, &s->select_id, "SELECT id, hash, path, hash_length, hash_datatype FROM " + s->table + " WHERE id = ?;");
+    if (!stmt)
+        return PH_ERRPREPARE;
 
-        if (dp->path == nullptr)
-            sqlite3_bind_text(statement, 3, "NO INPUT", -1, SQLITE_STATIC);
-        else
-            sqlite3_bind_text(statement, 3, dp->path, -1, SQLITE_STATIC);
-        sqlite3_bind_int(statement, 4, dp->hash_length);
-        sqlite3_bind_int(statement, 5, dp->hash_datatype);
+    MVPRetCode ret = PH_SUCCESS;
+    sqlite3_bind_text(stmt, 1, id, -1, SQLITE_STATIC);
+    DP dp;
+    if (sqlite3_step(stmt) == SQLITE_ROW && ph_mvp_row_view(s, stmt, &dp)) {
+        result->id = strdup(dp.id);
+        result->path = strdup(dp.path);
+        result->hash_length = dp.hash_length;
+        result->hash_datatype = dp.hash_datatype;
+        result->hash_type = dp.hash_type;
+        const size_t hashBytes = (size_t)dp.hash_length * dp.hash_datatype;
+        result->hash = malloc(hashBytes);
+        memcpy(result->hash, dp.hash, hashBytes);
+    } else {
+        ret = PH_ERRDPFOUND;
+    }
+    sqlite3_reset(stmt);
+    return ret;
+}
 
-        rc = sqlite3_step(statement);
-        if (rc != SQLITE_DONE) {
-            fprintf(stderr, "Failed to intser dp[%d] point: %s\n", i, sqlite3_errmsg(db));
+// 16-bit masks of at most PH_MVP_MAX_SUBSTRING_BITS bits, by bit count
+static const std::vector<uint16_t> &ph_substring_masks() {
+    static const std::vector<uint16_t> masks = []() {
+        std::vector<uint16_t> m;
+        for (int bits = 0; bits <= PH_MVP_MAX_SUBSTRING_BITS; bits++) {
+            for (uint32_t v = 0; v <= 0xffff; v++) {
+                if (ph_hamming_distance(v, 0) == bits)
+                    m.push_back((uint16_t)v);
+            }
         }
+        return m;
+    }();
+    return masks;
+}
 
-        sqlite3_reset(statement);
+static size_t ph_substring_neighbours(int bits) {
+    size_t n = 0, c = 1;
+    for (int i = 0; i <= bits; i++) {
+        n += c;
+        c = c * (16 - i) / (i + 1);
     }
+    return n;
+}
 
-    sqlite3_finalize(statement);
-    sqlite3_close(db);
-    return ret;
+// hamming radius query run by the engine: when the radius is below
+// 4 * (PH_MVP_MAX_SUBSTRING_BITS + 1), one of the four 16-bit substrings of
+// every match is within radius / 4 bits of the query's, so the substring
+// indexes give the candidates; wider radii scan with hamming_le
+static MVPRetCode ph_mvp_visit_hamming(MVPShard *h, ulong64 query, int radius, mvptree_visitCB visit, void *ctx) {
+    const int bits = radius / PH_MVP_SUBSTRINGS;
+    sqlite3_stmt *stmt;
+    std::string sql = "SELECT id, hash, path, hash_length, hash_datatype, hamming(hash, ?1) FROM " + h->table + " WHERE ";
+    if (bits <= PH_MVP_MAX_SUBSTRING_BITS) {
+        const size_t n = ph_substring_neighbours(bits);
+        sql += "(";
+        for (int i = 0; i < PH_MVP_SUBSTRINGS; i++) {
+            sql += (i ? " OR h" : "h") + std::to_string(i) + " IN (";
+            for (size_t k = 0; k < n; k++)
+                sql += k ? ", ?" : "?";
+            sql += ")";
+        }
+        sql += ") AND hamming_le(hash, ?1, ?);";
+        stmt = ph_mvp_statement(h, &h->near[bits], sql);
+        if (!stmt)
+            return PH_ERRPREPARE;
+        const std::vector<uint16_t> &masks = ph_substring_masks();
+        int param = 2;
+        for (int i = 0; i < PH_MVP_SUBSTRINGS; i++) {
+            const int sub = ph_hash_substring(query, i);
+            for (size_t k = 0; k < n; k++)
+                sqlite3_bind_int(stmt, param++, sub ^ masks[k]);
+        }
+    } else {
+        stmt = ph_mvp_statement(h, &h->near_scan, sql + "hamming_le(hash, ?1, ?);");
+        if (!stmt)
+            return PH_ERRPREPARE;
+    }
+
+    ulong64 le;
+    ph_hash_le_copy(&le, &query, 1, UINT64ARRAY);
+    sqlite3_bind_blob(stmt, 1, &le, sizeof(le), SQLITE_STATIC);
+    sqlite3_bind_int(stmt, sqlite3_bind_parameter_count(stmt), radius);
+
+    DP dp;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        if (ph_mvp_row_view(h, stmt, &dp) && visit(&dp, (float)sqlite3_column_int(stmt, 5), ctx))
+            break;
+    }
+    sqlite3_reset(stmt);
+    return PH_SUCCESS;
 }
 
-MVPRetCode ph_add_mvptree(MVPFile *m, DP *new_dp) {
-    if ((!m) || (!new_dp) || (!new_dp->id) || (!new_dp->hash) )
-        return PH_ERRNULLARG;
+static inline bool ph_mvp_hamming_pushdown(MVPShard *h, DP *query) {
+    return h->file->hashdist == hammingdistance && h->substrings && ph_has_substrings(query);
+}
 
-    if (m->hash_type != new_dp->hash_type)
+// distances are whole numbers of bits, d < threshold is d <= radius
+static inline int ph_hamming_radius(float threshold) {
+    return (int)std::min(ceilf(threshold) - 1, 64.0f);
+}
+
+static MVPRetCode ph_mvp_check_query(MVPHandle *h, DP *query) {
+    if (!h || !query)
+        return PH_ERRNULLARG;
+    if (h->file.hash_type != query->hash_type)
         return PH_ERRHASHTYPE;
+    if (!h->file.hashdist)
+        return PH_ERRNULLARG;
+    return PH_SUCCESS;
+}
 
-    // check file exist
-    char mainSqlite[MAX_PATH];
-    snprintf(mainSqlite, sizeof(mainSqlite), "%s.db", m->filename);
-    if (!ph_file_exists(mainSqlite)) {
-        fprintf(stderr, "File %s does not exist!\n", mainSqlite);
-        return PH_ERRFILEEXIST;
+// visit every point of one shard with hashdist(query, point) < threshold
+// until visit returns non zero; the points are borrowed from the tree or
+// the query row
+static MVPRetCode ph_mvp_visit(MVPShard *h, DP *query, float threshold, mvptree_visitCB visit, void *ctx) {
+    hash_compareCB hashdist = h->file->hashdist;
+
+    // the substring indexes only narrow radii down, past them the tree
+    // prunes better than hamming_le scans every row
+    if (ph_mvp_hamming_pushdown(h, query)) {
+        if (threshold <= 0)
+            return PH_SUCCESS;
+        const int radius = ph_hamming_radius(threshold);
+        if (radius / PH_MVP_SUBSTRINGS <= PH_MVP_MAX_SUBSTRING_BITS || !h->tree)
+            return ph_mvp_visit_hamming(h, *(ulong64 *)query->hash, radius, visit, ctx);
     }
 
-    // open db
-    sqlite3 *db;
-    int rc = sqlite3_open(mainSqlite, &db);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(db));
-        return PH_ERRFILEOPEN;
+    // the tree only evaluates hashdist on the points it can't rule out
+    if (h->tree)
+        return ph_mvptree_query(h->tree, hashdist, query, threshold, visit, ctx);
+
+    sqlite3_stmt *stmt =
+        ph_mvp_statement(h, &h->select_all, "SELECT id, hash, path, hash_length, hash_datatype FROM " + h->table);
+    if (!stmt)
+        return PH_ERRPREPARE;
+
+    // rows are compared in place
+    DP dp;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        if (!ph_mvp_row_view(h, stmt, &dp))
+            continue;
+        const float d = hashdist(query, &dp);
+        if (d >= 0 && d < threshold && visit(&dp, d, ctx))
+            break;
     }
+    sqlite3_reset(stmt);
+    return PH_SUCCESS;
+}
 
-    MVPRetCode ret = PH_SUCCESS;
+MVPRetCode ph_mvp_query(MVPHandle *h, DP *query, float threshold, DP **&results, int &count) {
+    results = nullptr;
+    count = 0;
+    MVPRetCode ret = ph_mvp_check_query(h, query);
+    if (ret != PH_SUCCESS)
+        return ret;
 
-    // insert
-    std::string insertQuery = "INSERT INTO ";
-    insertQuery += ph_db_table_name(m->hash_type);
-    insertQuery += " (id, hash, path, hash_length, hash_datatype) VALUES (?, ?, ?, ?, ?)";
-    sqlite3_stmt *stmt;
-    rc = sqlite3_prepare_v2(db, insertQuery.c_str(), -1, &stmt, nullptr);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Sqlite3 Prepare failed: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
-        sqlite3_close(db);
-        return PH_ERRPREPARE;
+    std::vector<MVPCollect> collect(h->shards.size(), MVPCollect{nullptr, 0, 0, false});
+    ret = ph_mvp_scatter(h, [&](MVPShard *s, int i) {
+        return ph_mvp_visit(s, query, threshold, ph_mvp_collect_point, &collect[i]);
+    });
+    for (const MVPCollect &c : collect) {
+        if (ret == PH_SUCCESS && c.failed)
+            ret = PH_ERRMEMALLOC;
     }
 
-    // bind
-    sqlite3_bind_text(stmt, 1, new_dp->id, -1, SQLITE_STATIC);
+    // one array for the caller, taking the points of every shard's
+    for (const MVPCollect &c : collect)
+        count += c.count;
+    if (count > 0)
+        results = (DP **)malloc(count * sizeof(DP *));
+    if (count > 0 && !results) {
+        for (const MVPCollect &c : collect) {
+            for (int i = 0; i < c.count; i++)
+                ph_mvp_free_dp(c.results[i]);
+            free(c.results);
+        }
+        count = 0;
+        return PH_ERRMEMALLOC;
+    }
+    int n = 0;
+    for (const MVPCollect &c : collect) {
+        if (c.count > 0)
+            memcpy(results + n, c.results, c.count * sizeof(DP *));
+        n += c.count;
+        free(c.results);
+    }
+    return ret;
+}
 
-    // Serialize hash arrays to JSON strings
-    std::string hashJson = serializeArray(new_dp->hash, new_dp->hash_length, new_dp->hash_datatype);
-    sqlite3_bind_text(stmt, 2, hashJson.c_str(), -1, SQLITE_STATIC);
+// results of all shards go through one callback, one call at a time
+typedef struct ph_mvp_stream {
+    mvp_resultCB callback;
+    void *ctx;
+    std::mutex lock;
+    std::atomic<bool> stop;
+} MVPStream;
+
+static int ph_mvp_stream_point(const DP *dp, float distance, void *ctx) {
+    MVPStream *s = (MVPStream *)ctx;
+    std::lock_guard<std::mutex> guard(s->lock);
+    if (!s->stop && s->callback(dp->id, distance, dp->path, s->ctx))
+        s->stop = true;
+    return s->stop;
+}
 
-    if (new_dp->path == nullptr)
-        sqlite3_bind_text(stmt, 3, "NO INPUT", -1, SQLITE_STATIC);
-    else
-        sqlite3_bind_text(stmt, 3, new_dp->path, -1, SQLITE_STATIC);
-    sqlite3_bind_int(stmt, 4, new_dp->hash_length);
-    sqlite3_bind_int(stmt, 5, new_dp->hash_datatype);
+MVPRetCode ph_mvp_query(MVPHandle *h, DP *query, float threshold, mvp_resultCB callback, void *ctx) {
+    if (!callback)
+        return PH_ERRNULLARG;
+    MVPRetCode ret = ph_mvp_check_query(h, query);
+    if (ret != PH_SUCCESS)
+        return ret;
 
-    rc = sqlite3_step(stmt);  // run
-    if (rc != SQLITE_DONE) {
-        fprintf(stderr, "Insert data failed: %s\n", sqlite3_errmsg(db));
-        ret = PH_ERRINSERT;
+    MVPStream stream;
+    stream.callback = callback;
+    stream.ctx = ctx;
+    stream.stop = false;
+    return ph_mvp_scatter(h, [&](MVPShard *s, int) {
+        return stream.stop ? PH_SUCCESS : ph_mvp_visit(s, query, threshold, ph_mvp_stream_point, &stream);
+    });
+}
+
+typedef struct ph_mvp_heap_entry {
+    float distance;
+    std::string id;
+    std::string path;
+    bool operator<(const ph_mvp_heap_entry &other) const {
+        return distance < other.distance;
+    }
+} MVPHeapEntry;
+
+// max-heap of the k nearest points seen so far
+typedef struct ph_mvp_topk {
+    std::vector<MVPHeapEntry> heap;
+    size_t k;
+    float *radius; /* lowered to the k-th distance once there are k points, may be NULL */
+} MVPTopK;
+
+static void ph_mvp_topk_push(MVPTopK *t, MVPHeapEntry &&e) {
+    if (t->heap.size() == t->k) {
+        if (!(e.distance < t->heap.front().distance))
+            return;
+        std::pop_heap(t->heap.begin(), t->heap.end());
+        t->heap.pop_back();
     }
+    t->heap.push_back(std::move(e));
+    std::push_heap(t->heap.begin(), t->heap.end());
+}
+
+static int ph_mvp_topk_point(const DP *dp, float distance, void *ctx) {
+    MVPTopK *t = (MVPTopK *)ctx;
+    // no copies of the id and path of points that can't make it
+    if (t->heap.size() == t->k && !(distance < t->heap.front().distance))
+        return 0;
+    ph_mvp_topk_push(t, MVPHeapEntry{distance, dp->id, dp->path ? dp->path : ""});
+    if (t->radius && t->heap.size() == t->k)
+        *t->radius = t->heap.front().distance;
+    return 0;
+}
 
-    sqlite3_finalize(stmt);  // release
-    sqlite3_close(db);       // close
+// the k nearest points of one shard
+static MVPRetCode ph_mvp_shard_topk(MVPShard *h, DP *query, float threshold, MVPTopK &topk) {
+    MVPRetCode ret = PH_ERRARG;
+
+    // with the indexes, widen the radius until it holds k points: all
+    // points within it have been seen, so they are the k nearest
+    if (ph_mvp_hamming_pushdown(h, query)) {
+        const int radius = ph_hamming_radius(threshold);
+        for (int r = PH_MVP_SUBSTRINGS - 1; r < PH_MVP_SUBSTRINGS * (PH_MVP_MAX_SUBSTRING_BITS + 1) && r < radius;
+             r += PH_MVP_SUBSTRINGS) {
+            topk.heap.clear();
+            ret = ph_mvp_visit_hamming(h, *(ulong64 *)query->hash, r, ph_mvp_topk_point, &topk);
+            if (ret != PH_SUCCESS || topk.heap.size() == topk.k)
+                break;
+        }
+    }
+    if (topk.heap.size() < topk.k && h->tree) {
+        // the search radius shrinks to the k-th distance as nearer points turn up
+        float radius = threshold;
+        topk.heap.clear();
+        topk.radius = &radius;
+        ret = ph_mvptree_query(h->tree, h->file->hashdist, query, &radius, ph_mvp_topk_point, &topk);
+        topk.radius = nullptr;
+    } else if (ph_mvp_hamming_pushdown(h, query) && topk.heap.size() < topk.k) {
+        // the engine's sorter keeps only the k best rows
+        topk.heap.clear();
+        sqlite3_stmt *stmt = ph_mvp_statement(h, &h->nearest,
+                                              "SELECT id, hash, path, hash_length, hash_datatype, hamming(hash, ?1) AS d"
+                                              " FROM " + h->table + " WHERE d <= ?2 ORDER BY d LIMIT ?3;");
+        if (!stmt)
+            return PH_ERRPREPARE;
+        ulong64 le;
+        ph_hash_le_copy(&le, query->hash, 1, UINT64ARRAY);
+        sqlite3_bind_blob(stmt, 1, &le, sizeof(le), SQLITE_STATIC);
+        sqlite3_bind_int(stmt, 2, ph_hamming_radius(threshold));
+        sqlite3_bind_int(stmt, 3, (int)topk.k);
+        DP dp;
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            if (ph_mvp_row_view(h, stmt, &dp))
+                ph_mvp_topk_point(&dp, (float)sqlite3_column_int(stmt, 5), &topk);
+        }
+        sqlite3_reset(stmt);
+        ret = PH_SUCCESS;
+    } else if (topk.heap.size() < topk.k) {
+        topk.heap.clear();
+        ret = ph_mvp_visit(h, query, threshold, ph_mvp_topk_point, &topk);
+    }
     return ret;
 }
 
-MVPRetCode ph_add_mvptree(MVPFile *m, DP **points, int nbpoints, int &nbsaved) {
-    if ((!m) || (!points) || nbpoints <= 0)
+MVPRetCode ph_mvp_query_topk(MVPHandle *h, DP *query, int k, float threshold, MVPResult *results, int &count) {
+    count = 0;
+    if (!results)
         return PH_ERRNULLARG;
+    MVPRetCode ret = ph_mvp_check_query(h, query);
+    if (ret != PH_SUCCESS)
+        return ret;
+    if (k <= 0)
+        return PH_ERRARG;
 
-    // check file exists
-    char mainSqlite[MAX_PATH];
-    snprintf(mainSqlite, sizeof(mainSqlite), "%s.db", m->filename);
-    if (!ph_file_exists(mainSqlite)) {
-        fprintf(stderr, "File %s does not exist!\n", mainSqlite);
-        return PH_ERRFILEEXIST;
+    // each shard's k nearest, merged down to k
+    std::vector<MVPTopK> shard(h->shards.size());
+    ret = ph_mvp_scatter(h, [&](MVPShard *s, int i) {
+        shard[i].k = (size_t)k;
+        shard[i].radius = nullptr;
+        shard[i].heap.reserve(k);
+        return ph_mvp_shard_topk(s, query, threshold, shard[i]);
+    });
+    MVPTopK topk = std::move(shard[0]);
+    for (size_t i = 1; i < shard.size(); i++) {
+        for (MVPHeapEntry &e : shard[i].heap)
+            ph_mvp_topk_push(&topk, std::move(e));
     }
 
-    // open database
-    sqlite3 *db;
-    int rc = sqlite3_open(mainSqlite, &db);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(db));
-        return PH_ERRFILEOPEN;
+    std::sort_heap(topk.heap.begin(), topk.heap.end());
+    for (const MVPHeapEntry &e : topk.heap) {
+        results[count].id = strdup(e.id.c_str());
+        results[count].path = strdup(e.path.c_str());
+        results[count].distance = e.distance;
+        count++;
     }
+    return ret;
+}
 
-    // start transaction
-    rc = sqlite3_exec(db, "BEGIN TRANSACTION", 0, 0, 0);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Failed to start transaction.\n");
-        sqlite3_close(db);
-        return PH_ERRTABLECREATE;
+void ph_mvp_free_results(MVPResult *results, int count) {
+    for (int i = 0; results && i < count; i++) {
+        free(results[i].id);
+        free(results[i].path);
+        results[i].id = results[i].path = nullptr;
     }
+}
 
-    // insert data points
-    std::string insertQuery = "INSERT INTO ";
-    insertQuery += ph_db_table_name(m->hash_type);
-    insertQuery += " (id, hash, path, hash_length, hash_datatype) VALUES (?, ?, ?, ?, ?)";
+MVPRetCode ph_mvp_add(MVPHandle *h, DP *new_dp) {
+    if ((!h) || (!new_dp) || (!new_dp->id) || (!new_dp->hash))
+        return PH_ERRNULLARG;
 
-    sqlite3_stmt *stmt;
-    rc = sqlite3_prepare_v2(db, insertQuery.c_str(), -1, &stmt, 0);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Sqlite3 Prepare failed: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
-        sqlite3_close(db);
+    if (h->file.hash_type != new_dp->hash_type)
+        return PH_ERRHASHTYPE;
+
+    MVPShard *s = ph_mvp_shard_of(h, new_dp->id);
+    sqlite3_stmt *stmt = ph_mvp_statement(s, &s->insert, ph_mvp_insert_sql(s));
+    if (!stmt)
         return PH_ERRPREPARE;
+
+    // the row and its tree entry go in together: the row of a point the tree
+    // can't take is rolled back, the tree's points are left as they were
+    if (sqlite3_exec(s->db, "BEGIN TRANSACTION", 0, 0, 0) != SQLITE_OK) {
+        fprintf(stderr, "Failed to start transaction.\n");
+        return PH_ERRTABLECREATE;
+    }
+    MVPRetCode ret = PH_SUCCESS;
+    if (ph_mvp_insert_row(s, stmt, new_dp) != SQLITE_DONE) {
+        fprintf(stderr, "Insert data failed: %s\n", sqlite3_errmsg(s->db));
+        ret = PH_ERRINSERT;
+    } else if (s->tree) {
+        ret = ph_mvptree_insert(s->tree, &h->file, new_dp);
     }
+    if (ret != PH_SUCCESS) {
+        sqlite3_exec(s->db, "ROLLBACK", 0, 0, 0);
+        return ret;
+    }
+    if (sqlite3_exec(s->db, "COMMIT", 0, 0, 0) != SQLITE_OK) {
+        fprintf(stderr, "Failed to commit transaction.\n");
+        sqlite3_exec(s->db, "ROLLBACK", 0, 0, 0);
+        ph_mvp_drop_tree(s);
+        return PH_ERRSUBMIT;
+    }
+    return PH_SUCCESS;
+}
 
-    // bind parameters
+MVPRetCode ph_mvp_add(MVPHandle *h, DP **points, int nbpoints, int &nbsaved) {
     nbsaved = 0;
-    for (int i = 0; i < nbpoints; ++i) {
-        DP *dp = points[i];
-        if (dp->hash_type != m->hash_type)
-        {
-            fprintf(stderr, "Failed to insert data point. Input points[%d]->hash_type != MVPFile->hash_type.\n", i);
-            continue;
-        }
+    if ((!h) || (!points) || nbpoints <= 0)
+        return PH_ERRNULLARG;
 
-        if (dp->id == nullptr) {
-            fprintf(stderr, "Failed to insert data point. Input points[%d]->id is NULL.\n", i);
-            continue;
-        }
+    std::vector<std::vector<DP *>> routed = ph_mvp_route(h, points, nbpoints);
+    std::vector<int> saved(h->shards.size(), 0);
+    MVPRetCode ret = ph_mvp_scatter(h, [&](MVPShard *s, int i) {
+        if (routed[i].empty())
+            return PH_SUCCESS;
+        std::vector<DP *> rows;
+        MVPRetCode r = ph_mvp_insert_rows(s, routed[i].data(), (int)routed[i].size(), true, rows);
+        saved[i] = (int)rows.size();
+        return r;
+    });
+    for (int n : saved)
+        nbsaved += n;
+    return ret;
+}
 
-        if (dp->hash == nullptr) {
-            fprintf(stderr, "Failed to insert data point. Input points[%d]->hash is NULL.\n", i);
-            continue;
-        }
+MVPRetCode ph_sizeof_mvptree(MVPFile *m, int64_t &result) {
+    MVPHandle *h;
+    MVPRetCode ret = ph_mvp_open(m, nullptr, &h);
+    if (ret != PH_SUCCESS)
+        return ret;
+    ret = ph_mvp_size(h, result);
+    ph_mvp_close(h);
+    return ret;
+}
 
-        sqlite3_bind_text(stmt, 1, dp->id, -1, SQLITE_STATIC);
+MVPRetCode ph_query_mvptree(MVPFile *m, const char *id, DP *result) {
+    if (!m || !id) {
+        return PH_ERRNULLARG;
+    }
 
-        // 序列化 hash 数组为 JSON 字符串
-        std::string hashJson = serializeArray(dp->hash, dp->hash_length, dp->hash_datatype);
-        sqlite3_bind_text(stmt, 2, hashJson.c_str(), -1, SQLITE_STATIC);
+    MVPHandle *h;
+    MVPRetCode ret = ph_mvp_open(m, nullptr, &h);
+    if (ret != PH_SUCCESS)
+        return ret;
+    ret = ph_mvp_query(h, id, result);
+    ph_mvp_close(h);
+    return ret;
+}
 
-        if (dp->path == nullptr)
-            sqlite3_bind_text(stmt, 3, "NO INPUT", -1, SQLITE_STATIC);
-        else
-            sqlite3_bind_text(stmt, 3, dp->path, -1, SQLITE_STATIC);
+MVPRetCode ph_query_mvptree(MVPFile *m, DP *query, float threshold, DP **&results, int *count) {
+    results = nullptr;
+    if (!m || !query || !count) {
+        return PH_ERRNULLARG;
+    }
+    *count = 0;
 
-        sqlite3_bind_int(stmt, 4, dp->hash_length);
-        sqlite3_bind_int(stmt, 5, dp->hash_datatype);
+    MVPHandle *h;
+    const MVPOptions options = {0, 1, 0, 0, 0, 0, 0};
+    MVPRetCode ret = ph_mvp_open(m, &options, &h);
+    if (ret != PH_SUCCESS)
+        return ret;
 
-        rc = sqlite3_step(stmt);
-        if (rc != SQLITE_DONE) {
-            fprintf(stderr, "Failed to insert data point. Skipping.\n");
-            sqlite3_reset(stmt);
-            continue;
-        }
+    ret = ph_mvp_query(h, query, threshold, results, *count);
+    ph_mvp_close(h);
+    return ret;
+}
 
-        sqlite3_reset(stmt);
-        ++nbsaved;
+MVPRetCode ph_create_mvptree(MVPFile *m) {
+    if (!m) {
+        return PH_ERRARG;
     }
 
-    MVPRetCode ret = PH_SUCCESS;
+    MVPHandle *h;
+    const MVPOptions options = {1, 0, 0, 0, 0, 0, 0};
+    MVPRetCode ret = ph_mvp_open(m, &options, &h);
+    if (ret != PH_SUCCESS)
+        return ret;
+    ph_mvp_close(h);
+    return PH_SUCCESS;
+}
 
-    // commit transaction
-    rc = sqlite3_exec(db, "COMMIT", 0, 0, 0);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Failed to commit transaction.\n");
-        ret = PH_ERRSUBMIT;
+MVPRetCode ph_create_mvptree(MVPFile *m, DP **points, int nbpoints) {
+    return ph_create_mvptree(m, points, nbpoints, 0, 0);
+}
+
+MVPRetCode ph_create_mvptree(MVPFile *m, DP **points, int nbpoints, int branchfactor, int leafcapacity) {
+    if ((!m) || (!points)) {
+        return PH_ERRARG;
     }
 
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
+    MVPHandle *h;
+    const MVPOptions options = {1, 0, 0, 0, 0, 0, 0};
+    MVPRetCode ret = ph_mvp_open(m, &options, &h);
+    if (ret != PH_SUCCESS)
+        return ret;
+
+    std::vector<std::vector<DP *>> routed = ph_mvp_route(h, points, nbpoints);
+    ret = ph_mvp_scatter(h, [&](MVPShard *s, int i) {
+        // index every row of the shard, old and new, in one bulk build
+        std::vector<DP *> saved;
+        MVPRetCode r = ph_mvp_insert_rows(s, routed[i].data(), (int)routed[i].size(), false, saved);
+        if (r != PH_SUCCESS || !m->hashdist)
+            return r;
+        return ph_mvp_rebuild_tree(s, branchfactor, leafcapacity);
+    });
+    ph_mvp_close(h);
+    return ret;
+}
+
+MVPRetCode ph_add_mvptree(MVPFile *m, DP *new_dp) {
+    if ((!m) || (!new_dp) || (!new_dp->id) || (!new_dp->hash))
+        return PH_ERRNULLARG;
+
+    if (m->hash_type != new_dp->hash_type)
+        return PH_ERRHASHTYPE;
 
+    MVPHandle *h;
+    MVPRetCode ret = ph_mvp_open(m, nullptr, &h);
+    if (ret != PH_SUCCESS)
+        return ret;
+    ret = ph_mvp_add(h, new_dp);
+    ph_mvp_close(h);
+    return ret;
+}
+
+MVPRetCode ph_add_mvptree(MVPFile *m, DP **points, int nbpoints, int &nbsaved) {
+    if ((!m) || (!points) || nbpoints <= 0)
+        return PH_ERRNULLARG;
+
+    MVPHandle *h;
+    MVPRetCode ret = ph_mvp_open(m, nullptr, &h);
+    if (ret != PH_SUCCESS)
+        return ret;
+    ret = ph_mvp_add(h, points, nbpoints, nbsaved);
+    ph_mvp_close(h);
     return ret;
 }
@@ -35,10 +35,85 @@ typedef struct ph_mvp_file {
     HashType hash_type;
     HashDataType hash_data_type;
 
-    /*callback function to use to calculate the distance between 2 datapoints */
+    /*callback function to use to calculate the distance between 2 datapoints,
+     * it must be a metric for the tree index (<filename>.mvp) to prune with */
     hash_compareCB hashdist;
 } MVPFile;
 
+/* open database and tree index of an MVPFile, keeping the prepared
+ * statements alive between calls; use it from one thread at a time.
+ * A database is <filename>.db and <filename>.mvp, or when sharded
+ * <filename>.<i>.db and <filename>.<i>.mvp for i below the shard count,
+ * each point living in the shard its id hashes to and each file kept under
+ * MaxFileSize. Queries run on all shards in parallel and merge the results.
+ * A tree index is only used while it holds as many points as its database
+ * has rows, queries scan the rows otherwise. */
+typedef struct ph_mvp_handle MVPHandle;
+
+typedef struct ph_mvp_options {
+    int create;        /* create the database if missing, build the tree index if missing or stale */
+    int readonly;      /* open for queries only */
+    int wal;           /* switch the database to write-ahead logging */
+    int64_t mmap_size; /* bytes of the database to memory map, 0 for the sqlite default */
+    int cache_size;    /* sqlite page cache, pages if positive, KiB if negative, 0 for the default */
+    int shards;        /* split new databases over this many files, 0 or 1 for one */
+    int threads;       /* pool threads querying the shards, 0 for all of them */
+} MVPOptions;
+
+/** /brief open the database of an mvp file
+ *  /param m - MVPFile state information, copied into the handle
+ *  /param options - MVPOptions (may be NULL for defaults)
+ *  /param handle - (out) handle to close with ph_mvp_close
+ *  /return MVPRetCode
+ **/
+DLL_EXPORT MVPRetCode ph_mvp_open(MVPFile *m, const MVPOptions *options, MVPHandle **handle);
+
+DLL_EXPORT void ph_mvp_close(MVPHandle *h);
+
+/** /brief handle versions of ph_sizeof_mvptree, ph_query_mvptree and
+ *         ph_add_mvptree
+ **/
+DLL_EXPORT MVPRetCode ph_mvp_size(MVPHandle *h, int64_t &result);
+
+DLL_EXPORT MVPRetCode ph_mvp_query(MVPHandle *h, const char *id, DP *result);
+
+DLL_EXPORT MVPRetCode ph_mvp_query(MVPHandle *h, DP *query, float threshold, DP **&results, int &count);
+
+/* called for each match of a query, the strings are only valid during the
+ * call; return non zero to stop the query */
+typedef int (*mvp_resultCB)(const char *id, float distance, const char *path, void *ctx);
+
+/** /brief stream the points with hashdist(query, point) < threshold to a
+ *         callback, in no particular order, without collecting them; on a
+ *         sharded handle the callback may run on worker threads, but never
+ *         twice at once
+ *  /return MVPRetCode
+ **/
+DLL_EXPORT MVPRetCode ph_mvp_query(MVPHandle *h, DP *query, float threshold, mvp_resultCB callback, void *ctx);
+
+typedef struct ph_mvp_result {
+    char *id;   /* malloc'd */
+    char *path; /* malloc'd */
+    float distance;
+} MVPResult;
+
+/** /brief the k points nearest the query, among those closer than threshold
+ *  /param k - int number of points wanted
+ *  /param threshold - float distance limit (FLT_MAX for none)
+ *  /param results - (out) array of k MVPResult, nearest first; release the
+ *                   strings with ph_mvp_free_results
+ *  /param count - (out) number of results, below k when fewer points qualify
+ *  /return MVPRetCode
+ **/
+DLL_EXPORT MVPRetCode ph_mvp_query_topk(MVPHandle *h, DP *query, int k, float threshold, MVPResult *results,
+                                        int &count);
+
+DLL_EXPORT void ph_mvp_free_results(MVPResult *results, int count);
+
+DLL_EXPORT MVPRetCode ph_mvp_add(MVPHandle *h, DP *new_dp);
+
+DLL_EXPORT MVPRetCode ph_mvp_add(MVPHandle *h, DP **points, int nbpoints, int &nbsaved);
+
 /** /brief get size of mvp tree
  *  /param m - MVPFile struct
  *  /param result - mvp tree size of result
@@ -59,21 +134,28 @@ DLL_EXPORT float hammingdistance(DP *pntA, DP *pntB);
  **/
 DLL_EXPORT MVPRetCode ph_query_mvptree(MVPFile* m, const char* id, DP* result);
 
-/** /brief query similar datapoints in mvp file
+/** /brief query similar datapoints in mvp file. With hammingdistance on
+ *         64-bit image hashes the database filters by itself (substring
+ *         indexes and its hamming()/hamming_le() functions), otherwise the
+ *         tree index is used when there is one, a scan when there is not
  *  /param m - MVPFile state information
  *  /param query - DP of datapoint to query
- *  /param results - DP array of points of result
+ *  /param threshold - float, points with hashdist(query, point) < threshold match
+ *  /param results - (out) malloc'd DP array of the matches, the caller frees
+ *                   each DP's id, path and hash, the DP and the array
  *  /param count - int* number of results found (out)
  *  /return MVPRetCode
  **/
-DLL_EXPORT MVPRetCode ph_query_mvptree(MVPFile *m, DP *query, float threshold, DP **results, int *count);
+DLL_EXPORT MVPRetCode ph_query_mvptree(MVPFile *m, DP *query, float threshold, DP **&results, int *count);
 
 /**
- * /brief create a database file
+ * /brief create a database file if missing; with m->hashdist set, build the
+ *        tree index from all its rows when the index is missing or stale
  */
 DLL_EXPORT MVPRetCode ph_create_mvptree(MVPFile *m);
 
-/** /brief creat a database and save points to mvp file
+/** /brief creat a database and save points to mvp file, then rebuild the
+ *         tree index from every row, the ones already there included
  *  /param m - MVPFile state info of file
  *  /param points - DP** list of points to add
  *  /param nbpoints - int number of points
@@ -81,6 +163,12 @@ DLL_EXPORT MVPRetCode ph_create_mvptree(MVPFile *m);
  **/
 DLL_EXPORT MVPRetCode ph_create_mvptree(MVPFile *m, DP **points, int nbpoints);
 
+/** /brief creat a database and save points to mvp file, with the tree shape
+ *  /param branchfactor - children per vantage point (0 for MVP_DEFAULT_BRANCHFACTOR)
+ *  /param leafcapacity - points per leaf (0 for MVP_DEFAULT_LEAFCAPACITY)
+ **/
+DLL_EXPORT MVPRetCode ph_create_mvptree(MVPFile *m, DP **points, int nbpoints, int branchfactor, int leafcapacity);
+
 /**  /brief add a point to mvp file
  *   /param m - MVPFile state information of file
  *   /param new_dp - datapoint to add
@@ -0,0 +1,686 @@
+#include "pHash_mvptree.h"
+
+#include <float.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define MVP_MAGIC "pHashMVP"
+#define MVP_VERSION 1
+#define MVP_NODE_LEAF 1
+#define MVP_NODE_INTERNAL 2
+#define MVP_INITIAL_PAGES 16
+
+typedef struct ph_mvp_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t page_size;
+    uint16_t hash_type;
+    uint16_t hash_datatype;
+    uint16_t branchfactor;
+    uint16_t leafcapacity;
+    uint64_t root;      /* page of the root node, 0 for an empty tree */
+    uint64_t npages;    /* pages in use, page 0 included */
+    uint64_t npoints;
+    uint64_t data_page; /* data page being filled, 0 for none */
+    uint32_t data_used; /* bytes used in data_page */
+    uint32_t reserved;
+} MVPHeader;
+
+static_assert(sizeof(MVPHeader) == HeaderSize, "mvp header must fill HeaderSize bytes");
+
+/* followed by hash_length * hash_datatype bytes of hash, then id and path
+ * with their terminating zeros, padded to 8 bytes */
+typedef struct ph_mvp_record {
+    uint32_t hash_length;
+    uint16_t hash_datatype;
+    uint8_t hash_type;
+    uint8_t has_path;
+    uint32_t id_length;
+    uint32_t path_length;
+} MVPRecord;
+
+typedef struct ph_mvp_leaf_entry {
+    uint64_t record; /* file offset of the MVPRecord */
+    float d1;        /* distance to vp1 */
+    float d2;        /* distance to vp2 */
+} MVPLeafEntry;
+
+/* followed by count MVPLeafEntry */
+typedef struct ph_mvp_leaf {
+    uint32_t type;
+    uint32_t count;
+    uint64_t vp1; /* records of the vantage points, both among the entries, 0 for none */
+    uint64_t vp2;
+} MVPLeaf;
+
+typedef struct ph_mvp_child {
+    uint64_t page;    /* 0 for an empty child */
+    float min1, max1; /* distances of the child's points to vp1 */
+    float min2, max2; /* and to vp2 */
+} MVPChild;
+
+/* followed by nchildren MVPChild, the vantage points are in no child */
+typedef struct ph_mvp_internal {
+    uint32_t type;
+    uint32_t nchildren;
+    uint64_t vp1;
+    uint64_t vp2;
+} MVPInternal;
+
+static_assert(sizeof(MVPLeaf) + MVP_MAX_LEAFCAPACITY * sizeof(MVPLeafEntry) <= MVP_PAGE_SIZE,
+              "leaf must fit in a page");
+static_assert(sizeof(MVPInternal) + MVP_MAX_BRANCHFACTOR * MVP_MAX_BRANCHFACTOR * sizeof(MVPChild) <= MVP_PAGE_SIZE,
+              "internal node must fit in a page");
+
+typedef struct ph_mvp_item {
+    uint64_t record;
+    float d1;
+    float d2;
+} MVPItem;
+
+struct ph_mvp_tree {
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+    uint8_t *base;
+    uint64_t mapped; /* bytes mapped, also the file size */
+    int writable;
+};
+
+static inline MVPHeader *mvp_header(const MVPTree *t) {
+    return (MVPHeader *)t->base;
+}
+
+static inline uint8_t *mvp_page(const MVPTree *t, uint64_t page) {
+    return t->base + page * MVP_PAGE_SIZE;
+}
+
+static void mvp_unmap(MVPTree *t) {
+    if (!t->base)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(t->base);
+    CloseHandle(t->mapping);
+    t->mapping = NULL;
+#else
+    munmap(t->base, t->mapped);
+#endif
+    t->base = NULL;
+}
+
+/* (re)map the file at size bytes, growing it first when writable */
+static int mvp_map(MVPTree *t, uint64_t size) {
+    mvp_unmap(t);
+#ifdef _WIN32
+    t->mapping = CreateFileMappingA(t->file, NULL, t->writable ? PAGE_READWRITE : PAGE_READONLY,
+                                    (DWORD)(size >> 32), (DWORD)size, NULL);
+    if (!t->mapping)
+        return -1;
+    t->base = (uint8_t *)MapViewOfFile(t->mapping, t->writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, (SIZE_T)size);
+    if (!t->base) {
+        CloseHandle(t->mapping);
+        t->mapping = NULL;
+        return -1;
+    }
+#else
+    if (t->writable && ftruncate(t->fd, (off_t)size) < 0)
+        return -1;
+    void *p = mmap(NULL, (size_t)size, PROT_READ | (t->writable ? PROT_WRITE : 0), MAP_SHARED, t->fd, 0);
+    if (p == MAP_FAILED)
+        return -1;
+    t->base = (uint8_t *)p;
+#endif
+    t->mapped = size;
+    return 0;
+}
+
+static MVPTree *mvp_file_open(const char *filename, int create, int writable) {
+    MVPTree *t = new MVPTree;
+    t->base = NULL;
+    t->mapped = 0;
+    t->writable = writable;
+    uint64_t size = 0;
+#ifdef _WIN32
+    t->mapping = NULL;
+    t->file = CreateFileA(filename, GENERIC_READ | (writable ? GENERIC_WRITE : 0), FILE_SHARE_READ, NULL,
+                          create ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (t->file == INVALID_HANDLE_VALUE) {
+        delete t;
+        return NULL;
+    }
+    LARGE_INTEGER fsize;
+    if (GetFileSizeEx(t->file, &fsize))
+        size = (uint64_t)fsize.QuadPart;
+#else
+    t->fd = open(filename, (writable ? O_RDWR : O_RDONLY) | (create ? O_CREAT | O_TRUNC : 0), 0644);
+    if (t->fd < 0) {
+        delete t;
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(t->fd, &st) == 0)
+        size = (uint64_t)st.st_size;
+#endif
+    if (create)
+        size = MVP_INITIAL_PAGES * MVP_PAGE_SIZE;
+    if (size < MVP_PAGE_SIZE || mvp_map(t, size) < 0) {
+        ph_mvptree_close(t);
+        return NULL;
+    }
+    return t;
+}
+
+void ph_mvptree_close(MVPTree *t) {
+    if (!t)
+        return;
+    /* drop the unused pages left by growing the mapping */
+    const uint64_t used = (t->writable && t->base) ? mvp_header(t)->npages * MVP_PAGE_SIZE : 0;
+#ifdef _WIN32
+    if (t->base && t->writable)
+        FlushViewOfFile(t->base, 0);
+    mvp_unmap(t);
+    if (used > 0) {
+        LARGE_INTEGER pos;
+        pos.QuadPart = (LONGLONG)used;
+        if (SetFilePointerEx(t->file, pos, NULL, FILE_BEGIN))
+            SetEndOfFile(t->file);
+    }
+    CloseHandle(t->file);
+#else
+    mvp_unmap(t);
+    if (used > 0 && ftruncate(t->fd, (off_t)used) < 0)
+        fprintf(stderr, "Unable to truncate mvp tree file\n");
+    close(t->fd);
+#endif
+    delete t;
+}
+
+MVPTree *ph_mvptree_open(const char *filename, int writable) {
+    if (!filename)
+        return NULL;
+    MVPTree *t = mvp_file_open(filename, 0, writable);
+    if (!t)
+        return NULL;
+    const MVPHeader *h = mvp_header(t);
+    if (memcmp(h->magic, MVP_MAGIC, sizeof(h->magic)) != 0 || h->version != MVP_VERSION ||
+        h->page_size != MVP_PAGE_SIZE || h->npages * MVP_PAGE_SIZE > t->mapped) {
+        t->writable = 0; /* leave a foreign file as it is */
+        ph_mvptree_close(t);
+        return NULL;
+    }
+    return t;
+}
+
+uint64_t ph_mvptree_size(const MVPTree *t) {
+    return t ? mvp_header(t)->npoints : 0;
+}
+
+/* first of n new zeroed pages, 0 when the file would pass MaxFileSize */
+static uint64_t mvp_alloc_pages(MVPTree *t, uint64_t n) {
+    const uint64_t first = mvp_header(t)->npages;
+    const uint64_t need = (first + n) * MVP_PAGE_SIZE;
+    if (need > (uint64_t)MaxFileSize)
+        return 0;
+    if (need > t->mapped) {
+        uint64_t size = t->mapped * 2;
+        while (size < need)
+            size *= 2;
+        if (size > (uint64_t)MaxFileSize)
+            size = MaxFileSize;
+        if (mvp_map(t, size) < 0)
+            return 0;
+    }
+    mvp_header(t)->npages = first + n;
+    memset(mvp_page(t, first), 0, (size_t)(n * MVP_PAGE_SIZE));
+    return first;
+}
+
+/* file offset of a copy of dp in the data pages, 0 for failure */
+static uint64_t mvp_write_record(MVPTree *t, const DP *dp) {
+    const uint64_t hash_bytes = (uint64_t)dp->hash_length * dp->hash_datatype;
+    const size_t id_length = dp->id ? strlen(dp->id) : 0;
+    const size_t path_length = dp->path ? strlen(dp->path) : 0;
+    const uint64_t size = (sizeof(MVPRecord) + hash_bytes + id_length + 1 + path_length + 1 + 7) & ~(uint64_t)7;
+
+    uint64_t off;
+    MVPHeader *h = mvp_header(t);
+    if (h->data_page && h->data_used + size <= MVP_PAGE_SIZE) {
+        off = h->data_page * MVP_PAGE_SIZE + h->data_used;
+        h->data_used += (uint32_t)size;
+    } else {
+        const uint64_t n = (size + MVP_PAGE_SIZE - 1) / MVP_PAGE_SIZE;
+        const uint64_t page = mvp_alloc_pages(t, n);
+        if (!page)
+            return 0;
+        if (n == 1) {
+            h = mvp_header(t);
+            h->data_page = page;
+            h->data_used = (uint32_t)size;
+        }
+        off = page * MVP_PAGE_SIZE;
+    }
+
+    MVPRecord *r = (MVPRecord *)(t->base + off);
+    r->hash_length = dp->hash_length;
+    r->hash_datatype = (uint16_t)dp->hash_datatype;
+    r->hash_type = (uint8_t)dp->hash_type;
+    r->has_path = dp->path ? 1 : 0;
+    r->id_length = (uint32_t)id_length;
+    r->path_length = (uint32_t)path_length;
+    uint8_t *p = (uint8_t *)(r + 1);
+    memcpy(p, dp->hash, (size_t)hash_bytes);
+    p += hash_bytes;
+    memcpy(p, dp->id ? dp->id : "", id_length + 1);
+    p += id_length + 1;
+    memcpy(p, dp->path ? dp->path : "", path_length + 1);
+    return off;
+}
+
+/* dp pointing into the mapping, valid until the next page allocation */
+static void mvp_record_dp(const MVPTree *t, uint64_t off, DP &dp) {
+    const MVPRecord *r = (const MVPRecord *)(t->base + off);
+    uint8_t *p = (uint8_t *)(r + 1);
+    dp.hash = p;
+    dp.hash_length = r->hash_length;
+    dp.hash_datatype = (HashDataType)r->hash_datatype;
+    dp.hash_type = (HashType)r->hash_type;
+    p += (size_t)r->hash_length * r->hash_datatype;
+    dp.id = (char *)p;
+    dp.path = r->has_path ? dp.id + r->id_length + 1 : NULL;
+}
+
+static float mvp_distance(const MVPTree *t, hash_compareCB hashdist, uint64_t a, uint64_t b) {
+    DP da, db;
+    mvp_record_dp(t, a, da);
+    mvp_record_dp(t, b, db);
+    return hashdist(&da, &db);
+}
+
+static float mvp_query_distance(const MVPTree *t, hash_compareCB hashdist, DP *query, uint64_t rec,
+                                MVPQueryStats *stats) {
+    DP d;
+    mvp_record_dp(t, rec, d);
+    stats->distance_calls++;
+    return hashdist(query, &d);
+}
+
+static bool mvp_item_d1_less(const MVPItem &a, const MVPItem &b) {
+    return a.d1 < b.d1;
+}
+
+static bool mvp_item_d2_less(const MVPItem &a, const MVPItem &b) {
+    return a.d2 < b.d2;
+}
+
+/* leaf page holding the n items, 0 for failure */
+static uint64_t mvp_write_leaf(MVPTree *t, hash_compareCB hashdist, MVPItem *items, size_t n) {
+    const uint64_t page = mvp_alloc_pages(t, 1);
+    if (!page)
+        return 0;
+
+    uint64_t vp1 = 0, vp2 = 0;
+    if (n > 0) {
+        vp1 = items[0].record;
+        size_t far = 0;
+        for (size_t i = 0; i < n; i++) {
+            items[i].d1 = (i == 0) ? 0 : mvp_distance(t, hashdist, vp1, items[i].record);
+            if (items[i].d1 > items[far].d1)
+                far = i;
+        }
+        if (n > 1) {
+            vp2 = items[(far > 0) ? far : 1].record;
+            for (size_t i = 0; i < n; i++) {
+                items[i].d2 = (items[i].record == vp2) ? 0 : mvp_distance(t, hashdist, vp2, items[i].record);
+            }
+        }
+    }
+
+    MVPLeaf *leaf = (MVPLeaf *)mvp_page(t, page);
+    leaf->type = MVP_NODE_LEAF;
+    leaf->count = (uint32_t)n;
+    leaf->vp1 = vp1;
+    leaf->vp2 = vp2;
+    MVPLeafEntry *entries = (MVPLeafEntry *)(leaf + 1);
+    for (size_t i = 0; i < n; i++) {
+        entries[i].record = items[i].record;
+        entries[i].d1 = items[i].d1;
+        entries[i].d2 = (n > 1) ? items[i].d2 : 0;
+    }
+    return page;
+}
+
+/* leaf or subtree holding the n items (reordered), 0 for failure */
+static uint64_t mvp_build_node(MVPTree *t, hash_compareCB hashdist, MVPItem *items, size_t n) {
+    const int bf = mvp_header(t)->branchfactor;
+    if (n <= mvp_header(t)->leafcapacity)
+        return mvp_write_leaf(t, hashdist, items, n);
+
+    const uint64_t page = mvp_alloc_pages(t, 1);
+    if (!page)
+        return 0;
+
+    /* vp1 is the first item, vp2 the item farthest from it */
+    const uint64_t vp1 = items[0].record;
+    size_t far = 1;
+    for (size_t i = 1; i < n; i++) {
+        items[i].d1 = mvp_distance(t, hashdist, vp1, items[i].record);
+        if (items[i].d1 > items[far].d1)
+            far = i;
+    }
+    std::swap(items[1], items[far]);
+    const uint64_t vp2 = items[1].record;
+    MVPItem *rest = items + 2;
+    const size_t m = n - 2;
+    for (size_t i = 0; i < m; i++) {
+        rest[i].d2 = mvp_distance(t, hashdist, vp2, rest[i].record);
+    }
+
+    /* bf slices by distance to vp1, each cut in bf by distance to vp2 */
+    std::vector<MVPChild> children(bf * bf);
+    std::sort(rest, rest + m, mvp_item_d1_less);
+    for (int i = 0; i < bf; i++) {
+        const size_t b0 = m * i / bf, b1 = m * (i + 1) / bf;
+        std::sort(rest + b0, rest + b1, mvp_item_d2_less);
+        for (int j = 0; j < bf; j++) {
+            const size_t c0 = b0 + (b1 - b0) * j / bf, c1 = b0 + (b1 - b0) * (j + 1) / bf;
+            MVPChild &c = children[i * bf + j];
+            c.page = 0;
+            c.min1 = c.min2 = FLT_MAX;
+            c.max1 = c.max2 = -FLT_MAX;
+            for (size_t k = c0; k < c1; k++) {
+                c.min1 = std::min(c.min1, rest[k].d1);
+                c.max1 = std::max(c.max1, rest[k].d1);
+                c.min2 = std::min(c.min2, rest[k].d2);
+                c.max2 = std::max(c.max2, rest[k].d2);
+            }
+            if (c1 > c0) {
+                c.page = mvp_build_node(t, hashdist, rest + c0, c1 - c0);
+                if (!c.page)
+                    return 0;
+            }
+        }
+    }
+
+    MVPInternal *node = (MVPInternal *)mvp_page(t, page);
+    node->type = MVP_NODE_INTERNAL;
+    node->nchildren = (uint32_t)children.size();
+    node->vp1 = vp1;
+    node->vp2 = vp2;
+    memcpy(node + 1, children.data(), children.size() * sizeof(MVPChild));
+    return page;
+}
+
+MVPRetCode ph_mvptree_build(const char *filename, MVPFile *m, DP **points, int nbpoints, int branchfactor,
+                            int leafcapacity) {
+    if (!filename || !m || (!points && nbpoints > 0))
+        return PH_ERRNULLARG;
+    if (!m->hashdist)
+        return PH_ERRDISTFUNC;
+    if (branchfactor == 0)
+        branchfactor = MVP_DEFAULT_BRANCHFACTOR;
+    if (leafcapacity == 0)
+        leafcapacity = MVP_DEFAULT_LEAFCAPACITY;
+    if (branchfactor < 2 || branchfactor > MVP_MAX_BRANCHFACTOR || leafcapacity < 2 ||
+        leafcapacity > MVP_MAX_LEAFCAPACITY)
+        return PH_ERRARG;
+
+    MVPTree *t = mvp_file_open(filename, 1, 1);
+    if (!t)
+        return PH_ERRFILEOPEN;
+    MVPHeader *h = mvp_header(t);
+    memset(h, 0, MVP_PAGE_SIZE);
+    memcpy(h->magic, MVP_MAGIC, sizeof(h->magic));
+    h->version = MVP_VERSION;
+    h->page_size = MVP_PAGE_SIZE;
+    h->hash_type = (uint16_t)m->hash_type;
+    h->hash_datatype = (uint16_t)m->hash_data_type;
+    h->branchfactor = (uint16_t)branchfactor;
+    h->leafcapacity = (uint16_t)leafcapacity;
+    h->npages = 1;
+
+    MVPRetCode ret = PH_SUCCESS;
+    std::vector<MVPItem> items;
+    items.reserve(nbpoints);
+    for (int i = 0; i < nbpoints; i++) {
+        DP *dp = points[i];
+        if (!dp || !dp->id || !dp->hash || dp->hash_type != m->hash_type)
+            continue;
+        MVPItem item = {mvp_write_record(t, dp), 0, 0};
+        if (!item.record) {
+            ret = PH_ERRMEMALLOC;
+            break;
+        }
+        items.push_back(item);
+    }
+    if (ret == PH_SUCCESS && !items.empty()) {
+        const uint64_t root = mvp_build_node(t, m->hashdist, items.data(), items.size());
+        if (root) {
+            mvp_header(t)->root = root;
+            mvp_header(t)->npoints = items.size();
+        } else {
+            ret = PH_ERRMEMALLOC;
+        }
+    }
+    ph_mvptree_close(t);
+    return ret;
+}
+
+static float mvp_gap(float d, float lo, float hi) {
+    return (d < lo) ? lo - d : ((d > hi) ? d - hi : 0);
+}
+
+MVPRetCode ph_mvptree_insert(MVPTree *t, MVPFile *m, DP *dp) {
+    if (!t || !m || !dp || !dp->id || !dp->hash)
+        return PH_ERRNULLARG;
+    if (!t->writable)
+        return PH_ERRARG;
+    if (dp->hash_type != mvp_header(t)->hash_type)
+        return PH_ERRHASHTYPE;
+    hash_compareCB hashdist = m->hashdist;
+    if (!hashdist)
+        return PH_ERRDISTFUNC;
+
+    MVPItem item = {mvp_write_record(t, dp), 0, 0};
+    if (!item.record)
+        return PH_ERRMEMALLOC;
+
+    /* file offset of the page number that leads to the current node, node
+     * pointers are not kept across page allocations which may remap */
+    uint64_t link = offsetof(MVPHeader, root);
+    uint64_t page = mvp_header(t)->root;
+    while (page) {
+        const uint32_t type = *(const uint32_t *)mvp_page(t, page);
+        if (type == MVP_NODE_INTERNAL) {
+            const MVPInternal *node = (const MVPInternal *)mvp_page(t, page);
+            const float d1 = mvp_distance(t, hashdist, item.record, node->vp1);
+            const float d2 = mvp_distance(t, hashdist, item.record, node->vp2);
+            MVPChild *children = (MVPChild *)(node + 1);
+            int best = 0;
+            float best_gap = FLT_MAX;
+            for (uint32_t c = 0; c < node->nchildren; c++) {
+                if (!children[c].page)
+                    continue;
+                const float gap = mvp_gap(d1, children[c].min1, children[c].max1) +
+                                  mvp_gap(d2, children[c].min2, children[c].max2);
+                if (gap < best_gap) {
+                    best_gap = gap;
+                    best = c;
+                }
+            }
+            MVPChild &c = children[best];
+            c.min1 = std::min(c.min1, d1);
+            c.max1 = std::max(c.max1, d1);
+            c.min2 = std::min(c.min2, d2);
+            c.max2 = std::max(c.max2, d2);
+            link = page * MVP_PAGE_SIZE + sizeof(MVPInternal) + best * sizeof(MVPChild) + offsetof(MVPChild, page);
+            page = c.page;
+            continue;
+        }
+
+        MVPLeaf *leaf = (MVPLeaf *)mvp_page(t, page);
+        MVPLeafEntry *entries = (MVPLeafEntry *)(leaf + 1);
+        if (leaf->count < mvp_header(t)->leafcapacity) {
+            MVPLeafEntry e = {item.record, 0, 0};
+            if (!leaf->vp1) {
+                leaf->vp1 = item.record;
+            } else {
+                e.d1 = mvp_distance(t, hashdist, item.record, leaf->vp1);
+                if (!leaf->vp2) {
+                    leaf->vp2 = item.record;
+                    for (uint32_t i = 0; i < leaf->count; i++) {
+                        entries[i].d2 = mvp_distance(t, hashdist, entries[i].record, item.record);
+                    }
+                } else {
+                    e.d2 = mvp_distance(t, hashdist, item.record, leaf->vp2);
+                }
+            }
+            entries[leaf->count++] = e;
+            mvp_header(t)->npoints++;
+            return PH_SUCCESS;
+        }
+
+        /* full leaf, its points and the new one become a subtree; the old
+         * leaf page is not reused */
+        std::vector<MVPItem> items(leaf->count + 1);
+        for (uint32_t i = 0; i < leaf->count; i++) {
+            items[i].record = entries[i].record;
+        }
+        items[leaf->count] = item;
+        const uint64_t sub = mvp_build_node(t, hashdist, items.data(), items.size());
+        if (!sub)
+            return PH_ERRMEMALLOC;
+        *(uint64_t *)(t->base + link) = sub;
+        mvp_header(t)->npoints++;
+        return PH_SUCCESS;
+    }
+
+    /* empty tree or empty child */
+    const uint64_t leaf = mvp_write_leaf(t, hashdist, &item, 1);
+    if (!leaf)
+        return PH_ERRMEMALLOC;
+    *(uint64_t *)(t->base + link) = leaf;
+    mvp_header(t)->npoints++;
+    return PH_SUCCESS;
+}
+
+/* lower bound of d(q, x) for the points x of a child: d(q, x) >= |dq - d(vp, x)|
+ * for both vantage points */
+static float mvp_child_bound(const MVPChild &ch, float dq1, float dq2) {
+    return std::max(mvp_gap(dq1, ch.min1, ch.max1), mvp_gap(dq2, ch.min2, ch.max2));
+}
+
+typedef struct ph_mvp_pending {
+    uint64_t page;
+    float bound; /* no point of the node is nearer the query */
+} MVPPending;
+
+static bool mvp_pending_farther(const MVPPending &a, const MVPPending &b) {
+    return a.bound > b.bound;
+}
+
+MVPRetCode ph_mvptree_query(MVPTree *t, hash_compareCB hashdist, DP *query, float radius, mvptree_visitCB visit,
+                            void *ctx, MVPQueryStats *stats) {
+    return ph_mvptree_query(t, hashdist, query, &radius, visit, ctx, stats);
+}
+
+MVPRetCode ph_mvptree_query(MVPTree *t, hash_compareCB hashdist, DP *query, float *radius, mvptree_visitCB visit,
+                            void *ctx, MVPQueryStats *stats) {
+    if (!t || !hashdist || !query || !radius || !visit)
+        return PH_ERRNULLARG;
+    if (query->hash_type != mvp_header(t)->hash_type)
+        return PH_ERRHASHTYPE;
+
+    MVPQueryStats local = {0, 0};
+    if (!stats)
+        stats = &local;
+    stats->distance_calls = 0;
+    stats->nodes = 0;
+
+    /* depth first, nearest child first, so a shrinking radius tightens early;
+     * the radius is read again before every test as visit may lower it */
+    std::vector<MVPPending> pending;
+    if (mvp_header(t)->root)
+        pending.push_back(MVPPending{mvp_header(t)->root, 0});
+    while (!pending.empty()) {
+        const MVPPending next = pending.back();
+        pending.pop_back();
+        if (next.bound >= *radius)
+            continue;
+        const uint64_t page = next.page;
+        stats->nodes++;
+        DP dp;
+        const uint32_t type = *(const uint32_t *)mvp_page(t, page);
+        if (type == MVP_NODE_INTERNAL) {
+            const MVPInternal *node = (const MVPInternal *)mvp_page(t, page);
+            const float dq1 = mvp_query_distance(t, hashdist, query, node->vp1, stats);
+            const float dq2 = mvp_query_distance(t, hashdist, query, node->vp2, stats);
+            if (dq1 < 0 || dq2 < 0)
+                return PH_ERRDISTFUNC;
+            if (dq1 < *radius) {
+                mvp_record_dp(t, node->vp1, dp);
+                if (visit(&dp, dq1, ctx))
+                    return PH_SUCCESS;
+            }
+            if (dq2 < *radius) {
+                mvp_record_dp(t, node->vp2, dp);
+                if (visit(&dp, dq2, ctx))
+                    return PH_SUCCESS;
+            }
+            const MVPChild *children = (const MVPChild *)(node + 1);
+            const size_t first = pending.size();
+            for (uint32_t c = 0; c < node->nchildren; c++) {
+                const MVPChild &ch = children[c];
+                if (!ch.page)
+                    continue;
+                const float bound = mvp_child_bound(ch, dq1, dq2);
+                if (bound < *radius)
+                    pending.push_back(MVPPending{ch.page, bound});
+            }
+            /* the nearest child on top of the stack */
+            std::sort(pending.begin() + first, pending.end(), mvp_pending_farther);
+        } else {
+            const MVPLeaf *leaf = (const MVPLeaf *)mvp_page(t, page);
+            const MVPLeafEntry *entries = (const MVPLeafEntry *)(leaf + 1);
+            float dq1 = 0, dq2 = 0;
+            if (leaf->vp1 && (dq1 = mvp_query_distance(t, hashdist, query, leaf->vp1, stats)) < 0)
+                return PH_ERRDISTFUNC;
+            if (leaf->vp2 && (dq2 = mvp_query_distance(t, hashdist, query, leaf->vp2, stats)) < 0)
+                return PH_ERRDISTFUNC;
+            for (uint32_t i = 0; i < leaf->count; i++) {
+                const MVPLeafEntry &e = entries[i];
+                if (fabsf(dq1 - e.d1) >= *radius || (leaf->vp2 && fabsf(dq2 - e.d2) >= *radius))
+                    continue;
+                float d;
+                if (e.record == leaf->vp1)
+                    d = dq1;
+                else if (e.record == leaf->vp2)
+                    d = dq2;
+                else
+                    d = mvp_query_distance(t, hashdist, query, e.record, stats);
+                if (d >= 0 && d < *radius) {
+                    mvp_record_dp(t, e.record, dp);
+                    if (visit(&dp, d, ctx))
+                        return PH_SUCCESS;
+                }
+            }
+        }
+    }
+    return PH_SUCCESS;
+}
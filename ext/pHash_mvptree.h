@@ -0,0 +1,73 @@
+#ifndef _PHASH_MVPTREE_H
+#define _PHASH_MVPTREE_H
+
+#include "pHash_mvp.h"
+
+/* On-disk multi-vantage-point tree. The file is a HeaderSize header at the
+ * start of page 0 followed by fixed size pages, all memory mapped:
+ *   - internal pages: two vantage points and branchfactor^2 children, each
+ *     with the range of its points' distances to both vantage points
+ *   - leaf pages: up to leafcapacity points with their distances to the
+ *     leaf's two vantage points
+ *   - data pages: the datapoint records (hash, id, path) the nodes refer to
+ * Queries skip every child and leaf point whose stored distances rule it out
+ * by the triangle inequality, so they only work for a hashdist that is a
+ * metric (hammingdistance is one). */
+
+#define MVP_PAGE_SIZE 4096
+#define MVP_DEFAULT_BRANCHFACTOR 2
+#define MVP_DEFAULT_LEAFCAPACITY 64
+#define MVP_MAX_BRANCHFACTOR 8
+#define MVP_MAX_LEAFCAPACITY 250 /* leaf entries that fit in a page */
+
+typedef struct ph_mvp_tree MVPTree;
+
+/* called for each point within the radius of a query, dp points into the
+ * mapped file and is only valid during the call; return non zero to stop */
+typedef int (*mvptree_visitCB)(const DP *dp, float distance, void *ctx);
+
+typedef struct ph_mvp_query_stats {
+    uint64_t distance_calls; /* hashdist evaluations */
+    uint64_t nodes;          /* pages visited */
+} MVPQueryStats;
+
+/** /brief write a new tree file holding the given points
+ *  /param filename - tree file, replaced if it exists
+ *  /param m - hash type, data type and hashdist of the points
+ *  /param points - DP** list of points, nbpoints may be 0 for an empty tree
+ *  /param branchfactor - children per vantage point, 2..MVP_MAX_BRANCHFACTOR (0 default)
+ *  /param leafcapacity - points per leaf, 2..MVP_MAX_LEAFCAPACITY (0 default)
+ *  /return MVPRetCode
+ **/
+MVPRetCode ph_mvptree_build(const char *filename, MVPFile *m, DP **points, int nbpoints, int branchfactor = 0,
+                            int leafcapacity = 0);
+
+/** /brief map an existing tree file
+ *  /return tree handle, NULL if the file is missing or not a tree file
+ **/
+MVPTree *ph_mvptree_open(const char *filename, int writable);
+
+void ph_mvptree_close(MVPTree *tree);
+
+/** /brief number of points in the tree
+ **/
+uint64_t ph_mvptree_size(const MVPTree *tree);
+
+/** /brief add one point, splitting its leaf into a subtree when full
+ **/
+MVPRetCode ph_mvptree_insert(MVPTree *tree, MVPFile *m, DP *dp);
+
+/** /brief visit every point with hashdist(query, point) < radius
+ *  /param stats - (out) work done by the query (may be NULL)
+ **/
+MVPRetCode ph_mvptree_query(MVPTree *tree, hash_compareCB hashdist, DP *query, float radius, mvptree_visitCB visit,
+                            void *ctx, MVPQueryStats *stats = NULL);
+
+/** /brief ph_mvptree_query with a radius visit may lower while the query
+ *         runs, nearer subtrees are searched first; a k nearest search sets
+ *         *radius to its k-th distance once it holds k points
+ **/
+MVPRetCode ph_mvptree_query(MVPTree *tree, hash_compareCB hashdist, DP *query, float *radius, mvptree_visitCB visit,
+                            void *ctx, MVPQueryStats *stats = NULL);
+
+#endif  // _PHASH_MVPTREE_H
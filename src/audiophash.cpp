@@ -25,7 +25,7 @@
 #include "audiophash.h"
 #include <samplerate.h>
 #include <sndfile.h>
-#include <thread>
+#include "ph_pool.h"
 #ifdef HAVE_LIBMPG123
 #include <mpg123.h>
 #endif
@@ -482,76 +482,43 @@ double *ph_audio_distance_ber(uint32_t *hash_a, const int Na, uint32_t *hash_b,
     free(dist);
     return pC;
 }
-#ifdef HAVE_PTHREAD
-
-void *ph_audio_thread(void *p) {
-    slice *s = (slice *)p;
-    for (int i = 0; i < s->n; ++i) {
-        DP *dp = (DP *)s->hash_p[i];
-        int N, count;
-        pair<int, int> *p = (pair<int, int> *)s->hash_params;
-        float *buf = ph_readaudio(dp->id, p->first, p->second, NULL, N);
-        uint32_t *hash = ph_audiohash(buf, N, p->first, count);
-        free(buf);
-        buf = NULL;
-        dp->hash = hash;
-        dp->hash_length = count;
-    }
+typedef struct ph_audio_batch {
+    DP **hashes;
+    int sr;
+    int channels;
+} AudioBatch;
+
+static void ph_audio_hash_task(void *arg, int i) {
+    AudioBatch *b = (AudioBatch *)arg;
+    DP *dp = b->hashes[i];
+    int N, count = 0;
+    float *buf = ph_readaudio(dp->id, b->sr, b->channels, NULL, N);
+    uint32_t *hash = buf ? ph_audiohash(buf, N, b->sr, count) : NULL;
+    free(buf);
+    buf = NULL;
+    dp->hash = hash;
+    dp->hash_length = hash ? count : 0;
 }
 
 DP **ph_audio_hashes(char *files[], int count, int sr, int channels, int threads) {
     if (!files || count <= 0)
         return nullptr;
 
-    int num_threads = 1;
-    if (count > 1) {
-        num_threads = threads < 0 ? 0 : threads;
-        int max_threads_num = std::thread::hardware_concurrency();
-        if (num_threads == 0 || num_threads > max_threads_num)
-            num_threads = max_threads_num;
-        if (num_threads > count)
-            num_threads = count;
-    }
-
     DP **hashes = (DP **)malloc(count * sizeof(DP *));
+    if (!hashes)
+        return nullptr;
     for (int i = 0; i < count; ++i) {
-        hashes[i] = (DP *)malloc(sizeof(DP));
-        hashes[i]->id = strdup(files[i]);
-    }
-
-    if (num_threads > 1) {
-        std::thread *thds = new std::thread[num_threads];
-        int rem = count % num_threads;
-        int start = 0;
-        int off = 0;
-        slice *s = new slice[num_threads];
-        for (int n = 0; n < num_threads; ++n) {
-            off = count / num_threads;
-            if (rem > 0) {
-                off += 1;
-                --rem;
-            }
-            s[n].hash_p = &hashes[start];
-            s[n].n = off;
-            s[n].hash_params = new pair<int, int>(sr, channels);
-            start += off;
-            thds[n] = std::thread(ph_image_thread, &s[n]);
-        }
-        for (int i = 0; i < num_threads; ++i) {
-            thds[i].join();
-            delete (pair<int, int> *)s[i].hash_params;
+        hashes[i] = ph_malloc_datapoint(AUDIO, UINT32ARRAY);
+        if (hashes[i])
+            hashes[i]->id = strdup(files[i]);
+        if (!hashes[i] || !hashes[i]->id) {
+            ph_free_datapoints(hashes, hashes[i] ? i + 1 : i);
+            return nullptr;
         }
-        delete[] s;
-        delete[] thds;
-    } else {
-        slice slice_tmp;
-        slice_tmp.hash_p = &hashes[0];
-        slice_tmp.hash_params = nullptr;
-        slice_tmp.n = count;
-        ph_image_thread(&slice_tmp);
-        delete (pair<int, int> *)slice_tmp.hash_params;
+        hashes[i]->hash_length = 0;
     }
 
+    AudioBatch batch = {hashes, sr, channels};
+    ph_parallel_for(ph_audio_hash_task, &batch, count, threads);
     return hashes;
 }
-#endif
@@ -73,6 +73,18 @@ float *ph_readaudio(const char *filename, int sr, int channels, float *sigbuf,
  */
 uint32_t *ph_audiohash(float *buf, int nbbuf, const int sr, int &nbframes);
 
+/* /brief audio hashes of several files, on the shared thread pool
+ *
+ * /param files - string array for name of files
+ * /param count - number of files
+ * /param sr - sample rate conversion
+ * /param channels - channels number conversion
+ * /param threads - number of pool threads to use, 0 for all of them
+ * /return DP** array of count points, a point's hash is NULL if its file
+ * could not be hashed
+ */
+DP **ph_audio_hashes(char *files[], int count, int sr, int channels, int threads = 0);
+
 /* /brief bit count set bits in 32bit variable
  * /param n
  * /return int number of bits set to 1, negative if error
@@ -1,4 +1,5 @@
 #include "pHash.h"
+#include "ph_imageio.h"
 
 static int _bmb_setbit(BMBHash &bh, uint32_t bit) {
     if (bh.hash == NULL) return -1;
@@ -15,10 +16,8 @@ static void _ph_bmb_new(BMBHash &bh, uint32_t n_bits) {
 
 void ph_bmb_free(BMBHash &bh) { delete[] bh.hash; }
 
-int ph_bmb_imagehash(const char *file, BMBHash &ret_hash) {
-    if (!file) return -1;
-
-    CImg<uint8_t> src;
+/* hash of the luma image (Y of YUV, 0..1), img is blurred and resized in place */
+static int ph_bmb_hash_luma(CImg<float> &img, BMBHash &ret_hash) {
     const float sigma = 1.0f;
     const int preset_width = 256;
     const int preset_height = 256;
@@ -26,54 +25,34 @@ int ph_bmb_imagehash(const char *file, BMBHash &ret_hash) {
     const int blk_height = 16;
     int n_blocks = (preset_width * preset_height) / (blk_width * blk_height);
 
-    try {
-        src.load(file);
-    } catch (CImgIOException ex) {
-        return -1;
-    }
-
-    CImg<float> img;
-    switch (src.spectrum()) {
-        case 4:
-        {
-            CImg<> rgb = src.get_shared_channels(0, 2);
-            img = rgb.get_RGBtoYUV();
-            img.channel(0);
-            break;
-        }
-        case 3:  // from RGB
-            img = src.get_RGBtoYUV();
-            img.channel(0);
-            break;
-        case 1:  // grayscale
-            break;
-        default:
-            return -1;
-    }
-
     img.blur(sigma, false,
              true); /* gaussian blur with dirichlet boundary condition */
     img.resize(preset_width, preset_height, 1, 1, 1); /* linear interpolation */
 
     CImg<double> localmeans(n_blocks, 1, 1, 1, 0);
 
+    /* one pass over the rows, adding each pixel to its block in the same
+     * row-major order as a block-by-block sum; only the first
+     * (preset - blk) / blk blocks per side are filled, the rest stay 0 */
+    const int blocks_x = (preset_width - 1) / blk_width;
+    const int blocks_y = (preset_height - 1) / blk_height;
+    float acc[(preset_width - 1) / blk_width];
     int blockidx = 0;
-    for (int blockrow = 0; blockrow < preset_height - blk_height;
-         blockrow += blk_height) {
-        for (int blockcol = 0; blockcol < preset_width - blk_width;
-             blockcol += blk_width) {
-            float acc = 0;
-            for (int subrow = blockrow; subrow < blockrow + blk_height;
-                 subrow++) {
-                for (int subcol = blockcol; subcol < blockcol + blk_width;
-                     subcol++) {
-                    float pxl = img.atXY(subcol, subrow);
-                    acc = acc + pxl;
-                }
+    for (int by = 0; by < blocks_y; by++) {
+        for (int bx = 0; bx < blocks_x; bx++)
+            acc[bx] = 0;
+        for (int subrow = by * blk_height; subrow < (by + 1) * blk_height; subrow++) {
+            const float *row = img.data(0, subrow);
+            for (int bx = 0; bx < blocks_x; bx++) {
+                const float *p = row + bx * blk_width;
+                float sum = acc[bx];
+                for (int x = 0; x < blk_width; x++)
+                    sum = sum + p[x];
+                acc[bx] = sum;
             }
-            localmeans(blockidx) = acc / (blk_height * blk_height);
-            blockidx++;
         }
+        for (int bx = 0; bx < blocks_x; bx++)
+            localmeans(blockidx++) = acc[bx] / (blk_height * blk_height);
     }
 
     double median_value = localmeans.median();
@@ -88,16 +67,25 @@ int ph_bmb_imagehash(const char *file, BMBHash &ret_hash) {
     return 0;
 }
 
+int ph_bmb_imagehash(const char *file, BMBHash &ret_hash) {
+    if (!file) return -1;
+
+    CImg<uint8_t> src;
+    if (ph_load_image_file(file, src, &ph_decode_bmb) < 0) return -1;
+
+    return _ph_bmb_imagehash(src, ret_hash);
+}
+
+int ph_bmb_imagehash_mem(const uint8_t *data, size_t len, BMBHash &ret_hash) {
+    CImg<uint8_t> src;
+    if (ph_decode_image_mem(data, len, src, &ph_decode_bmb) < 0) return -1;
+
+    return _ph_bmb_imagehash(src, ret_hash);
+}
+
 int _ph_bmb_imagehash(const CImg<uint8_t> &src, BMBHash &ret_hash) {
     if (src.is_empty()) return -1;
 
-    const float sigma = 1.0f;
-    const int preset_width = 256;
-    const int preset_height = 256;
-    const int blk_width = 16;
-    const int blk_height = 16;
-    int n_blocks = (preset_width * preset_height) / (blk_width * blk_height);
-
     CImg<float> img;
     switch (src.spectrum()) {
         case 4:
@@ -112,49 +100,64 @@ int _ph_bmb_imagehash(const CImg<uint8_t> &src, BMBHash &ret_hash) {
             img.channel(0);
             break;
         case 1:  // grayscale
+            img = src;
+            img /= 255;
             break;
         default:
             return -1;
     }
 
-    img.blur(sigma, false,
-             true); /* gaussian blur with dirichlet boundary condition */
-    img.resize(preset_width, preset_height, 1, 1, 1); /* linear interpolation */
+    return ph_bmb_hash_luma(img, ret_hash);
+}
 
-    CImg<double> localmeans(n_blocks, 1, 1, 1, 0);
+int ph_bmb_imagehash_view(const ImageView &view, BMBHash &ret_hash) {
+    if (!view.data || view.width <= 0 || view.height <= 0) return -1;
 
-    int blockidx = 0;
-    for (int blockrow = 0; blockrow < preset_height - blk_height;
-         blockrow += blk_height) {
-        for (int blockcol = 0; blockcol < preset_width - blk_width;
-             blockcol += blk_width) {
-            float acc = 0;
-            for (int subrow = blockrow; subrow < blockrow + blk_height;
-                 subrow++) {
-                for (int subcol = blockcol; subcol < blockcol + blk_width;
-                     subcol++) {
-                    float pxl = img.atXY(subcol, subrow);
-                    acc = acc + pxl;
-                }
+    int bpp, ro = 0, go = 0, bo = 0;
+    switch (view.format) {
+        case PH_PIXEL_GRAY8:
+        case PH_PIXEL_NV12:
+        case PH_PIXEL_I420:
+            bpp = 1;
+            break;
+        case PH_PIXEL_RGB24:
+            bpp = 3, ro = 0, go = 1, bo = 2;
+            break;
+        case PH_PIXEL_RGBA32:
+            bpp = 4, ro = 0, go = 1, bo = 2;
+            break;
+        case PH_PIXEL_BGRA32:
+            bpp = 4, ro = 2, go = 1, bo = 0;
+            break;
+        default:
+            return -1;
+    }
+    const size_t stride = view.stride ? (size_t)view.stride : (size_t)view.width * bpp;
+    if (stride < (size_t)view.width * bpp) return -1;
+
+    /* same Y as RGBtoYUV(), computed straight from the interleaved pixels */
+    CImg<float> img(view.width, view.height, 1, 1);
+    for (int y = 0; y < view.height; y++) {
+        const uint8_t *p = view.data + stride * y;
+        float *dst = img.data(0, y);
+        if (bpp == 1) {
+            for (int x = 0; x < view.width; x++) {
+                dst[x] = (float)p[x] / 255;
+            }
+        } else {
+            for (int x = 0; x < view.width; x++, p += bpp) {
+                dst[x] = 0.299f * ((float)p[ro] / 255) + 0.587f * ((float)p[go] / 255) +
+                         0.114f * ((float)p[bo] / 255);
             }
-            localmeans(blockidx) = acc / (blk_height * blk_height);
-            blockidx++;
         }
     }
 
-    double median_value = localmeans.median();
-
-    _ph_bmb_new(ret_hash, n_blocks);
-
-    for (int i = 0; i < n_blocks; i++) {
-        if (localmeans(i) > median_value) {
-            _bmb_setbit(ret_hash, i);
-        }
-    }
-    return 0;
+    return ph_bmb_hash_luma(img, ret_hash);
 }
 
 double ph_bmb_distance(const BMBHash &bh1, const BMBHash &bh2) {
-    return ph_hammingdistance2(bh1.hash, bh1.bytelength, bh2.hash,
-                               bh2.bytelength);
+    if (bh1.bytelength != bh2.bytelength) return -1.0;
+    int dist = ph_hamming_bytes(bh1.hash, bh2.hash, bh1.bytelength);
+    if (dist < 0) return -1.0;
+    return (double)dist / ((double)bh1.bytelength * 8);
 }
@@ -24,7 +24,21 @@
 
 #include "pHash.h"
 
-#include <thread>
+#include <errno.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "ph_dct32.h"
+#include "ph_imageio.h"
+#include "ph_mhcorr.h"
+#include "ph_pipeline.h"
+#include "ph_pool.h"
+#include "ph_preproc.h"
+#include "ph_radon.h"
 
 #ifdef HAVE_DIRENT_H
 #include <dirent.h>
@@ -48,6 +62,8 @@ const char *ph_about() {
 
 DP *ph_malloc_datapoint(HashType type, HashDataType datatype) {
     DP* dp = (DP*)malloc(sizeof(DP));
+    if (!dp)
+        return nullptr;
     dp->hash = nullptr;
     dp->id = nullptr;
     dp->path = nullptr;
@@ -154,8 +170,6 @@ int ph_feature_vector(const Projections &projs, Features &fv) {
         return -1;
 
     double *feat_v = fv.features;
-    double sum = 0.0;
-    double sum_sqd = 0.0;
     for (int k = 0; k < N; ++k) {
         double line_sum = 0.0;
         double line_sum_sqd = 0.0;
@@ -172,22 +186,19 @@ int ph_feature_vector(const Projections &projs, Features &fv) {
         const double nb_pixels_inv = 1.0 / nb_pixels;
         const double mean = line_sum * nb_pixels_inv;
         feat_v[k] = line_sum_sqd * nb_pixels_inv - mean * mean;
-        sum += feat_v[k];
-        sum_sqd += feat_v[k] * feat_v[k];
-    }
-    const double mean = sum / N;
-    const double var = 1.0 / sqrt((sum_sqd / N) - mean * mean);
-
-    for (int i = 0; i < N; ++i) {
-        feat_v[i] = (feat_v[i] - mean) * var;
     }
+    ph_feature_normalize(feat_v, N);
 
     return 0;
 }
 
 int ph_dct(const Features &fv, Digest &digest) {
     const int N = fv.size;
-    const int nb_coeffs = 40;
+    const int nb_coeffs = PH_RADIAL_COEFFS;
+
+    std::shared_ptr<const double> cos_table = ph_radon_dct_table(N);
+    if (!cos_table)
+        return -1;
 
     digest.coeffs = (uint8_t *)malloc(nb_coeffs * sizeof(uint8_t));
     if (!digest.coeffs)
@@ -203,13 +214,13 @@ int ph_dct(const Features &fv, Digest &digest) {
     double D_max = 0.0;
     double D_min = 0.0;
     const double sqrt_n = 1.0 / sqrt((double)N);
-    const double PI_2N = cimg::PI / (2 * N);
     const double SQRT_TWO_OVER_SQRT_N = SQRT_TWO * sqrt_n;
 
     for (int k = 0; k < nb_coeffs; ++k) {
+        const double *cos_k = cos_table.get() + k * N;
         double sum = 0.0;
         for (int n = 0; n < N; ++n) {
-            sum += R[n] * cos(PI_2N * (2 * n + 1) * k);
+            sum += R[n] * cos_k[n];
         }
         D_temp[k] = sum * ((k == 0) ? sqrt_n : SQRT_TWO_OVER_SQRT_N);
         D_max = D_max > D_temp[k] ? D_max : D_temp[k];
@@ -262,30 +273,15 @@ int ph_crosscorr(const Digest &x, const Digest &y, double &pcc, double threshold
     return result;
 }
 
-int _ph_image_digest(const CImg<uint8_t> &img, double sigma, double gamma, Digest &digest, int N) {
+/* digest of an already blurred single channel luma image */
+static int ph_image_digest_blurred(const CImg<uint8_t> &graysc, double gamma, Digest &digest, int N) {
     int result = -1;
-    CImg<uint8_t> graysc;
-    if (img.spectrum() > 3) {
-        CImg<> rgb = img.get_shared_channels(0, 2);
-        graysc = rgb.RGBtoYCbCr().channel(0);
-    } else if (img.spectrum() == 3) {
-        graysc = img.get_RGBtoYCbCr().channel(0);
-    } else if (img.spectrum() == 1) {
-        graysc = img;
-    } else {
-        return result;
-    }
-
-    graysc.blur((float)sigma);
 
     // (graysc / graysc.max()).pow(gamma);
 
-    Projections projs;
-    if (ph_radon_projections(graysc, N, projs) < 0)
-        goto cleanup;
-
     Features features;
-    if (ph_feature_vector(projs, features) < 0)
+    features.features = NULL;
+    if (ph_radon_features(graysc, N, features) < 0)
         goto cleanup;
 
     if (ph_dct(features, digest) < 0)
@@ -294,19 +290,59 @@ int _ph_image_digest(const CImg<uint8_t> &img, double sigma, double gamma, Diges
     result = 0;
 
 cleanup:
-    free(projs.nb_pix_perline);
     free(features.features);
-
-    delete projs.R;
     return result;
 }
 
+/* digest of a single channel luma image, graysc is blurred in place */
+static int ph_image_digest_gray(CImg<uint8_t> &graysc, double sigma, double gamma, Digest &digest, int N) {
+    graysc.blur((float)sigma);
+    return ph_image_digest_blurred(graysc, gamma, digest, N);
+}
+
+int _ph_image_digest(const CImg<uint8_t> &img, double sigma, double gamma, Digest &digest, int N) {
+    CImg<uint8_t> graysc;
+    if (img.spectrum() > 3) {
+        CImg<> rgb = img.get_shared_channels(0, 2);
+        graysc = rgb.RGBtoYCbCr().channel(0);
+    } else if (img.spectrum() == 3) {
+        graysc = img.get_RGBtoYCbCr().channel(0);
+    } else if (img.spectrum() == 1) {
+        graysc = img;
+    } else {
+        return -1;
+    }
+
+    return ph_image_digest_gray(graysc, sigma, gamma, digest, N);
+}
+
+int ph_image_digest_view(const ImageView &view, double sigma, double gamma, Digest &digest, int N) {
+    CImg<uint8_t> plane;
+    if (ph_luma_plane_view(view, plane) < 0)
+        return -1;
+
+    /* the blur works in place, never on the caller's buffer */
+    CImg<uint8_t> graysc;
+    if (plane.is_shared())
+        graysc = plane;
+    else
+        plane.move_to(graysc);
+
+    return ph_image_digest_gray(graysc, sigma, gamma, digest, N);
+}
+
 int ph_image_digest(const char *file, double sigma, double gamma, Digest &digest, int N) {
-    CImg<uint8_t> src(file);
-    int res = -1;
-    int result = _ph_image_digest(src, sigma, gamma, digest, N);
-    res = result;
-    return res;
+    CImg<uint8_t> src;
+    if (ph_load_image_file(file, src, &ph_decode_radial) < 0)
+        return -1;
+    return _ph_image_digest(src, sigma, gamma, digest, N);
+}
+
+int ph_image_digest_mem(const uint8_t *data, size_t len, double sigma, double gamma, Digest &digest, int N) {
+    CImg<uint8_t> src;
+    if (ph_decode_image_mem(data, len, src, &ph_decode_radial) < 0)
+        return -1;
+    return _ph_image_digest(src, sigma, gamma, digest, N);
 }
 
 int _ph_compare_images(const CImg<uint8_t> &imA, const CImg<uint8_t> &imB, double &pcc, double sigma, double gamma,
@@ -343,22 +379,39 @@ int ph_compare_images(const char *file1, const char *file2, double &pcc, double
     return res;
 }
 
-static CImg<float> ph_dct_matrix(const int N) {
-    CImg<float> matrix(N, N, 1, 1, 1 / sqrt((float)N));
-    const float c1 = sqrt(2.0 / N);
-    for (int x = 0; x < N; x++) {
-        for (int y = 1; y < N; y++) {
-            matrix(x, y) = c1 * cos((cimg::PI / 2 / N) * y * (2 * x + 1));
-        }
+static void ph_dct_hash_from_32x32(const float *img32, ulong64 &hash) {
+    float coeffs[64];
+    ph_dct32_lowfreq(img32, coeffs);
+
+    const CImg<float> subsec(coeffs, 64, 1, 1, 1, true);
+
+    float median = subsec.median();
+    hash = 0;
+    for (int i = 0; i < 64; i++, hash <<= 1) {
+        float current = coeffs[i];
+        if (current > median)
+            hash |= 0x01;
     }
-    return matrix;
 }
 
-static const CImg<float> dct_matrix = ph_dct_matrix(32);
-int _ph_dct_imagehash(const CImg<uint8_t> &src, ulong64 &hash) {
+int _ph_dct_imagehash(const CImg<uint8_t> &src, ulong64 &hash, DCTPreprocess mode) {
     if (src.is_empty()) {
         return -1;
     }
+
+    /* the reference keeps rgba luma in float, which the 8 bit rows of the
+     * fused pass cannot reproduce, so rgba only area averages when asked to */
+    const int fused = mode == DCT_PREPROCESS_FUSED || (mode == DCT_PREPROCESS_FUSED_NEAREST && src.spectrum() <= 3);
+    if (fused) {
+        float img32[32 * 32];
+        LumaSource luma;
+        ph_luma_source_cimg(src, luma);
+        if (ph_dct_preprocess_fused(luma, img32, mode == DCT_PREPROCESS_FUSED) < 0)
+            return -1;
+        ph_dct_hash_from_32x32(img32, hash);
+        return 0;
+    }
+
     CImg<float> meanfilter(7, 7, 1, 1, 1);
     CImg<float> img;
 
@@ -372,129 +425,269 @@ int _ph_dct_imagehash(const CImg<uint8_t> &src, ulong64 &hash) {
     }
 
     img.resize(32, 32);
-    const CImg<float> &C = dct_matrix;
-    CImg<float> Ctransp = C.get_transpose();
-
-    CImg<float> dctImage = (C)*img * Ctransp;
+    ph_dct_hash_from_32x32(img.data(), hash);
 
-    CImg<float> subsec = dctImage.crop(1, 1, 8, 8).unroll('x');
+    return 0;
+}
 
-    float median = subsec.median();
-    hash = 0;
-    for (int i = 0; i < 64; i++, hash <<= 1) {
-        float current = subsec(i);
-        if (current > median)
-            hash |= 0x01;
-    }
+int ph_dct_imagehash_view(const ImageView &view, ulong64 &hash, DCTPreprocess mode) {
+    LumaSource luma;
+    if (ph_luma_source_view(view, luma) < 0)
+        return -1;
 
+    float img32[32 * 32];
+    if (ph_dct_preprocess_fused(luma, img32, mode == DCT_PREPROCESS_FUSED) < 0)
+        return -1;
+    ph_dct_hash_from_32x32(img32, hash);
     return 0;
 }
 
 int ph_dct_imagehash(const char *file, ulong64 &hash) {
-    if (!file) {
-        return -1;
-    }
     CImg<uint8_t> src;
-    try {
-        src.load(file);
-    } catch (CImgIOException &ex) {
+    if (ph_load_image_file(file, src, &ph_decode_dct) < 0)
         return -1;
-    }
-    CImg<float> meanfilter(7, 7, 1, 1, 1);
-    CImg<float> img;
+    return _ph_dct_imagehash(src, hash);
+}
 
-    if (src.spectrum() > 3) {
-        CImg<> rgb = src.get_shared_channels(0, 2);
-        img = rgb.RGBtoYCbCr().channel(0).get_convolve(meanfilter);
-    } else if (src.spectrum() == 3) {
-        img = src.RGBtoYCbCr().channel(0).get_convolve(meanfilter);
-    } else {
-        img = src.channel(0).get_convolve(meanfilter);
-    }
+int ph_dct_imagehash_mem(const uint8_t *data, size_t len, ulong64 &hash) {
+    CImg<uint8_t> src;
+    if (ph_decode_image_mem(data, len, src, &ph_decode_dct) < 0)
+        return -1;
+    return _ph_dct_imagehash(src, hash);
+}
 
-    img.resize(32, 32);
-    const CImg<float> &C = dct_matrix;
-    CImg<float> Ctransp = C.get_transpose();
+/* scratch buffers of a thread hashing a batch, kept from one file to the
+ * next so images of the same size reuse them */
+typedef struct ph_image_workspace {
+    CImg<uint8_t> src;    /* decoded image */
+    CImg<float> response; /* mh kernel response */
+} ImageWorkspace;
+
+/* a batch of image files and the parameters of its hash */
+typedef struct ph_image_batch {
+    DP **hashes;
+    std::mutex lock;
+    std::vector<ImageWorkspace *> spare; /* workspaces no thread is using */
+    float alpha, lvl;                    /* mh */
+    double sigma, gamma;                 /* radial */
+    int N;
+} ImageBatch;
+
+static ImageWorkspace *ph_image_batch_workspace(ImageBatch *b) {
+    std::lock_guard<std::mutex> lock(b->lock);
+    if (b->spare.empty())
+        return new ImageWorkspace;
+    ImageWorkspace *ws = b->spare.back();
+    b->spare.pop_back();
+    return ws;
+}
 
-    CImg<float> dctImage = (C)*img * Ctransp;
+static void ph_image_batch_release(ImageBatch *b, ImageWorkspace *ws) {
+    std::lock_guard<std::mutex> lock(b->lock);
+    b->spare.push_back(ws);
+}
 
-    CImg<float> subsec = dctImage.crop(1, 1, 8, 8).unroll('x');
+/* one DP per file, hashed by stage on the pool as the files are read ahead;
+ * a workspace per hashing thread at most */
+static DP **ph_image_batch_run(ImageBatch &b, char *files[], int count, const PipelineOptions *opts,
+                               HashDataType datatype, ph_pipeline_hashCB stage) {
+    if (!files || count <= 0)
+        return nullptr;
 
-    float median = subsec.median();
-    hash = 0;
-    for (int i = 0; i < 64; i++, hash <<= 1) {
-        float current = subsec(i);
-        if (current > median)
-            hash |= 0x01;
+    b.hashes = (DP **)malloc(count * sizeof(DP *));
+    if (!b.hashes)
+        return nullptr;
+    for (int i = 0; i < count; ++i) {
+        b.hashes[i] = ph_malloc_datapoint(IMAGE, datatype);
+        b.hashes[i]->id = strdup(files[i]);
+        b.hashes[i]->hash_length = 0;
     }
 
-    return 0;
+    ph_pipeline_run(files, count, opts, stage, &b);
+    for (size_t i = 0; i < b.spare.size(); i++)
+        delete b.spare[i];
+    b.spare.clear();
+    return b.hashes;
 }
 
-void *ph_image_thread(void *p) {
-    slice *s = (slice *)p;
-    for (int i = 0; i < s->n; ++i) {
-        DP *dp = (DP *)s->hash_p[i];
-        ulong64 hash;
-        int ret = ph_dct_imagehash(dp->id, hash);
+static int ph_image_hash_stage(void *arg, int64_t i, const char *file, const uint8_t *data, size_t len) {
+    ImageBatch *b = (ImageBatch *)arg;
+    DP *dp = b->hashes[i];
+    ImageWorkspace *ws = ph_image_batch_workspace(b);
+    ulong64 hash = 0;
+    if (data && ph_decode_image_file_mem(file, data, len, ws->src, &ph_decode_dct) == 0 &&
+        _ph_dct_imagehash(ws->src, hash) == 0) {
         dp->hash = (ulong64 *)malloc(sizeof(hash));
-        memcpy(dp->hash, &hash, sizeof(hash));
-        dp->hash_length = 1;
+        if (dp->hash) {
+            memcpy(dp->hash, &hash, sizeof(hash));
+            dp->hash_length = 1;
+        }
     }
-    return NULL;
+    ph_image_batch_release(b, ws);
+    return 0;
+}
+
+DP **ph_dct_image_hashes_ex(char *files[], int count, const PipelineOptions *opts) {
+    // files are read ahead while the pool decodes and hashes
+    ImageBatch b;
+    return ph_image_batch_run(b, files, count, opts, UINT64ARRAY, ph_image_hash_stage);
 }
 
 DP **ph_dct_image_hashes(char *files[], int count, int threads) {
-    if (!files || count <= 0)
-        return nullptr;
+    PipelineOptions opts = {0, threads < 0 ? 0 : threads, 0, 0, PH_READ_AUTO};
+    return ph_dct_image_hashes_ex(files, count, &opts);
+}
 
-    int num_threads = 1;
-    if (count > 1) {
-        num_threads = threads < 0 ? 0 : threads;
-        int max_threads_num = std::thread::hardware_concurrency();
-        if (num_threads == 0 || num_threads > max_threads_num)
-            num_threads = max_threads_num;
-        if (num_threads > count)
-            num_threads = count;
-    }
+/* state of a streamed batch */
+typedef struct ph_batch_stream {
+    ph_batch_nextCB next;
+    ph_batch_resultCB result;
+    void *ctx;
+    std::mutex source;      /* held while taking the next file */
+    int64_t taken;
+    bool exhausted;
+    std::mutex emit;        /* results are handed over one at a time */
+    int64_t emitted;
+    std::atomic<bool> stop; /* result asked to stop */
+} BatchStream;
+
+static void ph_batch_stream_init(BatchStream &s, ph_batch_nextCB next, ph_batch_resultCB result, void *ctx) {
+    s.next = next;
+    s.result = result;
+    s.ctx = ctx;
+    s.taken = 0;
+    s.exhausted = false;
+    s.emitted = 0;
+    s.stop = false;
+}
 
-    DP **hashes = (DP **)malloc(count * sizeof(DP *));
-    for (int i = 0; i < count; ++i) {
-        hashes[i] = ph_malloc_datapoint(IMAGE, UINT64ARRAY);
-        hashes[i]->id = strdup(files[i]);
+/* hand a result over, false once the batch is stopped */
+static bool ph_batch_stream_emit(BatchStream *s, const DP *dp, int64_t index, int status) {
+    std::lock_guard<std::mutex> lock(s->emit);
+    if (s->stop.load())
+        return false;
+    s->emitted++;
+    if (s->result(dp, index, status, s->ctx))
+        s->stop = true;
+    return !s->stop.load();
+}
+
+static const char *ph_image_stream_next(void *arg) {
+    BatchStream *s = (BatchStream *)arg;
+    return s->next(s->ctx);
+}
+
+static int ph_image_stream_stage(void *arg, int64_t index, const char *file, const uint8_t *data, size_t len) {
+    BatchStream *s = (BatchStream *)arg;
+    if (s->stop.load())
+        return 1;
+    ulong64 hash = 0;
+    CImg<uint8_t> src;
+    const int status =
+        (data && ph_decode_image_file_mem(file, data, len, src, &ph_decode_dct) == 0 && _ph_dct_imagehash(src, hash) == 0)
+            ? 0
+            : -1;
+    DP dp = {(char *)file, status == 0 ? &hash : NULL, NULL, status == 0 ? 1u : 0u, UINT64ARRAY, IMAGE};
+    return ph_batch_stream_emit(s, &dp, index, status) ? 0 : 1;
+}
+
+int64_t ph_dct_image_hashes_stream(ph_batch_nextCB next, ph_batch_resultCB result, void *ctx,
+                                   const PipelineOptions *opts) {
+    if (!next || !result)
+        return -1;
+
+    BatchStream s;
+    ph_batch_stream_init(s, next, result, ctx);
+    ph_pipeline_stream(ph_image_stream_next, &s, opts, ph_image_stream_stage, &s);
+    return s.emitted;
+}
+
+/* files ph_read_imagehashes hashes */
+#define PH_IMAGE_EXTENSIONS "bmp,dib,jpg,jpeg,jpe,png,tif,tiff,gif,pbm,pgm,ppm,pnm"
+
+/* hashes of a directory tree, kept with their walk order */
+typedef struct ph_tree_hashes {
+    Walker *walker;
+    int capacity;
+    std::atomic<bool> full; /* capacity hashes in, no more files are taken */
+    bool failed;            /* out of memory */
+    std::vector<std::pair<int64_t, DP *> > hashes;
+} TreeHashes;
+
+static void ph_tree_free(TreeHashes &t, size_t from) {
+    for (size_t i = from; i < t.hashes.size(); i++) {
+        DP *h = t.hashes[i].second;
+        free(h->id);
+        free(h->hash);
+        free(h);
     }
+    t.hashes.resize(from);
+}
 
-    if (num_threads > 1) {
-        std::thread *thds = new std::thread[num_threads];
-        int rem = count % num_threads;
-        int start = 0;
-        int off = 0;
-        slice *s = new slice[num_threads];
-        for (int n = 0; n < num_threads; ++n) {
-            off = count / num_threads;
-            if (rem > 0) {
-                off += 1;
-                --rem;
-            }
-            s[n].hash_p = &hashes[start];
-            s[n].n = off;
-            s[n].hash_params = nullptr;
-            start += off;
-            thds[n] = std::thread(ph_image_thread, &s[n]);
-        }
-        for (int i = 0; i < num_threads; ++i) {
-            thds[i].join();
-        }
-        delete[] s;
-        delete[] thds;
-    } else {
-        slice slice_tmp;
-        slice_tmp.hash_p = &hashes[0];
-        slice_tmp.hash_params = nullptr;
-        slice_tmp.n = count;
-        ph_image_thread(&slice_tmp);
+static const char *ph_tree_next(void *ctx) {
+    TreeHashes *t = (TreeHashes *)ctx;
+    return t->full.load() ? NULL : ph_walk_next(t->walker);
+}
+
+/* once capacity files are hashed no more are taken, but the files in flight
+ * still come in: some may be earlier in the walk than those already kept */
+static int ph_tree_result(const DP *dp, int64_t index, int status, void *ctx) {
+    TreeHashes *t = (TreeHashes *)ctx;
+    if (status != 0)
+        return 0;
+    DP *h = ph_malloc_datapoint(IMAGE, UINT64ARRAY);
+    if (!h) {
+        t->failed = true;
+        return 1;
+    }
+    h->id = strdup(dp->id);
+    h->hash = (ulong64 *)malloc(sizeof(ulong64));
+    if (!h->id || !h->hash) {
+        free(h->id);
+        free(h->hash);
+        free(h);
+        t->failed = true;
+        return 1;
     }
+    memcpy(h->hash, dp->hash, sizeof(ulong64));
+    h->hash_length = 1;
+    t->hashes.push_back(std::make_pair(index, h));
+    if (t->capacity > 0 && (int)t->hashes.size() >= t->capacity)
+        t->full = true;
+    return 0;
+}
+
+DP **ph_read_imagehashes(const char *dirname, int capacity, int &count) {
+    count = 0;
+    WalkOptions opts = {PH_IMAGE_EXTENSIONS, 0, 0, 0};
+    TreeHashes t;
+    t.walker = ph_walk_open(dirname, &opts);
+    if (!t.walker)
+        return NULL;
+    t.capacity = capacity;
+    t.full = false;
+    t.failed = false;
 
+    // paths go from the walk straight to the readers of the hashing pipeline
+    ph_dct_image_hashes_stream(ph_tree_next, ph_tree_result, &t, NULL);
+    ph_walk_close(t.walker);
+
+    if (t.failed) {
+        ph_tree_free(t, 0);
+        return NULL;
+    }
+    // the first capacity files of the walk that could be hashed
+    std::sort(t.hashes.begin(), t.hashes.end());
+    if (capacity > 0 && t.hashes.size() > (size_t)capacity)
+        ph_tree_free(t, capacity);
+    DP **hashes = (DP **)malloc((t.hashes.size() + 1) * sizeof(DP *));
+    if (!hashes) {
+        ph_tree_free(t, 0);
+        return NULL;
+    }
+    for (size_t i = 0; i < t.hashes.size(); i++)
+        hashes[i] = t.hashes[i].second;
+    count = (int)t.hashes.size();
     return hashes;
 }
 
@@ -689,22 +882,23 @@ ulong64 *ph_dct_videohash(const char *filename, int &Length) {
     Length = keyframes->size();
 
     ulong64 *hash = (ulong64 *)malloc(sizeof(ulong64) * Length);
-    const CImg<float> &C = dct_matrix;
-    CImg<float> Ctransp = C.get_transpose();
-    CImg<float> dctImage;
-    CImg<float> subsec;
     CImg<uint8_t> currentframe;
+    CImg<float> frame32;
+    float coeffs[64];
+    const CImg<float> subsec(coeffs, 64, 1, 1, 1, true);
 
     for (unsigned int i = 0; i < keyframes->size(); i++) {
         currentframe = keyframes->at(i);
         currentframe.blur(1.0);
-        dctImage = (C) * (currentframe)*Ctransp;
-        subsec = dctImage.crop(1, 1, 8, 8).unroll('x');
+        frame32 = currentframe.get_channel(0);
+        if (frame32.width() != 32 || frame32.height() != 32)
+            frame32.resize(32, 32);
+        ph_dct32_lowfreq(frame32.data(), coeffs);
         float med = subsec.median();
         hash[i] = 0x0000000000000000;
         ulong64 one = 0x0000000000000001;
         for (int j = 0; j < 64; j++) {
-            if (subsec(j) > med)
+            if (coeffs[j] > med)
                 hash[i] |= one;
             one = one << 1;
         }
@@ -717,19 +911,16 @@ ulong64 *ph_dct_videohash(const char *filename, int &Length) {
     return hash;
 }
 
-void *ph_video_thread(void *p) {
-    slice *s = (slice *)p;
-    for (int i = 0; i < s->n; ++i) {
-        DP *dp = (DP *)s->hash_p[i];
-        int N;
-        ulong64 *hash = ph_dct_videohash(dp->id, N);
-        if (hash) {
-            dp->hash = hash;
-            dp->hash_length = N;
-        } else {
-            dp->hash = NULL;
-            dp->hash_length = 0;
-        }
+static void ph_video_hash_task(void *arg, int i) {
+    DP *dp = ((DP **)arg)[i];
+    int N;
+    ulong64 *hash = ph_dct_videohash(dp->id, N);
+    if (hash) {
+        dp->hash = hash;
+        dp->hash_length = N;
+    } else {
+        dp->hash = NULL;
+        dp->hash_length = 0;
     }
 }
 
@@ -737,54 +928,59 @@ DP **ph_dct_video_hashes(char *files[], int count, int threads) {
     if (!files || count <= 0)
         return nullptr;
 
-    int num_threads = 1;
-    if (count > 1) {
-        num_threads = threads < 0 ? 0 : threads;
-        int max_threads_num = std::thread::hardware_concurrency();
-        if (num_threads == 0 || num_threads > max_threads_num)
-            num_threads = max_threads_num;
-        if (num_threads > count)
-            num_threads = count;
-    }
-
     DP **hashes = (DP **)malloc(count * sizeof(DP *));
+    if (!hashes)
+        return nullptr;
     for (int i = 0; i < count; ++i) {
-        hashes[i] = (DP *)malloc(sizeof(DP));
-        hashes[i]->id = strdup(files[i]);
+        hashes[i] = ph_malloc_datapoint(VIDEO, UINT64ARRAY);
+        if (hashes[i])
+            hashes[i]->id = strdup(files[i]);
+        if (!hashes[i] || !hashes[i]->id) {
+            ph_free_datapoints(hashes, hashes[i] ? i + 1 : i);
+            return nullptr;
+        }
+        hashes[i]->hash_length = 0;
     }
 
-    if (num_threads > 1) {
-        std::thread *thds = new std::thread[num_threads];
-        int rem = count % num_threads;
-        int start = 0;
-        int off = 0;
-        slice *s = new slice[num_threads];
-        for (int n = 0; n < num_threads; ++n) {
-            off = count / num_threads;
-            if (rem > 0) {
-                off += 1;
-                --rem;
+    ph_parallel_for(ph_video_hash_task, hashes, count, threads);
+    return hashes;
+}
+
+/* each pool thread takes one file at a time, so only threads files are held */
+static void ph_video_stream_task(void *arg, int) {
+    BatchStream *s = (BatchStream *)arg;
+    for (;;) {
+        char *file = NULL;
+        int64_t index;
+        {
+            std::lock_guard<std::mutex> lock(s->source);
+            if (s->exhausted || s->stop.load())
+                return;
+            const char *name = s->next(s->ctx);
+            if (!name || !(file = strdup(name))) {
+                s->exhausted = true;
+                return;
             }
-            s[n].hash_p = &hashes[start];
-            s[n].n = off;
-            s[n].hash_params = nullptr;
-            start += off;
-            thds[n] = std::thread(ph_video_thread, &s[n]);
-        }
-        for (int i = 0; i < num_threads; ++i) {
-            thds[i].join();
+            index = s->taken++;
         }
-        delete[] s;
-        delete[] thds;
-    } else {
-        slice slice_tmp;
-        slice_tmp.hash_p = &hashes[0];
-        slice_tmp.hash_params = nullptr;
-        slice_tmp.n = count;
-        ph_video_thread(&slice_tmp);
+        int N = 0;
+        ulong64 *hash = ph_dct_videohash(file, N);
+        DP dp = {file, hash, NULL, hash ? (uint32_t)N : 0u, UINT64ARRAY, VIDEO};
+        ph_batch_stream_emit(s, &dp, index, hash ? 0 : -1);
+        free(hash);
+        free(file);
     }
+}
 
-    return hashes;
+int64_t ph_dct_video_hashes_stream(ph_batch_nextCB next, ph_batch_resultCB result, void *ctx, int threads) {
+    if (!next || !result)
+        return -1;
+
+    BatchStream s;
+    ph_batch_stream_init(s, next, result, ctx);
+    const int tasks = threads > 0 ? threads : ph_pool_size();
+    ph_parallel_for(ph_video_stream_task, &s, tasks, threads);
+    return s.emitted;
 }
 
 double ph_dct_videohash_dist(ulong64 *hashA, int N1, ulong64 *hashB, int N2, int threshold) {
@@ -837,81 +1033,63 @@ int ph_hamming_distance(const ulong64 hash1, const ulong64 hash2) {
 
 #ifdef HAVE_IMAGE_HASH
 
+/* the kernel stays valid until this thread asks for another one */
 CImg<float> *GetMHKernel(float alpha, float level) {
-    int sigma = (int)4 * pow((float)alpha, (float)level);
-    static CImg<float> *pkernel = NULL;
-    float xpos, ypos, A;
-    if (!pkernel) {
-        pkernel = new CImg<float>(2 * sigma + 1, 2 * sigma + 1, 1, 1, 0);
-        cimg_forXY(*pkernel, X, Y) {
-            xpos = pow(alpha, -level) * (X - sigma);
-            ypos = pow(alpha, -level) * (Y - sigma);
-            A = xpos * xpos + ypos * ypos;
-            pkernel->atXY(X, Y) = (2 - A) * exp(-A / 2);
-        }
-    }
-    return pkernel;
+    static thread_local std::shared_ptr<const CImg<float> > kernel;
+    kernel = ph_mh_kernel(alpha, level);
+    return (CImg<float> *)kernel.get();
 }
 
-uint8_t *_ph_mh_imagehash(const CImg<uint8_t> &src, int &N, float alpha, float lvl) {
-    if (src.is_empty()) {
-        return NULL;
-    }
+/* hash of the blurred, 512x512, equalized luma image, fresp is scratch
+ * space for the kernel response */
+static uint8_t *ph_mh_hash_equalized(const CImg<uint8_t> &img, int &N, float alpha, float lvl, CImg<float> &fresp) {
     uint8_t *hash = (unsigned char *)malloc(72 * sizeof(uint8_t));
+    if (!hash)
+        return NULL;
     N = 72;
 
-    CImg<uint8_t> img;
-    if (img.spectrum() > 3) {
-        CImg<> rgb = src.get_shared_channels(0, 2);
-        img = rgb.get_RGBtoYCbCr()
-                 .channel(0)
-                 .blur(1.0)
-                 .resize(512, 512, 1, 1, 5)
-                 .get_equalize(256);
-    } else if (src.spectrum() == 3) {
-        img = src.get_RGBtoYCbCr()
-                 .channel(0)
-                 .blur(1.0)
-                 .resize(512, 512, 1, 1, 5)
-                 .get_equalize(256);
-    } else {
-        img = src.get_channel(0)
-                 .get_blur(1.0)
-                 .resize(512, 512, 1, 1, 5)
-                 .get_equalize(256);
-    }
-    // src.clear();
-
-    CImg<float> *pkernel = GetMHKernel(alpha, lvl);
-    CImg<float> fresp = img.get_correlate(*pkernel);
-    img.clear();
+    ph_mh_correlate(img, alpha, lvl, fresp);
     fresp.normalize(0, 1.0);
-    CImg<float> blocks(31, 31, 1, 1, 0);
-    for (int rindex = 0; rindex < 31; rindex++) {
-        for (int cindex = 0; cindex < 31; cindex++) {
-            blocks(rindex, cindex) =
-                fresp.get_crop(rindex * 16, cindex * 16, rindex * 16 + 16 - 1, cindex * 16 + 16 - 1)
-                     .sum();
+    /* 16x16 block sums of the 31x31 grid. The tiles do not overlap, so one
+     * pass over the rows adds every pixel to its block, in the same row-major
+     * order (and double accumulator) as summing a crop of the block */
+    float blocks[31][31];
+    double acc[31];
+    for (int cindex = 0; cindex < 31; cindex++) {
+        for (int rindex = 0; rindex < 31; rindex++)
+            acc[rindex] = 0;
+        for (int y = cindex * 16; y < cindex * 16 + 16; y++) {
+            const float *row = fresp.data(0, y);
+            for (int rindex = 0; rindex < 31; rindex++) {
+                const float *p = row + rindex * 16;
+                double sum = acc[rindex];
+                for (int x = 0; x < 16; x++)
+                    sum += (double)p[x];
+                acc[rindex] = sum;
+            }
         }
+        for (int rindex = 0; rindex < 31; rindex++)
+            blocks[cindex][rindex] = (float)acc[rindex];
     }
+
     int hash_index;
-    int nb_ones = 0, nb_zeros = 0;
     int bit_index = 0;
     unsigned char hashbyte = 0;
     for (int rindex = 0; rindex < 31 - 2; rindex += 4) {
-        CImg<float> subsec;
         for (int cindex = 0; cindex < 31 - 2; cindex += 4) {
-            subsec = blocks.get_crop(cindex, rindex, cindex + 2, rindex + 2)
-                           .unroll('x');
-            float ave = subsec.mean();
-            cimg_forX(subsec, I) {
+            /* 3x3 sub-block, row by row */
+            float subsec[9];
+            double sum = 0;
+            for (int i = 0; i < 9; i++) {
+                subsec[i] = blocks[rindex + i / 3][cindex + i % 3];
+                sum += (double)subsec[i];
+            }
+            /* the reference stored the double mean in a float, compare against that rounded value */
+            const float ave = (float)(sum / 9);
+            for (int i = 0; i < 9; i++) {
                 hashbyte <<= 1;
-                if (subsec(I) > ave) {
+                if (subsec[i] > ave)
                     hashbyte |= 0x01;
-                    nb_ones++;
-                } else {
-                    nb_zeros++;
-                }
                 bit_index++;
                 if ((bit_index % 8) == 0) {
                     hash_index = (int)(bit_index / 8) - 1;
@@ -925,16 +1103,12 @@ uint8_t *_ph_mh_imagehash(const CImg<uint8_t> &src, int &N, float alpha, float l
     return hash;
 }
 
-uint8_t *ph_mh_imagehash(const char *filename, int &N, float alpha, float lvl) {
-    if (filename == NULL) {
+static uint8_t *ph_mh_hash_image(const CImg<uint8_t> &src, int &N, float alpha, float lvl, CImg<float> &fresp) {
+    if (src.is_empty()) {
         return NULL;
     }
-    uint8_t *hash = (unsigned char *)malloc(72 * sizeof(uint8_t));
-    N = 72;
 
-    CImg<uint8_t> src(filename);
     CImg<uint8_t> img;
-
     if (src.spectrum() > 3) {
         CImg<> rgb = src.get_shared_channels(0, 2);
         img = rgb.get_RGBtoYCbCr()
@@ -949,92 +1123,307 @@ uint8_t *ph_mh_imagehash(const char *filename, int &N, float alpha, float lvl) {
                  .resize(512, 512, 1, 1, 5)
                  .get_equalize(256);
     } else {
-        img = src.channel(0)
+        img = src.get_channel(0)
                  .get_blur(1.0)
                  .resize(512, 512, 1, 1, 5)
                  .get_equalize(256);
     }
-    src.clear();
 
-    CImg<float> *pkernel = GetMHKernel(alpha, lvl);
-    CImg<float> fresp = img.get_correlate(*pkernel);
-    img.clear();
-    fresp.normalize(0, 1.0);
-    CImg<float> blocks(31, 31, 1, 1, 0);
-    for (int rindex = 0; rindex < 31; rindex++) {
-        for (int cindex = 0; cindex < 31; cindex++) {
-            blocks(rindex, cindex) =
-                fresp.get_crop(rindex * 16, cindex * 16, rindex * 16 + 16 - 1, cindex * 16 + 16 - 1)
-                     .sum();
-        }
+    return ph_mh_hash_equalized(img, N, alpha, lvl, fresp);
+}
+
+uint8_t *_ph_mh_imagehash(const CImg<uint8_t> &src, int &N, float alpha, float lvl) {
+    CImg<float> fresp;
+    return ph_mh_hash_image(src, N, alpha, lvl, fresp);
+}
+
+uint8_t *ph_mh_imagehash_view(const ImageView &view, int &N, float alpha, float lvl) {
+    CImg<uint8_t> plane;
+    if (ph_luma_plane_view(view, plane) < 0)
+        return NULL;
+
+    /* like _ph_mh_imagehash(): color input is blurred as 8 bit luma, gray input in float */
+    CImg<uint8_t> img;
+    if (view.format == PH_PIXEL_GRAY8 || view.format == PH_PIXEL_NV12 || view.format == PH_PIXEL_I420) {
+        img = plane.get_blur(1.0)
+                   .resize(512, 512, 1, 1, 5)
+                   .get_equalize(256);
+    } else {
+        img = plane.blur(1.0)
+                   .resize(512, 512, 1, 1, 5)
+                   .get_equalize(256);
     }
-    int hash_index;
-    int nb_ones = 0, nb_zeros = 0;
-    int bit_index = 0;
-    unsigned char hashbyte = 0;
-    for (int rindex = 0; rindex < 31 - 2; rindex += 4) {
-        CImg<float> subsec;
-        for (int cindex = 0; cindex < 31 - 2; cindex += 4) {
-            subsec = blocks.get_crop(cindex, rindex, cindex + 2, rindex + 2)
-                           .unroll('x');
-            float ave = subsec.mean();
-            cimg_forX(subsec, I) {
-                hashbyte <<= 1;
-                if (subsec(I) > ave) {
-                    hashbyte |= 0x01;
-                    nb_ones++;
-                } else {
-                    nb_zeros++;
-                }
-                bit_index++;
-                if ((bit_index % 8) == 0) {
-                    hash_index = (int)(bit_index / 8) - 1;
-                    hash[hash_index] = hashbyte;
-                    hashbyte = 0x00;
-                }
+    plane.assign();
+
+    CImg<float> fresp;
+    return ph_mh_hash_equalized(img, N, alpha, lvl, fresp);
+}
+
+uint8_t *ph_mh_imagehash(const char *filename, int &N, float alpha, float lvl) {
+    if (filename == NULL) {
+        return NULL;
+    }
+
+    CImg<uint8_t> src;
+    if (ph_load_image_file(filename, src, &ph_decode_mh) < 0)
+        return NULL;
+
+    return _ph_mh_imagehash(src, N, alpha, lvl);
+}
+
+uint8_t *ph_mh_imagehash_mem(const uint8_t *data, size_t len, int &N, float alpha, float lvl) {
+    CImg<uint8_t> src;
+    if (ph_decode_image_mem(data, len, src, &ph_decode_mh) < 0)
+        return NULL;
+
+    return _ph_mh_imagehash(src, N, alpha, lvl);
+}
+
+/* the blur, resize and equalize stages of _ph_mh_imagehash on a luma plane */
+template <typename T>
+static uint8_t *ph_mh_hash_luma(const CImg<T> &blurred, int &N, float alpha, float lvl) {
+    CImg<uint8_t> img = blurred.get_resize(512, 512, 1, 1, 5).get_equalize(256);
+    CImg<float> fresp;
+    return ph_mh_hash_equalized(img, N, alpha, lvl, fresp);
+}
+
+static void ph_image_hashes_clear(ImageHashes &hashes) {
+    hashes.mask = 0;
+    hashes.dct = 0;
+    hashes.mh = NULL;
+    hashes.mh_length = 0;
+    hashes.bmb.hash = NULL;
+    hashes.bmb.bytelength = 0;
+    hashes.digest.id = NULL;
+    hashes.digest.coeffs = NULL;
+    hashes.digest.size = 0;
+}
+
+int _ph_image_hash_all(const CImg<uint8_t> &src, int mask, ImageHashes &hashes, double sigma, double gamma, int N,
+                       float alpha, float lvl) {
+    ph_image_hashes_clear(hashes);
+    if (src.is_empty())
+        return -1;
+
+    /* bmb works on the YUV luma in float, nothing to share with the others */
+    if ((mask & PH_HASH_BMB) && _ph_bmb_imagehash(src, hashes.bmb) == 0)
+        hashes.mask |= PH_HASH_BMB;
+
+    /* the other hashes take the same luma as the single hash functions: 8 bit
+     * YCbCr for rgb, float for rgba (only the radial digest rounds it to 8 bit) */
+    const int wanted = mask & (PH_HASH_DCT | PH_HASH_MH | PH_HASH_RADIAL);
+    if (src.spectrum() > 3 && wanted) {
+        CImg<> rgb = src.get_shared_channels(0, 2);
+        CImg<float> luma = rgb.RGBtoYCbCr().channel(0);
+        if (mask & PH_HASH_DCT) {
+            CImg<float> meanfilter(7, 7, 1, 1, 1);
+            CImg<float> img = luma.get_convolve(meanfilter).resize(32, 32);
+            ph_dct_hash_from_32x32(img.data(), hashes.dct);
+            hashes.mask |= PH_HASH_DCT;
+        }
+        if (mask & PH_HASH_MH) {
+            hashes.mh = ph_mh_hash_luma(luma.get_blur(1.0), hashes.mh_length, alpha, lvl);
+            if (hashes.mh)
+                hashes.mask |= PH_HASH_MH;
+        }
+        if (mask & PH_HASH_RADIAL) {
+            CImg<uint8_t> graysc = luma;
+            if (ph_image_digest_gray(graysc, sigma, gamma, hashes.digest, N) == 0)
+                hashes.mask |= PH_HASH_RADIAL;
+        }
+    } else if (wanted) {
+        const int color = src.spectrum() == 3;
+        CImg<uint8_t> luma = color ? src.get_RGBtoYCbCr().channel(0) : src.get_shared_channel(0);
+        if (mask & PH_HASH_DCT) {
+            float img32[32 * 32];
+            LumaSource source;
+            ph_luma_source_cimg(luma, source);
+            if (ph_dct_preprocess_fused(source, img32, 0) == 0) {
+                ph_dct_hash_from_32x32(img32, hashes.dct);
+                hashes.mask |= PH_HASH_DCT;
+            }
+        }
+        if (color) {
+            /* both blur the 8 bit plane in place, share it when sigma matches */
+            CImg<uint8_t> blurred;
+            if ((mask & PH_HASH_MH) && (mask & PH_HASH_RADIAL) && sigma == 1.0) {
+                luma.move_to(blurred);
+                blurred.blur(1.0);
+            }
+            const int shared = !blurred.is_empty();
+            if (mask & PH_HASH_MH) {
+                hashes.mh = shared ? ph_mh_hash_luma(blurred, hashes.mh_length, alpha, lvl)
+                                   : ph_mh_hash_luma(CImg<uint8_t>(luma, false).blur(1.0), hashes.mh_length,
+                                                     alpha, lvl);
+                if (hashes.mh)
+                    hashes.mask |= PH_HASH_MH;
+            }
+            if (mask & PH_HASH_RADIAL) {
+                const int res = shared ? ph_image_digest_blurred(blurred, gamma, hashes.digest, N)
+                                       : ph_image_digest_gray(luma, sigma, gamma, hashes.digest, N);
+                if (res == 0)
+                    hashes.mask |= PH_HASH_RADIAL;
+            }
+        } else {
+            /* gray input: mh blurs in float, the digest in 8 bit */
+            if (mask & PH_HASH_MH) {
+                hashes.mh = ph_mh_hash_luma(luma.get_blur(1.0), hashes.mh_length, alpha, lvl);
+                if (hashes.mh)
+                    hashes.mask |= PH_HASH_MH;
+            }
+            if ((mask & PH_HASH_RADIAL) && src.spectrum() == 1) {
+                CImg<uint8_t> graysc(luma, false);
+                if (ph_image_digest_gray(graysc, sigma, gamma, hashes.digest, N) == 0)
+                    hashes.mask |= PH_HASH_RADIAL;
             }
         }
     }
 
-    return hash;
+    return ((hashes.mask & mask) == (mask & PH_HASH_ALL)) ? 0 : -1;
+}
+
+int ph_image_hash_all(const char *file, int mask, ImageHashes &hashes, double sigma, double gamma, int N,
+                      float alpha, float lvl) {
+    DecodeOptions opts;
+    ph_decode_options_merge(mask, opts);
+
+    CImg<uint8_t> src;
+    if (ph_load_image_file(file, src, &opts) < 0) {
+        ph_image_hashes_clear(hashes);
+        return -1;
+    }
+    return _ph_image_hash_all(src, mask, hashes, sigma, gamma, N, alpha, lvl);
+}
+
+int ph_image_hash_all_mem(const uint8_t *data, size_t len, int mask, ImageHashes &hashes, double sigma,
+                          double gamma, int N, float alpha, float lvl) {
+    DecodeOptions opts;
+    ph_decode_options_merge(mask, opts);
+
+    CImg<uint8_t> src;
+    if (ph_decode_image_mem(data, len, src, &opts) < 0) {
+        ph_image_hashes_clear(hashes);
+        return -1;
+    }
+    return _ph_image_hash_all(src, mask, hashes, sigma, gamma, N, alpha, lvl);
+}
+
+void ph_image_hashes_free(ImageHashes &hashes) {
+    free(hashes.mh);
+    if (hashes.bmb.hash)
+        ph_bmb_free(hashes.bmb);
+    free(hashes.digest.coeffs);
+    ph_image_hashes_clear(hashes);
+}
+
+static int ph_mh_batch_stage(void *arg, int64_t i, const char *file, const uint8_t *data, size_t len) {
+    ImageBatch *b = (ImageBatch *)arg;
+    DP *dp = b->hashes[i];
+    ImageWorkspace *ws = ph_image_batch_workspace(b);
+    int N = 0;
+    if (data && ph_decode_image_file_mem(file, data, len, ws->src, &ph_decode_mh) == 0)
+        dp->hash = ph_mh_hash_image(ws->src, N, b->alpha, b->lvl, ws->response);
+    dp->hash_length = dp->hash ? N : 0;
+    ph_image_batch_release(b, ws);
+    return 0;
+}
+
+DP **ph_mh_image_hashes(char *files[], int count, float alpha, float lvl, const PipelineOptions *opts) {
+    ImageBatch b;
+    b.alpha = alpha;
+    b.lvl = lvl;
+    return ph_image_batch_run(b, files, count, opts, BYTEARRAY, ph_mh_batch_stage);
+}
+
+static int ph_bmb_batch_stage(void *arg, int64_t i, const char *file, const uint8_t *data, size_t len) {
+    ImageBatch *b = (ImageBatch *)arg;
+    DP *dp = b->hashes[i];
+    ImageWorkspace *ws = ph_image_batch_workspace(b);
+    BMBHash bh;
+    if (data && ph_decode_image_file_mem(file, data, len, ws->src, &ph_decode_bmb) == 0 &&
+        _ph_bmb_imagehash(ws->src, bh) == 0) {
+        /* BMBHash is new[]'ed, a DP hash is freed with free() */
+        dp->hash = malloc(bh.bytelength);
+        if (dp->hash) {
+            memcpy(dp->hash, bh.hash, bh.bytelength);
+            dp->hash_length = bh.bytelength;
+        }
+        ph_bmb_free(bh);
+    }
+    ph_image_batch_release(b, ws);
+    return 0;
+}
+
+DP **ph_bmb_image_hashes(char *files[], int count, const PipelineOptions *opts) {
+    ImageBatch b;
+    return ph_image_batch_run(b, files, count, opts, BYTEARRAY, ph_bmb_batch_stage);
+}
+
+static int ph_digest_batch_stage(void *arg, int64_t i, const char *file, const uint8_t *data, size_t len) {
+    ImageBatch *b = (ImageBatch *)arg;
+    DP *dp = b->hashes[i];
+    ImageWorkspace *ws = ph_image_batch_workspace(b);
+    Digest digest;
+    digest.coeffs = NULL;
+    if (data && ph_decode_image_file_mem(file, data, len, ws->src, &ph_decode_radial) == 0 &&
+        _ph_image_digest(ws->src, b->sigma, b->gamma, digest, b->N) == 0) {
+        dp->hash = digest.coeffs;
+        dp->hash_length = digest.size;
+    }
+    ph_image_batch_release(b, ws);
+    return 0;
+}
+
+DP **ph_image_digests(char *files[], int count, double sigma, double gamma, int N, const PipelineOptions *opts) {
+    ImageBatch b;
+    b.sigma = sigma;
+    b.gamma = gamma;
+    b.N = N;
+    return ph_image_batch_run(b, files, count, opts, BYTEARRAY, ph_digest_batch_stage);
 }
 #endif
 
 char **ph_readfilenames(const char *dirname, int &count) {
     count = 0;
-    struct dirent *dir_entry;
     DIR *dir = opendir(dirname);
     if (!dir)
         return NULL;
 
-    /*count files */
-    while ((dir_entry = readdir(dir)) != NULL) {
-        if (strcmp(dir_entry->d_name, ".") && strcmp(dir_entry->d_name, ".."))
-            count++;
-    }
-
-    /* alloc list of files */
-    char **files = (char **)malloc(count * sizeof(*files));
-    if (!files)
-        return NULL;
-
-    errno = 0;
-    int index = 0;
-    char path[1024];
-    path[0] = '\0';
-    rewinddir(dir);
-    while ((dir_entry = readdir(dir)) != 0) {
-        if (strcmp(dir_entry->d_name, ".") && strcmp(dir_entry->d_name, "..")) {
-            strcat(path, dirname);
-            strcat(path, "/");
-            strcat(path, dir_entry->d_name);
-            files[index++] = strdup(path);
+    /* one pass, growing the list */
+    const size_t dlen = strlen(dirname);
+    int capacity = 64;
+    char **files = (char **)malloc(capacity * sizeof(*files));
+    struct dirent *dir_entry = NULL;
+    while (files && (dir_entry = readdir(dir)) != NULL) {
+        if (!strcmp(dir_entry->d_name, ".") || !strcmp(dir_entry->d_name, ".."))
+            continue;
+        if (count == capacity) {
+            capacity *= 2;
+            char **grown = (char **)realloc(files, capacity * sizeof(*files));
+            if (!grown)
+                break;
+            files = grown;
         }
-        path[0] = '\0';
+        const size_t nlen = strlen(dir_entry->d_name);
+        char *path = (char *)malloc(dlen + nlen + 2);
+        if (!path)
+            break;
+        memcpy(path, dirname, dlen);
+        path[dlen] = '/';
+        memcpy(path + dlen + 1, dir_entry->d_name, nlen + 1);
+        files[count++] = path;
     }
-    if (errno)
-        return NULL;
     closedir(dir);
+
+    if (files && dir_entry) {
+        /* out of memory part way */
+        for (int i = 0; i < count; i++)
+            free(files[i]);
+        free(files);
+        files = NULL;
+    }
+    if (!files)
+        count = 0;
     return files;
 }
 
@@ -1051,17 +1440,12 @@ double ph_hammingdistance2(uint8_t *hashA, int lenA, uint8_t *hashB, int lenB) {
     if (lenA != lenB) {
         return -1.0;
     }
-    if ((hashA == NULL) || (hashB == NULL) || (lenA <= 0)) {
+    int dist = ph_hamming_bytes(hashA, hashB, lenA);
+    if (dist < 0) {
         return -1.0;
     }
-    double dist = 0;
-    uint8_t D = 0;
-    for (int i = 0; i < lenA; i++) {
-        D = hashA[i] ^ hashB[i];
-        dist = dist + (double)ph_bitcount8(D);
-    }
     double bits = (double)lenA * 8;
-    return dist / bits;
+    return (double)dist / bits;
 }
 
 TxtHashPoint *ph_texthash(const char *filename, int *nbpoints) {
@@ -29,6 +29,7 @@
 
 #define __STDC_CONSTANT_MACROS
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define PACKAGE_STRING "pHash"
@@ -76,6 +77,12 @@ typedef enum ph_hashdatatype {
     UINT64ARRAY = 8,
 } HashDataType;
 
+typedef enum ph_dct_preprocess {
+    DCT_PREPROCESS_CIMG          = 0, /* CImg luma, 7x7 mean filter and resize (reference) */
+    DCT_PREPROCESS_FUSED         = 1, /* single streaming pass, area resampling */
+    DCT_PREPROCESS_FUSED_NEAREST = 2, /* single streaming pass, same sampling as the reference */
+} DCTPreprocess;
+
 typedef enum ph_hashtype {
     TEXT   = 1, /* refers to bitwidth of the hash value */
     IMAGE  = 2,
@@ -99,6 +106,24 @@ typedef struct ph_slice {
     void *hash_params;
 } slice;
 
+typedef enum ph_pixel_format {
+    PH_PIXEL_GRAY8  = 1, /* 8 bit gray */
+    PH_PIXEL_RGB24  = 2, /* interleaved r, g, b */
+    PH_PIXEL_RGBA32 = 3, /* interleaved r, g, b, a */
+    PH_PIXEL_BGRA32 = 4, /* interleaved b, g, r, a */
+    PH_PIXEL_NV12   = 5, /* only the leading Y plane is read */
+    PH_PIXEL_I420   = 6, /* only the leading Y plane is read */
+} PixelFormat;
+
+/* view of a caller owned pixel buffer, nothing is copied or freed */
+typedef struct ph_image_view {
+    const uint8_t *data; /* first byte of the top row (of the Y plane for NV12/I420) */
+    int width;
+    int height;
+    int stride; /* bytes from one row to the next, 0 for tightly packed rows */
+    PixelFormat format;
+} ImageView;
+
 typedef struct bmb_hash {
     uint8_t *hash;
     uint32_t bytelength;
@@ -131,6 +156,51 @@ typedef struct ph_digest {
     int size;         // the size of the coeff array
 } Digest;
 
+/*! /brief mean centred, unit norm form of a Digest
+ */
+typedef struct ph_norm_digest {
+    float *coeffs;  // size values, (coeff - mean) / norm
+    int size;
+} NormDigest;
+
+/* hashes computed by ph_image_hash_all */
+typedef enum ph_image_hash_mask {
+    PH_HASH_DCT    = 0x01,
+    PH_HASH_MH     = 0x02,
+    PH_HASH_BMB    = 0x04,
+    PH_HASH_RADIAL = 0x08,
+    PH_HASH_ALL    = 0x0f,
+} ImageHashMask;
+
+/* all image signatures of one image, release with ph_image_hashes_free */
+typedef struct ph_image_hashes {
+    int mask;        /* ImageHashMask bits of the hashes actually computed */
+    ulong64 dct;
+    uint8_t *mh;     /* malloc'ed, mh_length bytes */
+    int mh_length;
+    BMBHash bmb;
+    Digest digest;   /* coeffs malloc'ed, id unset */
+} ImageHashes;
+
+/* in-memory multi-index hash table over ulong64 hashes, see ph_mih_create */
+typedef struct ph_mih_index MIHIndex;
+
+typedef struct ph_mih_match {
+    uint32_t id;  /* id given by ph_mih_insert */
+    int distance; /* hamming distance to the query */
+} MIHMatch;
+
+/* recursive directory walk, see ph_walk_open */
+typedef struct ph_walker Walker;
+
+/* files ph_walk_open keeps, 0 or NULL for no limit */
+typedef struct ph_walk_options {
+    const char *extensions; /* comma separated, case insensitive, as "jpg,png" */
+    size_t min_size;        /* smallest file size in bytes */
+    size_t max_size;        /* largest file size in bytes */
+    int threads;            /* threads listing directories, 0 for 4 */
+} WalkOptions;
+
 /* variables for textual hash */
 const int KgramLength = 50;
 const int WindowLength = 100;
@@ -166,6 +236,56 @@ DLL_EXPORT void ph_free_datapoints(DP **dp, const int nbpoints);
  */
 DLL_EXPORT const char *ph_about();
 
+/* a batch task, run once for each index of the batch */
+typedef void (*ph_taskCB)(void *arg, int index);
+
+/* runs task(arg, i) for every i in [0, count), on at most threads threads
+ * (0 for no limit), and returns once they have all run */
+typedef void (*ph_executorCB)(ph_taskCB task, void *arg, int count, int threads, void *ctx);
+
+/*! /brief size the thread pool the batch functions share
+ *  The pool starts on first use with one thread per core; batches already
+ *  running finish on the old pool.
+ *  /param threads - number of threads, '0' means one per core
+ *  /return int value - -1 for failure, 0 for success
+ */
+DLL_EXPORT int ph_set_threads(int threads);
+
+/*! /brief run the batch functions on an application executor instead of
+ *         the library pool
+ *  /param exec - executor, NULL to go back to the pool
+ *  /param ctx  - passed to exec
+ */
+DLL_EXPORT void ph_set_executor(ph_executorCB exec, void *ctx);
+
+/* how the batch functions read their files */
+typedef enum ph_read_backend {
+    PH_READ_AUTO = 0,  /* io_uring when built with liburing and the kernel has it */
+    PH_READ_PREAD = 1, /* reader threads with pread */
+    PH_READ_URING = 2, /* io_uring, pread when not available */
+} ReadBackend;
+
+/* stages of the batch functions that read files: reader threads read the
+ * files ahead while the pool decodes and hashes those already read */
+typedef struct ph_pipeline_options {
+    int readers;         /* threads reading files ahead with pread, 0 for 2 */
+    int workers;         /* pool threads decoding and hashing, 0 for all of them */
+    int depth;           /* files read ahead and not hashed yet, 0 for 4 per worker */
+    size_t max_bytes;    /* bytes read ahead and not hashed yet, 0 for 256 MB */
+    ReadBackend backend; /* io_uring reads depth files at once from one thread */
+} PipelineOptions;
+
+/* next file of a streamed batch, NULL at the end; called one at a time, the
+ * name only has to stay valid until the next call */
+typedef const char *(*ph_batch_nextCB)(void *ctx);
+
+/* result of one file of a streamed batch, called as the files complete, in
+ * any order but one call at a time: index is the file's place in the order
+ * next gave it, dp->id its name; status is 0, or -1 with dp->hash_length 0
+ * when the file could not be hashed. dp is only valid during the call,
+ * return non zero to stop the batch */
+typedef int (*ph_batch_resultCB)(const DP *dp, int64_t index, int status, void *ctx);
+
 /*! /brief radon function
  *  Find radon projections of N lines running through the image center for lines angled 0
  *  to 180 degrees from horizontal.
@@ -205,6 +325,34 @@ DLL_EXPORT int ph_dct(const Features &fv, Digest &digest);
 
 DLL_EXPORT int ph_crosscorr(const Digest &x, const Digest &y, double &pcc, double threshold = 0.90);
 
+/*! /brief normalize a digest for repeated cross correlation
+ *  Stores the digest mean centred and scaled to unit norm, so that matching it
+ *  only costs the dot products of ph_crosscorr.
+ *  /param digest - Digest struct
+ *  /param norm   - (out) NormDigest, free with ph_free_normalized_digest
+ *  /return - int value - less than 0 for error
+ */
+DLL_EXPORT int ph_normalize_digest(const Digest &digest, NormDigest &norm);
+
+DLL_EXPORT void ph_free_normalized_digest(NormDigest &norm);
+
+/*! /brief cross correlation of one digest against many
+ *  Scores the query against every candidate over all circular shifts, the
+ *  same measure as ph_crosscorr (up to float rounding). With early_out a
+ *  candidate is dropped as soon as the rows left can not lift any shift
+ *  above threshold; its pcc is then the partial peak and its shift -1.
+ *  /param query      - NormDigest of the query
+ *  /param candidates - array of count NormDigest's, same size as the query
+ *  /param count      - number of candidates
+ *  /param pcc        - (out) count peaks of cross correlation
+ *  /param shift      - (out) count shifts of the peaks, as d in ph_crosscorr
+ *  /param threshold  - double value for the threshold
+ *  /param early_out  - 1 to skip candidates that can not reach threshold
+ *  /return - int value - number of candidates above threshold, < 0 for error
+ */
+DLL_EXPORT int ph_crosscorr_many(const NormDigest &query, const NormDigest *candidates, int count, double *pcc,
+                                 int *shift, double threshold = 0.90, int early_out = 1);
+
 /*! /brief image digest
  *  Compute the image digest for an image given the input image
  *  /param img - CImg object representing an input image
@@ -226,6 +374,30 @@ DLL_EXPORT int _ph_image_digest(const CImg<uint8_t> &img, double sigma, double g
  */
 DLL_EXPORT int ph_image_digest(const char *file, double sigma, double gamma, Digest &digest, int N = 180);
 
+/*! /brief image digest
+ *  Compute the image digest of an encoded image (bmp, jpeg, png, ...) held in memory.
+ *  /param data - encoded image bytes
+ *  /param len  - number of bytes
+ *  /param sigma - double value for the deviation for gaussian filter
+ *  /param gamma - double value for gamma correction on the input image.
+ *  /param digest - Digest struct
+ *  /param N      - int value for number of angles to consider
+ *  /return       - less than 0 for error
+ */
+DLL_EXPORT int ph_image_digest_mem(const uint8_t *data, size_t len, double sigma, double gamma, Digest &digest,
+                                   int N = 180);
+
+/*! /brief image digest
+ *  Compute the image digest reading a caller owned pixel buffer in place
+ *  /param view - ImageView of the input image
+ *  /param sigma - double value for the deviation for a gaussian filter function
+ *  /param gamma - double value for gamma correction on the input image
+ *  /param digest - (out) Digest struct
+ *  /param N      - int value for the number of angles to consider.
+ *  /return       - less than 0 for error
+ */
+DLL_EXPORT int ph_image_digest_view(const ImageView &view, double sigma, double gamma, Digest &digest, int N = 180);
+
 /*! /brief compare 2 images
  *  /param imA - CImg object of first image
  *  /param imB - CImg object of second image
@@ -253,32 +425,120 @@ DLL_EXPORT int ph_compare_images(const char *file1, const char *file2, double &p
                                  double gamma = 1.0, int N = 180, double threshold = 0.90);
 
 /*! /brief compute dct robust image hash
+ *  With libjpeg (WITH_OTHER_IMAGE_HASH) large jpeg files are decoded in gray at
+ *  a reduced size, which moves the hash by a few bits from a full size decode.
  *  /param file string variable for name of file
  *  /param hash of type ulong64 (must be 64-bit variable)
  *  /return int value - -1 for failure, 1 for success
  */
 DLL_EXPORT int ph_dct_imagehash(const char *file, ulong64 &hash);
 
+/*! /brief compute dct robust image hash of an encoded image held in memory
+ *  /param data - encoded image bytes (bmp, jpeg, png, ...)
+ *  /param len  - number of bytes
+ *  /param hash of type ulong64 (must be 64-bit variable)
+ *  /return int value - -1 for failure, 0 for success
+ */
+DLL_EXPORT int ph_dct_imagehash_mem(const uint8_t *data, size_t len, ulong64 &hash);
+
 /*! /brief compute dct robust image hash
  *  /param img - CImg object of source image
  *  /param hash of type ulong64 (must be 64-bit variable)
- *  /return int value - -1 for failure, 1 for success
+ *  /param mode - DCT_PREPROCESS_CIMG filters the whole image then resizes it with CImg.
+ *                The fused modes convert, box filter and resample to 32x32 in a single pass
+ *                over the rows, with O(width) memory instead of full size float copies.
+ *                DCT_PREPROCESS_FUSED_NEAREST samples like the reference and gives the same
+ *                hash (rgba input, whose luma the reference keeps in float, takes the
+ *                reference path). DCT_PREPROCESS_FUSED area averages instead, which is less
+ *                sensitive to noise but not compatible with stored hashes: expect a hamming
+ *                distance of 6 to 12 to the reference hash, up to 24 for small or very
+ *                elongated images.
+ *  /return int value - -1 for failure, 0 for success
+ */
+DLL_EXPORT int _ph_dct_imagehash(const CImg<uint8_t> &img, ulong64 &hash, DCTPreprocess mode = DCT_PREPROCESS_CIMG);
+
+/*! /brief compute dct robust image hash from a caller owned pixel buffer
+ *  The buffer is streamed row by row through the fused preprocessing, only the
+ *  luma of each row is computed and no image copy is made.
+ *  /param view - ImageView of the source image
+ *  /param hash of type ulong64 (must be 64-bit variable)
+ *  /param mode - DCT_PREPROCESS_FUSED_NEAREST (same hash as _ph_dct_imagehash) or
+ *                DCT_PREPROCESS_FUSED, DCT_PREPROCESS_CIMG is treated as the former
+ *  /return int value - -1 for failure, 0 for success
  */
-DLL_EXPORT int _ph_dct_imagehash(const CImg<uint8_t> &img, ulong64 &hash);
+DLL_EXPORT int ph_dct_imagehash_view(const ImageView &view, ulong64 &hash,
+                                     DCTPreprocess mode = DCT_PREPROCESS_FUSED_NEAREST);
 
 /*! /brief compute multiple dct robust image hashes
  *  /param files  - string array for name of files
  *  /param count  - number of files
- *  /param threads- Number of threads(use c++11 std::thread, 
- *      defalut '0' means to use the max number of concurrent threads supported)
- *  /return - hash array
+ *  /param threads- Number of threads of the shared pool to use (see
+ *      ph_set_threads), defalut '0' means all of them
+ *  /return - hash array, a file that could not be read or hashed has a NULL
+ *            hash and a hash_length of 0
  */
 DLL_EXPORT DP **ph_dct_image_hashes(char *files[], int count, int threads = 0);
 
+/*! /brief ph_dct_image_hashes with the read ahead of the files tuned
+ *  /param opts - PipelineOptions (may be NULL for defaults)
+ *  /return - hash array, failed files as for ph_dct_image_hashes
+ */
+DLL_EXPORT DP **ph_dct_image_hashes_ex(char *files[], int count, const PipelineOptions *opts);
+
+/*! /brief compute dct robust image hashes of files taken from a source,
+ *  handing over each hash as soon as it is done. Only the files read ahead
+ *  and being hashed are held (see PipelineOptions), so the batch may have
+ *  any number of files.
+ *  /param next   - source of the file names
+ *  /param result - called with each hash
+ *  /param ctx    - passed to next and result
+ *  /param opts   - PipelineOptions (may be NULL for defaults)
+ *  /return number of results handed over, -1 for bad arguments
+ */
+DLL_EXPORT int64_t ph_dct_image_hashes_stream(ph_batch_nextCB next, ph_batch_resultCB result, void *ctx,
+                                              const PipelineOptions *opts);
+
+/*! /brief compute mh image hashes of multiple files on the shared pool,
+ *  reading the files ahead as ph_dct_image_hashes_ex does
+ *  /param alpha, lvl - see ph_mh_imagehash
+ *  /param opts - PipelineOptions (may be NULL for defaults)
+ *  /return - count BYTEARRAY DPs of 72 bytes, hash NULL and hash_length 0
+ *      for files that failed
+ */
+DLL_EXPORT DP **ph_mh_image_hashes(char *files[], int count, float alpha = 2.0f, float lvl = 1.0f,
+                                   const PipelineOptions *opts = NULL);
+
+/*! /brief compute bmb image hashes of multiple files, see ph_mh_image_hashes
+ *  /return - count BYTEARRAY DPs, hash_length is the BMBHash bytelength
+ */
+DLL_EXPORT DP **ph_bmb_image_hashes(char *files[], int count, const PipelineOptions *opts = NULL);
+
+/*! /brief compute radial image digests of multiple files, see ph_mh_image_hashes
+ *  /param sigma, gamma, N - see ph_image_digest
+ *  /return - count BYTEARRAY DPs holding the Digest coeffs
+ */
+DLL_EXPORT DP **ph_image_digests(char *files[], int count, double sigma = 1.0, double gamma = 1.0, int N = 180,
+                                 const PipelineOptions *opts = NULL);
+
 DLL_EXPORT int ph_bmb_imagehash(const char *file, BMBHash &ret_hash);
 
+/*! /brief compute bmb image hash of an encoded image held in memory
+ *  /param data - encoded image bytes (bmp, jpeg, png, ...)
+ *  /param len  - number of bytes
+ *  /param ret_hash - (out) BMBHash, free with ph_bmb_free
+ *  /return int value - -1 for failure, 0 for success
+ */
+DLL_EXPORT int ph_bmb_imagehash_mem(const uint8_t *data, size_t len, BMBHash &ret_hash);
+
 DLL_EXPORT int _ph_bmb_imagehash(const CImg<uint8_t> &img, BMBHash &ret_hash);
 
+/*! /brief compute bmb image hash from a caller owned pixel buffer
+ *  /param view - ImageView of the source image
+ *  /param ret_hash - (out) BMBHash, free with ph_bmb_free
+ *  /return int value - -1 for failure, 0 for success
+ */
+DLL_EXPORT int ph_bmb_imagehash_view(const ImageView &view, BMBHash &ret_hash);
+
 DLL_EXPORT double ph_bmb_distance(const BMBHash &bh1, const BMBHash &bh2);
 
 #endif
@@ -290,6 +550,14 @@ DLL_EXPORT ulong64 *ph_dct_videohash(const char *filename, int &Length);
 
 DLL_EXPORT DP **ph_dct_video_hashes(char *files[], int count, int threads = 0);
 
+/*! /brief compute dct video hashes of files taken from a source, handing
+ *  over each hash as soon as it is done, see ph_dct_image_hashes_stream
+ *  /param threads - number of threads of the shared pool to use, 0 for all
+ *  /return number of results handed over, -1 for bad arguments
+ */
+DLL_EXPORT int64_t ph_dct_video_hashes_stream(ph_batch_nextCB next, ph_batch_resultCB result, void *ctx,
+                                              int threads = 0);
+
 DLL_EXPORT double ph_dct_videohash_dist(ulong64 *hashA, int N1, ulong64 *hashB, int N2, int threshold = 21);
 #endif
 
@@ -302,11 +570,110 @@ DLL_EXPORT double ph_dct_videohash_dist(ulong64 *hashA, int N1, ulong64 *hashB,
 #ifdef HAVE_IMAGE_HASH
 DLL_EXPORT int ph_hamming_distance(const ulong64 hash1, const ulong64 hash2);
 
+/*! /brief find every hash of an array within a hamming distance of a query
+ *  Runs on AVX-512 VPOPCNTQ or AVX2 when the cpu has them, and splits large
+ *  arrays (8MB and up per thread) across threads.
+ *  /param query     - hash to look for
+ *  /param db        - array of n hashes
+ *  /param n         - number of hashes in db
+ *  /param max_dist  - largest distance to report (inclusive)
+ *  /param out_ids   - (out) indexes into db of the matches, in increasing order (may be NULL to count)
+ *  /param out_dists - (out) distances of the matches (may be NULL)
+ *  /param capacity  - room in out_ids and out_dists, by default n
+ *  /param threads   - number of threads, '0' means the max number of concurrent threads supported
+ *  /return number of matches (only the first capacity are stored), -1 for failure
+ */
+DLL_EXPORT long long ph_hamming_scan(ulong64 query, const ulong64 *db, size_t n, int max_dist, size_t *out_ids,
+                                     int *out_dists, size_t capacity = (size_t)-1, int threads = 0);
+
+/*! /brief find the k hashes of an array nearest to a query
+ *  /param query     - hash to look for
+ *  /param db        - array of n hashes
+ *  /param n         - number of hashes in db
+ *  /param k         - number of neighbours wanted
+ *  /param out_ids   - (out) k indexes into db, nearest first, ties by lower index
+ *  /param out_dists - (out) k distances (may be NULL)
+ *  /param threads   - number of threads, '0' means the max number of concurrent threads supported
+ *  /return number of neighbours stored, min(k, n), -1 for failure
+ */
+DLL_EXPORT int ph_hamming_topk(ulong64 query, const ulong64 *db, size_t n, int k, size_t *out_ids, int *out_dists,
+                               int threads = 0);
+
+/*! /brief create an empty multi-index hash (MIH) index for ulong64 hashes
+ *  Hashes are cut into m substrings with one table each; radius queries
+ *  only probe the substring neighbourhoods, which pays off while the radius
+ *  stays small against the substring width (r up to about 3m).
+ *  Queries may run concurrently, inserts and deletes may not.
+ *  /param m - number of substrings, 2..16; around 64 / log2(number of hashes)
+ *             works best, '0' for the default of 4 (16 bit substrings)
+ *  /return pointer to the index, release with ph_mih_free (NULL for error)
+ */
+DLL_EXPORT MIHIndex *ph_mih_create(int m = 0);
+
+DLL_EXPORT void ph_mih_free(MIHIndex *index);
+
+/*! /brief number of hashes in the index
+ */
+DLL_EXPORT int ph_mih_size(const MIHIndex *index);
+
+/*! /brief add a hash to the index
+ *  /return id of the hash (ids of deleted hashes are reused), -1 for failure
+ */
+DLL_EXPORT int64_t ph_mih_insert(MIHIndex *index, ulong64 hash);
+
+/*! /brief add count hashes to the index
+ *  /param ids - (out) count ids (may be NULL)
+ *  /return int count, -1 for failure
+ */
+DLL_EXPORT int ph_mih_insert_many(MIHIndex *index, const ulong64 *hashes, int count, uint32_t *ids);
+
+/*! /brief remove a hash from the index
+ *  /return int value - -1 for an unknown id, 0 for success
+ */
+DLL_EXPORT int ph_mih_delete(MIHIndex *index, uint32_t id);
+
+/*! /brief find every hash within a hamming distance of a query
+ *  /param radius   - largest distance to report (inclusive)
+ *  /param matches  - (out) matches sorted by distance, then id
+ *  /param capacity - room in matches, negative fails
+ *  /return number of matches (only the first capacity are stored), -1 for failure
+ */
+DLL_EXPORT int ph_mih_query(const MIHIndex *index, ulong64 query, int radius, MIHMatch *matches, int capacity);
+
+/*! /brief find the k hashes nearest to a query
+ *  /param matches - (out) k matches sorted by distance, then id
+ *  /return number of matches stored, min(k, size), -1 for failure
+ */
+DLL_EXPORT int ph_mih_topk(const MIHIndex *index, ulong64 query, int k, MIHMatch *matches);
+
+/*! /brief ph_mih_query for nq queries
+ *  /param matches  - (out) capacity slots per query, nq * capacity in all
+ *  /param counts   - (out) nq match counts, as returned by ph_mih_query
+ *  /param threads  - number of threads, '0' means the max number of concurrent threads supported
+ *  /return int nq, -1 for failure
+ */
+DLL_EXPORT int ph_mih_query_batch(const MIHIndex *index, const ulong64 *queries, int nq, int radius,
+                                  MIHMatch *matches, int capacity, int *counts, int threads = 0);
+
+/*! /brief ph_mih_topk for nq queries
+ *  /param matches  - (out) k slots per query, nq * k in all
+ *  /param counts   - (out) nq match counts, as returned by ph_mih_topk
+ *  /param threads  - number of threads, '0' means the max number of concurrent threads supported
+ *  /return int nq, -1 for failure
+ */
+DLL_EXPORT int ph_mih_topk_batch(const MIHIndex *index, const ulong64 *queries, int nq, int k, MIHMatch *matches,
+                                 int *counts, int threads = 0);
+
 /** /brief create a list of datapoint's directly from a directory of image files
+ *  Walks the whole tree with ph_walk_open and hashes the image files (by
+ *  extension) as they are found, with ph_dct_image_hashes_stream; files that
+ *  fail to decode are left out.
  *  /param dirname - path and name of directory containg all image file names
- *  /param capacity - int value for upper limit on number of hashes
+ *  /param capacity - int value for upper limit on number of hashes, 0 for none;
+ *      the first capacity files of the walk that could be hashed are kept
  *  /param count - number of hashes created (out param)
- *  /return pointer to a list of DP pointers (NULL for error)
+ *  /return pointer to a list of DP pointers in the order the walk found the
+ *      files, free with ph_free_datapoints (NULL for error)
  */
 
 DLL_EXPORT DP **ph_read_imagehashes(const char *dirname, int capacity, int &count);
@@ -320,6 +687,17 @@ DLL_EXPORT DP **ph_read_imagehashes(const char *dirname, int capacity, int &coun
  **/
 DLL_EXPORT uint8_t *ph_mh_imagehash(const char *filename, int &N, float alpha = 2.0f, float lvl = 1.0f);
 
+/** /brief create MH image hash of an encoded image held in memory
+ *   /param data - encoded image bytes (bmp, jpeg, png, ...)
+ *   /param len  - number of bytes
+ *   /param N - (out) int value for length of image hash returned
+ *   /param alpha - int scale factor for marr wavelet (default=2)
+ *   /param lvl   - int level of scale factor (default = 1)
+ *   /return uint8_t array
+ **/
+DLL_EXPORT uint8_t *ph_mh_imagehash_mem(const uint8_t *data, size_t len, int &N, float alpha = 2.0f,
+                                        float lvl = 1.0f);
+
 /** /brief create MH image hash for filename image
  *   /param img - CImg object of source image
  *   /param N - (out) int value for length of image hash returned
@@ -328,7 +706,61 @@ DLL_EXPORT uint8_t *ph_mh_imagehash(const char *filename, int &N, float alpha =
  *   /return uint8_t array
  **/
 DLL_EXPORT uint8_t *_ph_mh_imagehash(const CImg<uint8_t> &img, int &N, float alpha = 2.0f, float lvl = 1.0f);
+
+/** /brief create MH image hash from a caller owned pixel buffer
+ *   Gray, NV12 and I420 buffers with packed rows are used without any copy,
+ *   other layouts are converted straight to a single luma plane.
+ *   /param view - ImageView of the source image
+ *   /param N - (out) int value for length of image hash returned
+ *   /param alpha - int scale factor for marr wavelet (default=2)
+ *   /param lvl   - int level of scale factor (default = 1)
+ *   /return uint8_t array
+ **/
+DLL_EXPORT uint8_t *ph_mh_imagehash_view(const ImageView &view, int &N, float alpha = 2.0f, float lvl = 1.0f);
+#endif
+#ifdef HAVE_IMAGE_HASH
+/** /brief compute several image hashes from one decoded image
+ *   The luma plane is built once and shared by the dct, mh and radial hashes,
+ *   and so is the blurred plane when sigma is 1.0 (the mh blur). Each hash is
+ *   the same as its own CImg entry point gives for img.
+ *   /param img - CImg object of source image
+ *   /param mask - ImageHashMask bits of the wanted hashes
+ *   /param hashes - (out) ImageHashes, free with ph_image_hashes_free
+ *   /param sigma, gamma, N - radial digest parameters, see ph_image_digest
+ *   /param alpha, lvl - mh hash parameters, see ph_mh_imagehash
+ *   /return int value - less than 0 if any wanted hash failed, hashes.mask
+ *                       tells which ones are valid
+ **/
+DLL_EXPORT int _ph_image_hash_all(const CImg<uint8_t> &img, int mask, ImageHashes &hashes, double sigma = 1.0,
+                                  double gamma = 1.0, int N = 180, float alpha = 2.0f, float lvl = 1.0f);
+
+/** /brief compute several image hashes of an image file with a single decode
+ *   The decode is as small as the most demanding wanted hash allows, so jpeg
+ *   hashes can differ slightly from the single hash functions.
+ *   /param file - name of image file
+ *   /param mask - ImageHashMask bits of the wanted hashes
+ *   /param hashes - (out) ImageHashes, free with ph_image_hashes_free
+ *   /return int value - less than 0 if any wanted hash failed
+ **/
+DLL_EXPORT int ph_image_hash_all(const char *file, int mask, ImageHashes &hashes, double sigma = 1.0,
+                                 double gamma = 1.0, int N = 180, float alpha = 2.0f, float lvl = 1.0f);
+
+/** /brief compute several image hashes of an encoded image held in memory
+ *   /param data - encoded image bytes (bmp, jpeg, png, ...)
+ *   /param len  - number of bytes
+ *   /param mask - ImageHashMask bits of the wanted hashes
+ *   /param hashes - (out) ImageHashes, free with ph_image_hashes_free
+ *   /return int value - less than 0 if any wanted hash failed
+ **/
+DLL_EXPORT int ph_image_hash_all_mem(const uint8_t *data, size_t len, int mask, ImageHashes &hashes,
+                                     double sigma = 1.0, double gamma = 1.0, int N = 180, float alpha = 2.0f,
+                                     float lvl = 1.0f);
+
+/** /brief free the hashes held by an ImageHashes record
+ **/
+DLL_EXPORT void ph_image_hashes_free(ImageHashes &hashes);
 #endif
+
 /** /brief count number bits set in given byte
  *   /param val - uint8_t byte value
  *   /return int value for number of bits set
@@ -344,6 +776,29 @@ DLL_EXPORT int ph_bitcount8(uint8_t val);
  **/
 DLL_EXPORT double ph_hammingdistance2(uint8_t *hashA, int lenA, uint8_t *hashB, int lenB);
 
+/** /brief count the bits that differ between two byte arrays
+ *  Specialised for the MH (72), radial (40) and BMB (33) lengths.
+ *  /param hashA - byte array for first hash
+ *  /param hashB - byte array for second hash
+ *  /param len - int length of both hashes
+ *  /param max_dist - stop once the distance is known to exceed this, the
+ *                    result is then some value above max_dist (-1 for no limit)
+ *  /return int number of differing bits, -1 for error
+ **/
+DLL_EXPORT int ph_hamming_bytes(const uint8_t *hashA, const uint8_t *hashB, int len, int max_dist = -1);
+
+/** /brief bit distances from one byte array hash to many
+ *  /param query - byte array of len bytes
+ *  /param hashes - count hashes of len bytes, one after another
+ *  /param len - int length of each hash
+ *  /param count - number of hashes
+ *  /param dists - (out) count distances, as from ph_hamming_bytes
+ *  /param max_dist - early exit limit as for ph_hamming_bytes
+ *  /return int count, -1 for error
+ **/
+DLL_EXPORT int ph_hamming_bytes_many(const uint8_t *query, const uint8_t *hashes, int len, int count, int *dists,
+                                     int max_dist = -1);
+
 /** /brief get all the filenames in specified directory
  *  /param dirname - string value for path and filename
  *  /param cap - int value for upper limit to number of files
@@ -353,6 +808,26 @@ DLL_EXPORT double ph_hammingdistance2(uint8_t *hashA, int lenA, uint8_t *hashB,
 
 DLL_EXPORT char **ph_readfilenames(const char *dirname, int &count);
 
+/** /brief start walking a directory tree
+ *  Threads list the directories in parallel and queue the files that pass
+ *  the filters for ph_walk_next; they wait when a few thousand files are
+ *  queued, so a tree of any size is walked in bounded memory. Symbolic
+ *  links are not followed.
+ *  /param dirname - root of the tree
+ *  /param opts - WalkOptions (may be NULL to keep every file)
+ *  /return Walker, release with ph_walk_close (NULL if dirname is not a directory)
+ **/
+DLL_EXPORT Walker *ph_walk_open(const char *dirname, const WalkOptions *opts);
+
+/** /brief next file of the walk, in no particular order
+ *  /return path, valid until the next call (NULL when the walk is done)
+ **/
+DLL_EXPORT const char *ph_walk_next(Walker *walker);
+
+/** /brief stop the walk and release it
+ **/
+DLL_EXPORT void ph_walk_close(Walker *walker);
+
 /** /brief textual hash for file
  *  /param filename - char* name of file
  *  /param nbpoints - int length of array of return value (out)
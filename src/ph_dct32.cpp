@@ -0,0 +1,187 @@
+/*
+
+    pHash, the open source perceptual hash library
+    Copyright (C) 2009 Aetilius, Inc.
+    All rights reserved.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Evan Klinger - eklinger@phash.org
+    D Grant Starkweather - dstarkweather@phash.org
+
+*/
+
+
+#include "ph_dct32.h"
+
+#include <math.h>
+
+#include "ph_simd.h"
+
+#define DCT32_N   32
+#define DCT32_LOW 8
+#define DCT32_PI  3.14159265358979323846
+
+/* rows 1..8 of the 32x32 dct matrix, and the same rows stored transposed so
+ * that the second pass can also run along contiguous memory */
+struct ph_dct32_tables {
+    float rows[DCT32_LOW][DCT32_N];
+    float cols[DCT32_N][DCT32_LOW];
+
+    ph_dct32_tables() {
+        /* C(x, y) = c1 * cos(pi / 2N * y * (2x + 1)), c1 rounded to float first */
+        const float c1 = sqrt(2.0 / DCT32_N);
+        for (int v = 0; v < DCT32_LOW; v++) {
+            for (int k = 0; k < DCT32_N; k++) {
+                rows[v][k] = c1 * cos((DCT32_PI / 2 / DCT32_N) * (v + 1) * (2 * k + 1));
+                cols[k][v] = rows[v][k];
+            }
+        }
+    }
+};
+
+static const ph_dct32_tables &ph_dct32_get_tables() {
+    static const ph_dct32_tables tables;
+    return tables;
+}
+
+static void ph_dct32_lowfreq_scalar(const float *src, float *coeffs) {
+    const ph_dct32_tables &t = ph_dct32_get_tables();
+    float tmp[DCT32_LOW][DCT32_N];
+    for (int v = 0; v < DCT32_LOW; v++) {
+        for (int l = 0; l < DCT32_N; l++) {
+            float sum = 0.0f;
+            for (int k = 0; k < DCT32_N; k++) {
+                sum += t.rows[v][k] * src[k * DCT32_N + l];
+            }
+            tmp[v][l] = sum;
+        }
+    }
+    for (int v = 0; v < DCT32_LOW; v++) {
+        for (int u = 0; u < DCT32_LOW; u++) {
+            float sum = 0.0f;
+            for (int l = 0; l < DCT32_N; l++) {
+                sum += tmp[v][l] * t.cols[l][u];
+            }
+            coeffs[v * DCT32_LOW + u] = sum;
+        }
+    }
+}
+
+#ifdef PH_SIMD_SSE2
+static void ph_dct32_lowfreq_sse2(const float *src, float *coeffs) {
+    const ph_dct32_tables &t = ph_dct32_get_tables();
+    float tmp[DCT32_LOW][DCT32_N];
+    for (int v = 0; v < DCT32_LOW; v++) {
+        __m128 acc[8];
+        for (int j = 0; j < 8; j++) {
+            acc[j] = _mm_setzero_ps();
+        }
+        for (int k = 0; k < DCT32_N; k++) {
+            const __m128 c = _mm_set1_ps(t.rows[v][k]);
+            const float *row = src + k * DCT32_N;
+            for (int j = 0; j < 8; j++) {
+                acc[j] = _mm_add_ps(acc[j], _mm_mul_ps(c, _mm_loadu_ps(row + 4 * j)));
+            }
+        }
+        for (int j = 0; j < 8; j++) {
+            _mm_storeu_ps(&tmp[v][4 * j], acc[j]);
+        }
+    }
+    for (int v = 0; v < DCT32_LOW; v++) {
+        __m128 lo = _mm_setzero_ps();
+        __m128 hi = _mm_setzero_ps();
+        for (int l = 0; l < DCT32_N; l++) {
+            const __m128 x = _mm_set1_ps(tmp[v][l]);
+            lo = _mm_add_ps(lo, _mm_mul_ps(x, _mm_loadu_ps(&t.cols[l][0])));
+            hi = _mm_add_ps(hi, _mm_mul_ps(x, _mm_loadu_ps(&t.cols[l][4])));
+        }
+        _mm_storeu_ps(coeffs + v * DCT32_LOW, lo);
+        _mm_storeu_ps(coeffs + v * DCT32_LOW + 4, hi);
+    }
+}
+#endif
+
+#ifdef PH_SIMD_AVX2
+PH_TARGET_AVX2 static void ph_dct32_lowfreq_avx2(const float *src, float *coeffs) {
+    const ph_dct32_tables &t = ph_dct32_get_tables();
+    float tmp[DCT32_LOW][DCT32_N];
+    for (int v = 0; v < DCT32_LOW; v++) {
+        __m256 acc0 = _mm256_setzero_ps();
+        __m256 acc1 = _mm256_setzero_ps();
+        __m256 acc2 = _mm256_setzero_ps();
+        __m256 acc3 = _mm256_setzero_ps();
+        for (int k = 0; k < DCT32_N; k++) {
+            const __m256 c = _mm256_set1_ps(t.rows[v][k]);
+            const float *row = src + k * DCT32_N;
+            acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(c, _mm256_loadu_ps(row)));
+            acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(c, _mm256_loadu_ps(row + 8)));
+            acc2 = _mm256_add_ps(acc2, _mm256_mul_ps(c, _mm256_loadu_ps(row + 16)));
+            acc3 = _mm256_add_ps(acc3, _mm256_mul_ps(c, _mm256_loadu_ps(row + 24)));
+        }
+        _mm256_storeu_ps(&tmp[v][0], acc0);
+        _mm256_storeu_ps(&tmp[v][8], acc1);
+        _mm256_storeu_ps(&tmp[v][16], acc2);
+        _mm256_storeu_ps(&tmp[v][24], acc3);
+    }
+    for (int v = 0; v < DCT32_LOW; v++) {
+        __m256 acc = _mm256_setzero_ps();
+        for (int l = 0; l < DCT32_N; l++) {
+            acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(tmp[v][l]), _mm256_loadu_ps(&t.cols[l][0])));
+        }
+        _mm256_storeu_ps(coeffs + v * DCT32_LOW, acc);
+    }
+}
+#endif
+
+typedef void (*ph_dct32_func)(const float *, float *);
+
+static ph_dct32_func ph_dct32_select() {
+#ifdef PH_SIMD_AVX2
+    if (ph_cpu_has_avx2())
+        return ph_dct32_lowfreq_avx2;
+#endif
+#ifdef PH_SIMD_SSE2
+    return ph_dct32_lowfreq_sse2;
+#else
+    return ph_dct32_lowfreq_scalar;
+#endif
+}
+
+void ph_dct32_lowfreq(const float *src, float *coeffs) {
+    static const ph_dct32_func func = ph_dct32_select();
+    func(src, coeffs);
+}
+
+int ph_dct32_lowfreq_path(DCT32Path path, const float *src, float *coeffs) {
+    switch (path) {
+        case PH_DCT32_SCALAR:
+            ph_dct32_lowfreq_scalar(src, coeffs);
+            return 0;
+#ifdef PH_SIMD_SSE2
+        case PH_DCT32_SSE2:
+            ph_dct32_lowfreq_sse2(src, coeffs);
+            return 0;
+#endif
+#ifdef PH_SIMD_AVX2
+        case PH_DCT32_AVX2:
+            if (!ph_cpu_has_avx2())
+                return -1;
+            ph_dct32_lowfreq_avx2(src, coeffs);
+            return 0;
+#endif
+        default:
+            return -1;
+    }
+}
@@ -0,0 +1,55 @@
+/*
+
+    pHash, the open source perceptual hash library
+    Copyright (C) 2009 Aetilius, Inc.
+    All rights reserved.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Evan Klinger - eklinger@phash.org
+    D Grant Starkweather - dstarkweather@phash.org
+
+*/
+
+
+#ifndef _PH_DCT32_H
+#define _PH_DCT32_H
+
+#include "pHash.h"
+
+/* /brief low frequency block of the 32x32 dct
+ *  Computes the coefficients (1..8, 1..8) of C * src * C^T, where C is the
+ *  32x32 dct-II matrix, i.e. the block the dct image and video hashes use.
+ *  The transform is separable: only the 8 needed rows of C are applied to the
+ *  columns, then to the rows of the 8x32 intermediate. AVX2 or SSE2 is chosen
+ *  at runtime, all paths accumulate in the same order and agree bit for bit.
+ *  /param src    - 32x32 float image, row major
+ *  /param coeffs - (out) 64 floats, row (vertical frequency) major
+ */
+void ph_dct32_lowfreq(const float *src, float *coeffs);
+
+/* implementations of ph_dct32_lowfreq */
+typedef enum ph_dct32_path {
+    PH_DCT32_SCALAR = 0,
+    PH_DCT32_SSE2 = 1,
+    PH_DCT32_AVX2 = 2,
+} DCT32Path;
+
+/* /brief ph_dct32_lowfreq on the given path, to check the paths against
+ *  each other (see examples/test_image_paths.cpp)
+ *  /return 0, -1 if the path is not built in or the cpu lacks it
+ */
+DLL_EXPORT int ph_dct32_lowfreq_path(DCT32Path path, const float *src, float *coeffs);
+
+#endif /* _PH_DCT32_H */
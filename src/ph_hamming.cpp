@@ -0,0 +1,390 @@
+/*
+
+    pHash, the open source perceptual hash library
+    Copyright (C) 2009 Aetilius, Inc.
+    All rights reserved.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Evan Klinger - eklinger@phash.org
+    D Grant Starkweather - dstarkweather@phash.org
+
+*/
+
+
+#include "pHash.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "ph_pool.h"
+#include "ph_simd.h"
+
+#define SCAN_BLOCK 64              /* hashes per match mask */
+#define SCAN_PREFETCH 512          /* hashes (4KB) to prefetch ahead */
+#define SCAN_MIN_PER_THREAD (1 << 20) /* below 8MB per thread, threads cost more than they save */
+
+/* bit i of the result is set when popcount(query ^ db[i]) <= max_dist, for
+ * the SCAN_BLOCK hashes at db */
+typedef uint64_t (*ph_scan_func)(ulong64 query, const ulong64 *db, int max_dist);
+
+static uint64_t ph_scan_mask_scalar(ulong64 query, const ulong64 *db, int count, int max_dist) {
+    uint64_t mask = 0;
+    for (int i = 0; i < count; i++) {
+        if (ph_popcount64(query ^ db[i]) <= max_dist)
+            mask |= (uint64_t)1 << i;
+    }
+    return mask;
+}
+
+static uint64_t ph_scan_block_scalar(ulong64 query, const ulong64 *db, int max_dist) {
+    return ph_scan_mask_scalar(query, db, SCAN_BLOCK, max_dist);
+}
+
+#ifdef PH_SIMD_AVX2
+/* per 64-bit lane popcount: nibble lookup with pshufb, then sum the bytes */
+PH_TARGET_AVX2 static inline __m256i ph_popcnt_epi64_avx2(__m256i v) {
+    const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i lo = _mm256_and_si256(v, nibble);
+    const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+    const __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lut, lo), _mm256_shuffle_epi8(lut, hi));
+    return _mm256_sad_epu8(cnt, _mm256_setzero_si256());
+}
+
+PH_TARGET_AVX2 static uint64_t ph_scan_block_avx2(ulong64 query, const ulong64 *db, int max_dist) {
+    const __m256i q = _mm256_set1_epi64x((long long)query);
+    const __m256i lim = _mm256_set1_epi64x(max_dist);
+    uint64_t mask = 0;
+    for (int i = 0; i < SCAN_BLOCK; i += 4) {
+        const __m256i v = _mm256_loadu_si256((const __m256i *)(db + i));
+        const __m256i d = ph_popcnt_epi64_avx2(_mm256_xor_si256(v, q));
+        const int far = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(d, lim)));
+        mask |= (uint64_t)(~far & 0xf) << i;
+    }
+    return mask;
+}
+#endif
+
+#ifdef PH_SIMD_AVX512_POPCNT
+PH_TARGET_AVX512_POPCNT static uint64_t ph_scan_block_avx512(ulong64 query, const ulong64 *db, int max_dist) {
+    const __m512i q = _mm512_set1_epi64((long long)query);
+    const __m512i lim = _mm512_set1_epi64(max_dist);
+    uint64_t mask = 0;
+    for (int i = 0; i < SCAN_BLOCK; i += 8) {
+        const __m512i v = _mm512_loadu_si512((const void *)(db + i));
+        const __m512i d = _mm512_popcnt_epi64(_mm512_xor_si512(v, q));
+        mask |= (uint64_t)_mm512_cmple_epu64_mask(d, lim) << i;
+    }
+    return mask;
+}
+#endif
+
+static ph_scan_func ph_scan_select() {
+#ifdef PH_SIMD_AVX512_POPCNT
+    if (ph_cpu_has_avx512_popcnt())
+        return ph_scan_block_avx512;
+#endif
+#ifdef PH_SIMD_AVX2
+    if (ph_cpu_has_avx2())
+        return ph_scan_block_avx2;
+#endif
+    return ph_scan_block_scalar;
+}
+
+static inline void ph_scan_prefetch(const ulong64 *db, size_t i, size_t end) {
+#ifdef PH_SIMD_SSE2
+    if (i + SCAN_PREFETCH + SCAN_BLOCK <= end) {
+        const char *p = (const char *)(db + i + SCAN_PREFETCH);
+        for (int line = 0; line < SCAN_BLOCK * 8; line += 64)
+            _mm_prefetch(p + line, _MM_HINT_T0);
+    }
+#else
+    (void)db;
+    (void)i;
+    (void)end;
+#endif
+}
+
+/* match mask of the hashes db[i..i+count), count <= SCAN_BLOCK */
+static inline uint64_t ph_scan_mask(ph_scan_func scan, ulong64 query, const ulong64 *db, size_t i, size_t end,
+                                    int max_dist) {
+    if (end - i >= SCAN_BLOCK) {
+        ph_scan_prefetch(db, i, end);
+        return scan(query, db + i, max_dist);
+    }
+    return ph_scan_mask_scalar(query, db + i, (int)(end - i), max_dist);
+}
+
+static void ph_scan_range(ph_scan_func scan, ulong64 query, const ulong64 *db, size_t begin, size_t end,
+                          int max_dist, std::vector<size_t> *ids) {
+    for (size_t i = begin; i < end; i += SCAN_BLOCK) {
+        uint64_t mask = ph_scan_mask(scan, query, db, i, end, max_dist);
+        while (mask) {
+            const int bit = ph_popcount64((mask & (0 - mask)) - 1);
+            ids->push_back(i + bit);
+            mask &= mask - 1;
+        }
+    }
+}
+
+typedef std::pair<int, size_t> ph_scan_hit; /* distance, index */
+
+/* k nearest of db[begin..end) in hits, a max-heap on (distance, index) */
+static void ph_topk_range(ph_scan_func scan, ulong64 query, const ulong64 *db, size_t begin, size_t end,
+                          size_t k, std::vector<ph_scan_hit> *hits) {
+    hits->reserve(k + 1);
+    for (size_t i = begin; i < end; i += SCAN_BLOCK) {
+        /* indexes grow, so only a strictly smaller distance displaces the top */
+        int limit = 64;
+        if (hits->size() == k) {
+            limit = hits->front().first - 1;
+            if (limit < 0)
+                break;
+        }
+        uint64_t mask = ph_scan_mask(scan, query, db, i, end, limit);
+        while (mask) {
+            const int bit = ph_popcount64((mask & (0 - mask)) - 1);
+            const int d = ph_popcount64(query ^ db[i + bit]);
+            mask &= mask - 1;
+            if (hits->size() == k) {
+                if (d >= hits->front().first)
+                    continue;
+                std::pop_heap(hits->begin(), hits->end());
+                hits->pop_back();
+            }
+            hits->push_back(ph_scan_hit(d, i + bit));
+            std::push_heap(hits->begin(), hits->end());
+        }
+    }
+}
+
+/* threads to use for n hashes, same convention as ph_dct_image_hashes */
+static int ph_scan_threads(size_t n, int threads) {
+    int num_threads = threads < 0 ? 0 : threads;
+    int max_threads_num = std::thread::hardware_concurrency();
+    if (max_threads_num < 1)
+        max_threads_num = 1;
+    if (num_threads == 0 || num_threads > max_threads_num)
+        num_threads = max_threads_num;
+    size_t most = n / SCAN_MIN_PER_THREAD;
+    if (most < 1)
+        most = 1;
+    if ((size_t)num_threads > most)
+        num_threads = (int)most;
+    return num_threads;
+}
+
+/* start of slice t of num_threads, kept on a SCAN_BLOCK boundary */
+static size_t ph_scan_slice(size_t n, int t, int num_threads) {
+    if (t >= num_threads)
+        return n;
+    return (n / SCAN_BLOCK) * t / num_threads * SCAN_BLOCK;
+}
+
+long long ph_hamming_scan(ulong64 query, const ulong64 *db, size_t n, int max_dist, size_t *out_ids,
+                          int *out_dists, size_t capacity, int threads) {
+    if (!db && n > 0)
+        return -1;
+    if (max_dist < 0 || n == 0)
+        return 0;
+    if (capacity == (size_t)-1)
+        capacity = n;
+    if (!out_ids)
+        capacity = 0;
+
+    static const ph_scan_func scan = ph_scan_select();
+    const int num_threads = ph_scan_threads(n, threads);
+    std::vector<std::vector<size_t> > ids(num_threads);
+    ph_parallel_for(num_threads, num_threads, [&](int t) {
+        ph_scan_range(scan, query, db, ph_scan_slice(n, t, num_threads), ph_scan_slice(n, t + 1, num_threads),
+                      max_dist, &ids[t]);
+    });
+
+    size_t total = 0;
+    for (int t = 0; t < num_threads; t++) {
+        for (size_t j = 0; j < ids[t].size(); j++, total++) {
+            if (total >= capacity)
+                continue;
+            out_ids[total] = ids[t][j];
+            if (out_dists)
+                out_dists[total] = ph_popcount64(query ^ db[ids[t][j]]);
+        }
+    }
+    return (long long)total;
+}
+
+int ph_hamming_topk(ulong64 query, const ulong64 *db, size_t n, int k, size_t *out_ids, int *out_dists,
+                    int threads) {
+    if ((!db && n > 0) || (!out_ids && k > 0))
+        return -1;
+    if (k <= 0 || n == 0)
+        return 0;
+
+    static const ph_scan_func scan = ph_scan_select();
+    const size_t kk = std::min((size_t)k, n);
+    const int num_threads = ph_scan_threads(n, threads);
+    std::vector<std::vector<ph_scan_hit> > hits(num_threads);
+    ph_parallel_for(num_threads, num_threads, [&](int t) {
+        ph_topk_range(scan, query, db, ph_scan_slice(n, t, num_threads), ph_scan_slice(n, t + 1, num_threads), kk,
+                      &hits[t]);
+    });
+
+    std::vector<ph_scan_hit> all;
+    for (int t = 0; t < num_threads; t++) {
+        all.insert(all.end(), hits[t].begin(), hits[t].end());
+    }
+    std::sort(all.begin(), all.end());
+    const int count = (int)std::min(kk, all.size());
+    for (int i = 0; i < count; i++) {
+        out_ids[i] = all[i].second;
+        if (out_dists)
+            out_dists[i] = all[i].first;
+    }
+    return count;
+}
+
+/* byte array hashes (MH 72, BMB 33, radial 40 bytes): 64-bit words first,
+ * then the tail bytes; LEN 0 takes the length at run time */
+typedef int (*ph_hamming_bytes_func)(const uint8_t *a, const uint8_t *b, int len, int max_dist);
+
+#define HAMMING_EXIT_WORDS 4 /* compare to max_dist every 32 bytes */
+
+template <int LEN>
+static inline int ph_hamming_bytes_impl(const uint8_t *a, const uint8_t *b, int len, int max_dist) {
+    const int n = LEN ? LEN : len;
+    const int words = n / 8;
+    int dist = 0;
+    int w = 0;
+    while (w < words) {
+        const int stop = std::min(words, w + HAMMING_EXIT_WORDS);
+        for (; w < stop; w++) {
+            ulong64 x, y;
+            memcpy(&x, a + 8 * w, 8);
+            memcpy(&y, b + 8 * w, 8);
+            dist += ph_popcount64(x ^ y);
+        }
+        if (dist > max_dist)
+            return dist;
+    }
+    ulong64 x = 0;
+    for (int i = 8 * words; i < n; i++) {
+        x = (x << 8) | (uint8_t)(a[i] ^ b[i]);
+    }
+    return dist + ph_popcount64(x);
+}
+
+template <int LEN>
+static int ph_hamming_bytes_scalar(const uint8_t *a, const uint8_t *b, int len, int max_dist) {
+    return ph_hamming_bytes_impl<LEN>(a, b, len, max_dist);
+}
+
+#ifdef PH_SIMD_POPCNT
+/* the same code, with __builtin_popcountll as the popcnt instruction */
+template <int LEN>
+PH_TARGET_POPCNT static int ph_hamming_bytes_popcnt(const uint8_t *a, const uint8_t *b, int len, int max_dist) {
+    return ph_hamming_bytes_impl<LEN>(a, b, len, max_dist);
+}
+#endif
+
+#ifdef PH_SIMD_AVX512_POPCNT
+/* sum of the eight 64-bit lanes, two 256-bit halves folded down to one; the
+ * zero masking forms of the extract, as the plain ones (and the casts built
+ * on them) read an undefined vector that gcc 12 warns about */
+PH_TARGET_AVX512_POPCNT static inline int ph_sum_epi64_avx512(__m512i v) {
+    const __m256i s = _mm256_add_epi64(_mm512_maskz_extracti64x4_epi64(0xf, v, 0),
+                                       _mm512_maskz_extracti64x4_epi64(0xf, v, 1));
+    const __m128i t = _mm_add_epi64(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1));
+    return (int)(_mm_cvtsi128_si64(t) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(t, t)));
+}
+
+/* 64 bytes per VPOPCNTQ, the last partial block through a masked load; the
+ * counts add up in a vector and are summed when max_dist is checked */
+template <int LEN>
+PH_TARGET_AVX512_POPCNT static int ph_hamming_bytes_avx512(const uint8_t *a, const uint8_t *b, int len, int max_dist) {
+    const int n = LEN ? LEN : len;
+    const int words = n / 8;
+    __m512i acc = _mm512_setzero_si512();
+    int w = 0;
+    for (; w + 8 <= words; w += 8) {
+        const __m512i x = _mm512_xor_si512(_mm512_loadu_si512((const void *)(a + 8 * w)),
+                                           _mm512_loadu_si512((const void *)(b + 8 * w)));
+        acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(x));
+        if (w + 8 < words) {
+            const int dist = ph_sum_epi64_avx512(acc);
+            if (dist > max_dist)
+                return dist;
+        }
+    }
+    if (w < words) {
+        const __mmask8 m = (__mmask8)((1u << (words - w)) - 1);
+        const __m512i x = _mm512_xor_si512(_mm512_maskz_loadu_epi64(m, (const void *)(a + 8 * w)),
+                                           _mm512_maskz_loadu_epi64(m, (const void *)(b + 8 * w)));
+        acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(x));
+    }
+    ulong64 x = 0;
+    for (int i = 8 * words; i < n; i++) {
+        x = (x << 8) | (uint8_t)(a[i] ^ b[i]);
+    }
+    return ph_sum_epi64_avx512(acc) + ph_popcount64(x);
+}
+#endif
+
+#define HAMMING_BYTES_PICK(kernel, len)                         \
+    ((len) == 72 ? &kernel<72> : (len) == 40 ? &kernel<40> :   \
+     (len) == 33 ? &kernel<33> : &kernel<0>)
+
+static ph_hamming_bytes_func ph_hamming_bytes_select(int len) {
+#ifdef PH_SIMD_AVX512_POPCNT
+    if (ph_cpu_has_avx512_popcnt())
+        return HAMMING_BYTES_PICK(ph_hamming_bytes_avx512, len);
+#endif
+#ifdef PH_SIMD_POPCNT
+    if (ph_cpu_has_popcnt())
+        return HAMMING_BYTES_PICK(ph_hamming_bytes_popcnt, len);
+#endif
+    return HAMMING_BYTES_PICK(ph_hamming_bytes_scalar, len);
+}
+
+int ph_hamming_bytes(const uint8_t *hashA, const uint8_t *hashB, int len, int max_dist) {
+    if (!hashA || !hashB || len <= 0)
+        return -1;
+    if (max_dist < 0)
+        max_dist = INT_MAX;
+    return ph_hamming_bytes_select(len)(hashA, hashB, len, max_dist);
+}
+
+int ph_hamming_bytes_many(const uint8_t *query, const uint8_t *hashes, int len, int count, int *dists,
+                          int max_dist) {
+    if (!query || !hashes || !dists || len <= 0 || count < 0)
+        return -1;
+    if (max_dist < 0)
+        max_dist = INT_MAX;
+    const ph_hamming_bytes_func dist = ph_hamming_bytes_select(len);
+    for (int i = 0; i < count; i++) {
+        const uint8_t *h = hashes + (size_t)i * len;
+#ifdef PH_SIMD_SSE2
+        _mm_prefetch((const char *)(h + 8 * len), _MM_HINT_T0);
+#endif
+        dists[i] = dist(query, h, len, max_dist);
+    }
+    return count;
+}
@@ -0,0 +1,692 @@
+/*
+
+    pHash, the open source perceptual hash library
+    Copyright (C) 2009 Aetilius, Inc.
+    All rights reserved.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Evan Klinger - eklinger@phash.org
+    D Grant Starkweather - dstarkweather@phash.org
+
+*/
+
+
+#include "ph_imageio.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_SYS_MMAN_H
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_LIBJPEG
+#include <setjmp.h>
+#include <jpeglib.h>
+#if JPEG_LIB_VERSION < 80 && !defined(MEM_SRCDST_SUPPORTED)
+#undef HAVE_LIBJPEG /* no jpeg_mem_src, leave jpeg to CImg */
+#endif
+#endif
+
+#ifdef HAVE_LIBPNG
+#include <png.h>
+#endif
+
+#ifdef HAVE_LIBTIFF
+#include <tiffio.h>
+#endif
+
+typedef enum ph_image_format {
+    PH_FORMAT_UNKNOWN = 0,
+    PH_FORMAT_BMP,
+    PH_FORMAT_PNM,
+    PH_FORMAT_JPEG,
+    PH_FORMAT_PNG,
+    PH_FORMAT_TIFF,
+    PH_FORMAT_GIF,
+} ImageFormat;
+
+static ImageFormat ph_sniff_format(const uint8_t *data, size_t len) {
+    if (len >= 2 && data[0] == 'B' && data[1] == 'M')
+        return PH_FORMAT_BMP;
+    if (len >= 2 && data[0] == 'P' && data[1] >= '1' && data[1] <= '6')
+        return PH_FORMAT_PNM;
+    if (len >= 3 && data[0] == 0xff && data[1] == 0xd8 && data[2] == 0xff)
+        return PH_FORMAT_JPEG;
+    if (len >= 8 && !memcmp(data, "\x89PNG\r\n\x1a\n", 8))
+        return PH_FORMAT_PNG;
+    if (len >= 4 && (!memcmp(data, "II*\0", 4) || !memcmp(data, "MM\0*", 4)))
+        return PH_FORMAT_TIFF;
+    if (len >= 6 && (!memcmp(data, "GIF87a", 6) || !memcmp(data, "GIF89a", 6)))
+        return PH_FORMAT_GIF;
+    return PH_FORMAT_UNKNOWN;
+}
+
+/* formats CImg decodes from a FILE* without external tools */
+static int ph_format_in_memory(ImageFormat format) {
+#ifndef HAVE_FMEMOPEN
+    return 0;
+#else
+    switch (format) {
+        case PH_FORMAT_BMP:
+        case PH_FORMAT_PNM:
+            return 1;
+#ifdef cimg_use_jpeg
+        case PH_FORMAT_JPEG:
+            return 1;
+#endif
+#ifdef cimg_use_png
+        case PH_FORMAT_PNG:
+            return 1;
+#endif
+        default:
+            return 0;
+    }
+#endif
+}
+
+static const char *ph_format_extension(ImageFormat format) {
+    switch (format) {
+        case PH_FORMAT_BMP:
+            return "bmp";
+        case PH_FORMAT_PNM:
+            return "pnm";
+        case PH_FORMAT_JPEG:
+            return "jpg";
+        case PH_FORMAT_PNG:
+            return "png";
+        case PH_FORMAT_TIFF:
+            return "tif";
+        case PH_FORMAT_GIF:
+            return "gif";
+        default:
+            return "img";
+    }
+}
+
+/* the 7x7 box filter runs at source resolution, below 256 pixels it averages
+ * a visibly larger part of the image and the hash drifts */
+const DecodeOptions ph_decode_dct = {1, 256, 256};
+
+/* the hash works on a 512x512 resize. Color is kept: the gray and color paths
+ * of _ph_mh_imagehash blur with different precision and MH is sensitive to it */
+const DecodeOptions ph_decode_mh = {0, 512, 512};
+
+/* the hash works on a 256x256 resize */
+const DecodeOptions ph_decode_bmb = {1, 256, 256};
+
+/* radon projections cost grows with the image size, a 512 pixel wide decode
+ * keeps the digest within 0.01 of the full size one */
+const DecodeOptions ph_decode_radial = {1, 512, 512};
+
+void ph_decode_options_merge(int mask, DecodeOptions &opts) {
+    const struct {
+        int bit;
+        const DecodeOptions *opts;
+    } needs[] = {
+        {PH_HASH_DCT, &ph_decode_dct},
+        {PH_HASH_MH, &ph_decode_mh},
+        {PH_HASH_BMB, &ph_decode_bmb},
+        {PH_HASH_RADIAL, &ph_decode_radial},
+    };
+
+    opts.gray = 1;
+    opts.min_width = 0;
+    opts.min_height = 0;
+    for (size_t i = 0; i < sizeof(needs) / sizeof(needs[0]); i++) {
+        if (!(mask & needs[i].bit))
+            continue;
+        opts.gray &= needs[i].opts->gray;
+        if (needs[i].opts->min_width > opts.min_width)
+            opts.min_width = needs[i].opts->min_width;
+        if (needs[i].opts->min_height > opts.min_height)
+            opts.min_height = needs[i].opts->min_height;
+    }
+}
+
+/* formats decoded by the libjpeg/libpng/libtiff decoders below */
+static int ph_format_native(ImageFormat format) {
+    switch (format) {
+#ifdef HAVE_LIBJPEG
+        case PH_FORMAT_JPEG:
+            return 1;
+#endif
+#ifdef HAVE_LIBPNG
+        case PH_FORMAT_PNG:
+            return 1;
+#endif
+#ifdef HAVE_LIBTIFF
+        case PH_FORMAT_TIFF:
+            return 1;
+#endif
+        default:
+            return 0;
+    }
+}
+
+/* the same integer luma as CImg's RGBtoYCbCr() */
+static inline uint8_t ph_rgb_luma(int r, int g, int b) {
+    return (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+/* scatter interleaved rows into the planar layout of img */
+static void ph_deinterleave_row(const uint8_t *row, int y, CImg<uint8_t> &img) {
+    const int channels = img.spectrum();
+    for (int c = 0; c < channels; c++) {
+        uint8_t *dst = img.data(0, y, 0, c);
+        const uint8_t *src = row + c;
+        for (int x = 0; x < img.width(); x++, src += channels)
+            dst[x] = *src;
+    }
+}
+
+#ifdef HAVE_LIBJPEG
+typedef struct ph_jpeg_error {
+    struct jpeg_error_mgr mgr;
+    jmp_buf jump;
+} JpegError;
+
+static void ph_jpeg_error_exit(j_common_ptr cinfo) {
+    longjmp(((JpegError *)cinfo->err)->jump, 1);
+}
+
+static void ph_jpeg_output_message(j_common_ptr /* cinfo */) {}
+
+/* largest power of 2 reduction (libjpeg scales by 1/1, 1/2, 1/4 and 1/8 in
+ * the dct domain) that keeps the image at least min_width x min_height */
+static int ph_jpeg_scale_denom(int width, int height, const DecodeOptions *opts) {
+    int denom = 1;
+    if (!opts || opts->min_width <= 0 || opts->min_height <= 0)
+        return denom;
+    while (denom < 8) {
+        const int next = 2 * denom;
+        if ((width + next - 1) / next < opts->min_width || (height + next - 1) / next < opts->min_height)
+            break;
+        denom = next;
+    }
+    return denom;
+}
+
+static int ph_decode_jpeg(const uint8_t *data, size_t len, const DecodeOptions *opts, CImg<uint8_t> &img) {
+    struct jpeg_decompress_struct cinfo;
+    JpegError jerr;
+    uint8_t *volatile row = NULL;
+
+    cinfo.err = jpeg_std_error(&jerr.mgr);
+    jerr.mgr.error_exit = ph_jpeg_error_exit;
+    jerr.mgr.output_message = ph_jpeg_output_message;
+    if (setjmp(jerr.jump)) {
+        jpeg_destroy_decompress(&cinfo);
+        free(row);
+        img.assign();
+        return -1;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, (unsigned char *)data, (unsigned long)len);
+    jpeg_read_header(&cinfo, TRUE);
+
+    switch (cinfo.jpeg_color_space) {
+        case JCS_GRAYSCALE:
+            cinfo.out_color_space = JCS_GRAYSCALE;
+            break;
+        case JCS_YCbCr:
+        case JCS_RGB:
+            /* the Y plane of a YCbCr jpeg is the luma, no color conversion */
+            cinfo.out_color_space = (opts && opts->gray) ? JCS_GRAYSCALE : JCS_RGB;
+            break;
+        default:
+            /* cmyk and ycck are left to CImg */
+            jpeg_destroy_decompress(&cinfo);
+            return 0;
+    }
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = ph_jpeg_scale_denom(cinfo.image_width, cinfo.image_height, opts);
+
+    jpeg_start_decompress(&cinfo);
+    const int width = cinfo.output_width;
+    const int height = cinfo.output_height;
+    const int channels = cinfo.output_components;
+    img.assign(width, height, 1, channels);
+
+    if (channels > 1)
+        row = (uint8_t *)malloc(width * channels);
+    while (cinfo.output_scanline < cinfo.output_height) {
+        const int y = cinfo.output_scanline;
+        JSAMPROW dst = (channels > 1) ? (JSAMPROW)row : (JSAMPROW)img.data(0, y, 0, 0);
+        if (!dst)
+            longjmp(jerr.jump, 1);
+        jpeg_read_scanlines(&cinfo, &dst, 1);
+        if (channels > 1)
+            ph_deinterleave_row(row, y, img);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    free(row);
+    return 1;
+}
+#endif
+
+#ifdef HAVE_LIBPNG
+typedef struct ph_png_reader {
+    const uint8_t *data;
+    size_t len;
+    size_t pos;
+} PngReader;
+
+static void ph_png_read(png_structp png, png_bytep out, png_size_t n) {
+    PngReader *reader = (PngReader *)png_get_io_ptr(png);
+    if (n > reader->len - reader->pos)
+        png_error(png, "truncated png");
+    memcpy(out, reader->data + reader->pos, n);
+    reader->pos += n;
+}
+
+static void ph_png_error(png_structp png, png_const_charp /* msg */) {
+    longjmp(png_jmpbuf(png), 1);
+}
+
+static void ph_png_warning(png_structp /* png */, png_const_charp /* msg */) {}
+
+static int ph_decode_png(const uint8_t *data, size_t len, const DecodeOptions * /* opts */, CImg<uint8_t> &img) {
+    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, ph_png_error, ph_png_warning);
+    if (!png)
+        return -1;
+    png_infop info = png_create_info_struct(png);
+    uint8_t *volatile pixels = NULL;
+    png_bytep *volatile rows = NULL;
+    if (!info || setjmp(png_jmpbuf(png))) {
+        png_destroy_read_struct(&png, info ? &info : NULL, NULL);
+        free(pixels);
+        free(rows);
+        img.assign();
+        return -1;
+    }
+
+    PngReader reader = {data, len, 0};
+    png_set_read_fn(png, &reader, ph_png_read);
+    png_read_info(png, info);
+
+    png_set_expand(png);
+    png_set_strip_16(png);
+    png_set_strip_alpha(png); /* the hashes never look at alpha */
+    /* color stays color even when opts->gray: libpng's luma weights are not
+     * the ones of CImg, and a png has no cheaper gray decode to gain */
+    png_set_interlace_handling(png);
+    png_read_update_info(png, info);
+
+    const int width = png_get_image_width(png, info);
+    const int height = png_get_image_height(png, info);
+    const int channels = png_get_channels(png, info);
+    img.assign(width, height, 1, channels);
+
+    /* single channel output is read straight into the image */
+    uint8_t *dst = img.data();
+    if (channels > 1) {
+        pixels = (uint8_t *)malloc((size_t)width * height * channels);
+        dst = pixels;
+    }
+    rows = (png_bytep *)malloc(height * sizeof(png_bytep));
+    if (!dst || !rows)
+        png_error(png, "out of memory");
+    for (int y = 0; y < height; y++)
+        rows[y] = dst + (size_t)y * width * channels;
+    png_read_image(png, rows);
+    png_read_end(png, NULL);
+
+    if (channels > 1) {
+        for (int y = 0; y < height; y++)
+            ph_deinterleave_row(rows[y], y, img);
+    }
+    png_destroy_read_struct(&png, &info, NULL);
+    free(pixels);
+    free(rows);
+    return 1;
+}
+#endif
+
+#ifdef HAVE_LIBTIFF
+typedef struct ph_tiff_reader {
+    const uint8_t *data;
+    toff_t len;
+    toff_t pos;
+} TiffReader;
+
+static tmsize_t ph_tiff_read(thandle_t handle, void *buf, tmsize_t size) {
+    TiffReader *reader = (TiffReader *)handle;
+    if (size < 0 || reader->pos > reader->len)
+        return 0;
+    if ((toff_t)size > reader->len - reader->pos)
+        size = (tmsize_t)(reader->len - reader->pos);
+    memcpy(buf, reader->data + reader->pos, size);
+    reader->pos += size;
+    return size;
+}
+
+static tmsize_t ph_tiff_write(thandle_t handle, void *buf, tmsize_t size) { return 0; }
+
+static toff_t ph_tiff_seek(thandle_t handle, toff_t off, int whence) {
+    TiffReader *reader = (TiffReader *)handle;
+    switch (whence) {
+        case SEEK_SET:
+            reader->pos = off;
+            break;
+        case SEEK_CUR:
+            reader->pos += off;
+            break;
+        case SEEK_END:
+            reader->pos = reader->len + off;
+            break;
+    }
+    return reader->pos;
+}
+
+static int ph_tiff_close(thandle_t handle) { return 0; }
+
+static toff_t ph_tiff_size(thandle_t handle) { return ((TiffReader *)handle)->len; }
+
+static int ph_tiff_map(thandle_t handle, void **base, toff_t *size) {
+    TiffReader *reader = (TiffReader *)handle;
+    *base = (void *)reader->data;
+    *size = reader->len;
+    return 1;
+}
+
+static void ph_tiff_unmap(thandle_t handle, void *base, toff_t size) {}
+
+static int ph_decode_tiff(const uint8_t *data, size_t len, const DecodeOptions *opts, CImg<uint8_t> &img) {
+    TiffReader reader = {data, (toff_t)len, 0};
+    TIFF *tif = TIFFClientOpen("memory", "rm", (thandle_t)&reader, ph_tiff_read, ph_tiff_write, ph_tiff_seek,
+                               ph_tiff_close, ph_tiff_size, ph_tiff_map, ph_tiff_unmap);
+    if (!tif)
+        return -1;
+
+    uint32_t width = 0, height = 0;
+    uint16_t spp = 1;
+    TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &width);
+    TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &height);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &spp);
+
+    int res = -1;
+    uint32_t *raster = NULL;
+    if (width > 0 && height > 0)
+        raster = (uint32_t *)_TIFFmalloc((tmsize_t)width * height * sizeof(uint32_t));
+    if (raster && TIFFReadRGBAImageOriented(tif, width, height, raster, ORIENTATION_TOPLEFT, 0)) {
+        const int gray = spp < 3 || (opts && opts->gray);
+        img.assign(width, height, 1, gray ? 1 : 3);
+        const uint32_t *p = raster;
+        for (uint32_t y = 0; y < height; y++) {
+            for (uint32_t x = 0; x < width; x++, p++) {
+                const int r = TIFFGetR(*p), g = TIFFGetG(*p), b = TIFFGetB(*p);
+                if (spp < 3) {
+                    img(x, y) = (uint8_t)r;
+                } else if (gray) {
+                    img(x, y) = ph_rgb_luma(r, g, b);
+                } else {
+                    img(x, y, 0, 0) = (uint8_t)r;
+                    img(x, y, 0, 1) = (uint8_t)g;
+                    img(x, y, 0, 2) = (uint8_t)b;
+                }
+            }
+        }
+        res = 1;
+    }
+    _TIFFfree(raster);
+    TIFFClose(tif);
+    return res;
+}
+#endif
+
+/* 1 if decoded, 0 if the format has no native decoder, -1 for error */
+static int ph_decode_native(const uint8_t *data, size_t len, ImageFormat format, const DecodeOptions *opts,
+                            CImg<uint8_t> &img) {
+    switch (format) {
+#ifdef HAVE_LIBJPEG
+        case PH_FORMAT_JPEG:
+            return ph_decode_jpeg(data, len, opts, img);
+#endif
+#ifdef HAVE_LIBPNG
+        case PH_FORMAT_PNG:
+            return ph_decode_png(data, len, opts, img);
+#endif
+#ifdef HAVE_LIBTIFF
+        case PH_FORMAT_TIFF:
+            return ph_decode_tiff(data, len, opts, img);
+#endif
+        default:
+            return 0;
+    }
+}
+
+/* whole file into a malloc'ed buffer with stdio */
+static int ph_read_stdio(const char *file, MappedFile &m) {
+    FILE *fp = fopen(file, "rb");
+    if (!fp)
+        return -1;
+    uint8_t *buf = NULL;
+    long size = -1;
+    if (fseek(fp, 0, SEEK_END) == 0)
+        size = ftell(fp);
+    if (size <= 0 || fseek(fp, 0, SEEK_SET) != 0)
+        goto cleanup;
+    buf = (uint8_t *)malloc((size_t)size);
+    if (!buf)
+        goto cleanup;
+    if (fread(buf, 1, (size_t)size, fp) != (size_t)size) {
+        free(buf);
+        buf = NULL;
+        goto cleanup;
+    }
+    m.data = buf;
+    m.size = (size_t)size;
+
+cleanup:
+    fclose(fp);
+    return buf ? 0 : -1;
+}
+
+int ph_map_file(const char *file, MappedFile &m) {
+    m.data = NULL;
+    m.size = 0;
+    m.mapped = 0;
+    if (!file)
+        return -1;
+
+#ifdef HAVE_SYS_MMAN_H
+    int fd = open(file, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+        close(fd);
+        return -1;
+    }
+    void *addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr != MAP_FAILED) {
+        m.data = (const uint8_t *)addr;
+        m.size = (size_t)st.st_size;
+        m.mapped = 1;
+        return 0;
+    }
+#endif
+
+    return ph_read_stdio(file, m);
+}
+
+int ph_read_file(const char *file, MappedFile &m) {
+    m.data = NULL;
+    m.size = 0;
+    m.mapped = 0;
+    if (!file)
+        return -1;
+
+#ifdef HAVE_SYS_MMAN_H
+    int fd = open(file, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+        close(fd);
+        return -1;
+    }
+#ifdef POSIX_FADV_WILLNEED
+    // start the readahead of the whole file before the first read blocks
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+    const size_t size = (size_t)st.st_size;
+    uint8_t *buf = (uint8_t *)malloc(size);
+    size_t done = 0;
+    while (buf && done < size) {
+        const ssize_t n = pread(fd, buf + done, size - done, (off_t)done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += (size_t)n;
+    }
+    close(fd);
+    if (!buf || done != size) {
+        free(buf);
+        return -1;
+    }
+    m.data = buf;
+    m.size = size;
+    return 0;
+#else
+    return ph_read_stdio(file, m);
+#endif
+}
+
+void ph_unmap_file(MappedFile &m) {
+    if (!m.data)
+        return;
+#ifdef HAVE_SYS_MMAN_H
+    if (m.mapped)
+        munmap((void *)m.data, m.size);
+    else
+#endif
+        free((void *)m.data);
+    m.data = NULL;
+    m.size = 0;
+    m.mapped = 0;
+}
+
+#ifdef HAVE_FMEMOPEN
+static int ph_decode_stream(const uint8_t *data, size_t len, ImageFormat format, CImg<uint8_t> &img) {
+    FILE *fp = fmemopen((void *)data, len, "rb");
+    if (!fp)
+        return -1;
+    int res = 0;
+    try {
+        switch (format) {
+            case PH_FORMAT_BMP:
+                img.load_bmp(fp);
+                break;
+            case PH_FORMAT_PNM:
+                img.load_pnm(fp);
+                break;
+            case PH_FORMAT_JPEG:
+                img.load_jpeg(fp);
+                break;
+            case PH_FORMAT_PNG:
+                img.load_png(fp);
+                break;
+            default:
+                res = -1;
+        }
+    } catch (CImgException &ex) {
+        res = -1;
+    }
+    fclose(fp);
+    return (res < 0 || img.is_empty()) ? -1 : 0;
+}
+#endif
+
+/* last resort for formats only CImg's external converters understand */
+static int ph_decode_tempfile(const uint8_t *data, size_t len, ImageFormat format, CImg<uint8_t> &img) {
+    char filename[1024];
+    snprintf(filename, sizeof(filename), "%s%c%s.%s", cimg::temporary_path(), cimg_file_separator,
+             cimg::filenamerand(), ph_format_extension(format));
+    FILE *fp = fopen(filename, "wb");
+    if (!fp)
+        return -1;
+    const int written = fwrite(data, 1, len, fp) == len;
+    fclose(fp);
+
+    int res = -1;
+    if (written) {
+        const unsigned int omode = cimg::exception_mode();
+        cimg::exception_mode(0); /* a bad buffer is reported by the return value only */
+        try {
+            img.load(filename);
+            res = img.is_empty() ? -1 : 0;
+        } catch (CImgException &ex) {
+            res = -1;
+        }
+        cimg::exception_mode(omode);
+    }
+    remove(filename);
+    return res;
+}
+
+int ph_decode_image_mem(const uint8_t *data, size_t len, CImg<uint8_t> &img, const DecodeOptions *opts) {
+    if (!data || len == 0)
+        return -1;
+
+    const ImageFormat format = ph_sniff_format(data, len);
+    const int res = ph_decode_native(data, len, format, opts, img);
+    if (res != 0)
+        return res < 0 ? -1 : 0;
+#ifdef HAVE_FMEMOPEN
+    if (ph_format_in_memory(format))
+        return ph_decode_stream(data, len, format, img);
+#endif
+    return ph_decode_tempfile(data, len, format, img);
+}
+
+int ph_decode_image_file_mem(const char *file, const uint8_t *data, size_t len, CImg<uint8_t> &img,
+                             const DecodeOptions *opts) {
+    if (!file || !data || len == 0)
+        return -1;
+
+    const ImageFormat format = ph_sniff_format(data, len);
+    if (ph_format_native(format) || ph_format_in_memory(format))
+        return ph_decode_image_mem(data, len, img, opts);
+    try {
+        img.load(file);
+        return img.is_empty() ? -1 : 0;
+    } catch (CImgException &ex) {
+        return -1;
+    }
+}
+
+int ph_load_image_file(const char *file, CImg<uint8_t> &img, const DecodeOptions *opts) {
+    if (!file)
+        return -1;
+
+    MappedFile m;
+    if (ph_map_file(file, m) < 0)
+        return -1;
+
+    const int res = ph_decode_image_file_mem(file, m.data, m.size, img, opts);
+    ph_unmap_file(m);
+    return res;
+}
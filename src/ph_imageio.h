@@ -0,0 +1,125 @@
+/*
+
+    pHash, the open source perceptual hash library
+    Copyright (C) 2009 Aetilius, Inc.
+    All rights reserved.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Evan Klinger - eklinger@phash.org
+    D Grant Starkweather - dstarkweather@phash.org
+
+*/
+
+
+#ifndef _PH_IMAGEIO_H
+#define _PH_IMAGEIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pHash.h"
+
+/* /brief read only view of a whole file
+ *  The file is mmap'ed where possible, otherwise read into a malloc'ed buffer.
+ */
+typedef struct ph_mapped_file {
+    const uint8_t *data;
+    size_t size;
+    int mapped; /* 1 if data must be munmap'ed, 0 if it must be freed */
+} MappedFile;
+
+/* /brief map a file for reading
+ *  /param file - name of file
+ *  /param m    - (out) MappedFile, release with ph_unmap_file
+ *  /return int value - less than 0 for error
+ */
+int ph_map_file(const char *file, MappedFile &m);
+
+/* /brief read a whole file into memory
+ *  Unlike ph_map_file the bytes are all read before it returns, so the
+ *  I/O wait is spent in the caller; the kernel is told to read the file
+ *  ahead in full where posix_fadvise is available.
+ *  /param file - name of file
+ *  /param m    - (out) MappedFile, release with ph_unmap_file
+ *  /return int value - less than 0 for error
+ */
+int ph_read_file(const char *file, MappedFile &m);
+
+/* /brief release a file mapped with ph_map_file
+ *  /param m - MappedFile
+ */
+void ph_unmap_file(MappedFile &m);
+
+/* /brief what a hash needs from the decoder
+ *  Only the native decoders act on these, other formats are always decoded
+ *  at full resolution in their own channel layout.
+ */
+typedef struct ph_decode_options {
+    int gray;       /* 1 to ask the codec for a single luma channel */
+    int min_width;  /* jpeg is decoded at the smallest dct scaling that keeps */
+    int min_height; /* at least min_width x min_height pixels, 0 for full size */
+} DecodeOptions;
+
+/* decode needs of each image hash */
+extern const DecodeOptions ph_decode_dct;
+extern const DecodeOptions ph_decode_mh;
+extern const DecodeOptions ph_decode_bmb;
+extern const DecodeOptions ph_decode_radial;
+
+/* /brief decode needs of several hashes at once
+ *  /param mask - ImageHashMask bits
+ *  /param opts - (out) gray only if every hash is fine with it, the largest
+ *                minimum size of them all
+ */
+void ph_decode_options_merge(int mask, DecodeOptions &opts);
+
+/* /brief decode an encoded image held in memory
+ *  Jpeg, png and tiff are decoded in process with libjpeg, libpng and libtiff
+ *  when the library is built with them (WITH_OTHER_IMAGE_HASH). Formats CImg
+ *  can read from a stream (bmp, pnm) are decoded straight from the buffer.
+ *  Anything else needs CImg's external converters and goes through a
+ *  temporary file.
+ *  /param data - encoded image bytes
+ *  /param len  - number of bytes
+ *  /param img  - (out) decoded image
+ *  /param opts - DecodeOptions, NULL for a full size decode
+ *  /return int value - less than 0 for error
+ */
+int ph_decode_image_mem(const uint8_t *data, size_t len, CImg<uint8_t> &img, const DecodeOptions *opts = NULL);
+
+/* /brief decode an image file whose bytes are already in memory
+ *  As ph_load_image_file, with the bytes read by the caller; formats that
+ *  can not be decoded in memory are loaded by name with CImg.
+ *  /param file - name of file
+ *  /param data - the file's bytes
+ *  /param len  - number of bytes
+ *  /param img  - (out) decoded image
+ *  /param opts - DecodeOptions, NULL for a full size decode
+ *  /return int value - less than 0 for error
+ */
+int ph_decode_image_file_mem(const char *file, const uint8_t *data, size_t len, CImg<uint8_t> &img,
+                             const DecodeOptions *opts = NULL);
+
+/* /brief load an image file
+ *  Maps the file and decodes it with ph_decode_image_mem, formats that can not
+ *  be decoded in memory are loaded by name with CImg.
+ *  /param file - name of file
+ *  /param img  - (out) decoded image
+ *  /param opts - DecodeOptions, NULL for a full size decode
+ *  /return int value - less than 0 for error
+ */
+int ph_load_image_file(const char *file, CImg<uint8_t> &img, const DecodeOptions *opts = NULL);
+
+#endif /* _PH_IMAGEIO_H */
@@ -0,0 +1,166 @@
+/*
+
+    pHash, the open source perceptual hash library
+    Copyright (C) 2009 Aetilius, Inc.
+    All rights reserved.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Evan Klinger - eklinger@phash.org
+    D Grant Starkweather - dstarkweather@phash.org
+
+*/
+
+
+#include "ph_mhcorr.h"
+
+#include <math.h>
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/* below this sigma CImg's direct correlation is as fast as the split */
+#define MH_SEPARABLE_MIN_SIGMA 2
+
+/* kernels kept for the most recently used (alpha, level) pairs */
+#define MH_CACHE_SIZE 8
+
+typedef struct ph_mh_entry {
+    float alpha;
+    float level;
+    int sigma;
+    CImg<float> kernel;
+    /* 1D factors: kernel(X, Y) ~ a(X) g(Y) - g(X) h(Y) */
+    std::vector<float> a;
+    std::vector<float> g;
+    std::vector<float> h;
+} MHEntry;
+
+static MHEntry *ph_mh_entry_build(float alpha, float level) {
+    MHEntry *e = new MHEntry;
+    int sigma = (int)4 * pow((float)alpha, (float)level);
+    float xpos, ypos, A;
+    e->alpha = alpha;
+    e->level = level;
+    e->sigma = sigma;
+    e->kernel.assign(2 * sigma + 1, 2 * sigma + 1, 1, 1, 0);
+    cimg_forXY(e->kernel, X, Y) {
+        xpos = pow(alpha, -level) * (X - sigma);
+        ypos = pow(alpha, -level) * (Y - sigma);
+        A = xpos * xpos + ypos * ypos;
+        e->kernel.atXY(X, Y) = (2 - A) * exp(-A / 2);
+    }
+
+    e->a.resize(2 * sigma + 1);
+    e->g.resize(2 * sigma + 1);
+    e->h.resize(2 * sigma + 1);
+    for (int X = 0; X < 2 * sigma + 1; X++) {
+        xpos = pow(alpha, -level) * (X - sigma);
+        e->g[X] = exp(-xpos * xpos / 2);
+        e->h[X] = xpos * xpos * e->g[X];
+        e->a[X] = 2 * e->g[X] - e->h[X];
+    }
+    return e;
+}
+
+static std::shared_ptr<const MHEntry> ph_mh_entry(float alpha, float level) {
+    static std::mutex mutex;
+    static std::shared_ptr<const MHEntry> cache[MH_CACHE_SIZE]; /* most recent first */
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int i = 0; i < MH_CACHE_SIZE && cache[i]; i++) {
+            if (cache[i]->alpha == alpha && cache[i]->level == level) {
+                std::shared_ptr<const MHEntry> e = cache[i];
+                for (; i > 0; i--)
+                    cache[i] = cache[i - 1];
+                cache[0] = e;
+                return e;
+            }
+        }
+    }
+
+    /* built outside the lock, two threads may race to build the same kernel */
+    std::shared_ptr<const MHEntry> e(ph_mh_entry_build(alpha, level));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (int i = MH_CACHE_SIZE - 1; i > 0; i--)
+        cache[i] = cache[i - 1];
+    cache[0] = e;
+    return e;
+}
+
+std::shared_ptr<const CImg<float> > ph_mh_kernel(float alpha, float level) {
+    std::shared_ptr<const MHEntry> e = ph_mh_entry(alpha, level);
+    return std::shared_ptr<const CImg<float> >(e, &e->kernel);
+}
+
+static inline int ph_clamp(int v, int lo, int hi) {
+    return (v < lo) ? lo : ((v > hi) ? hi : v);
+}
+
+static void ph_mh_correlate_separable(const CImg<uint8_t> &img, const MHEntry &e, CImg<float> &resp) {
+    const int width = img.width();
+    const int height = img.height();
+    const int r = e.sigma;
+    const int taps = 2 * r + 1;
+
+    /* horizontal passes with a and g over rows padded by their edge pixels */
+    CImg<float> ta(width, height, 1, 1, 0);
+    CImg<float> tg(width, height, 1, 1, 0);
+    std::vector<float> row(width + 2 * r);
+    for (int y = 0; y < height; y++) {
+        const uint8_t *src = img.data(0, y);
+        for (int i = 0; i < width + 2 * r; i++) {
+            row[i] = src[ph_clamp(i - r, 0, width - 1)];
+        }
+        float *outa = ta.data(0, y);
+        float *outg = tg.data(0, y);
+        for (int p = 0; p < taps; p++) {
+            const float ap = e.a[p];
+            const float gp = e.g[p];
+            const float *in = row.data() + p;
+            for (int x = 0; x < width; x++) {
+                outa[x] += ap * in[x];
+                outg[x] += gp * in[x];
+            }
+        }
+    }
+
+    /* vertical passes: a(X) g(Y) - g(X) h(Y) */
+    resp.assign(width, height, 1, 1, 0);
+    for (int y = 0; y < height; y++) {
+        float *out = resp.data(0, y);
+        for (int q = 0; q < taps; q++) {
+            const int yy = ph_clamp(y + q - r, 0, height - 1);
+            const float gq = e.g[q];
+            const float hq = e.h[q];
+            const float *ra = ta.data(0, yy);
+            const float *rg = tg.data(0, yy);
+            for (int x = 0; x < width; x++) {
+                out[x] += gq * ra[x] - hq * rg[x];
+            }
+        }
+    }
+}
+
+void ph_mh_correlate(const CImg<uint8_t> &img, float alpha, float level, CImg<float> &resp) {
+    std::shared_ptr<const MHEntry> e = ph_mh_entry(alpha, level);
+    if (e->sigma < MH_SEPARABLE_MIN_SIGMA || img.spectrum() != 1 || img.depth() != 1) {
+        resp = img.get_correlate(e->kernel);
+    } else {
+        ph_mh_correlate_separable(img, *e, resp);
+    }
+}
@@ -0,0 +1,55 @@
+/*
+
+    pHash, the open source perceptual hash library
+    Copyright (C) 2009 Aetilius, Inc.
+    All rights reserved.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Evan Klinger - eklinger@phash.org
+    D Grant Starkweather - dstarkweather@phash.org
+
+*/
+
+
+#ifndef _PH_MHCORR_H
+#define _PH_MHCORR_H
+
+#include <memory>
+
+#include "pHash.h"
+
+/* /brief Marr-Hildreth (mexican hat) kernel
+ *  Built once per (alpha, level); the last few pairs used are cached and an
+ *  evicted kernel lives on as long as a caller holds it. Safe to call from
+ *  several threads.
+ *  /param alpha - scale factor of the wavelet
+ *  /param level - level of the scale factor
+ *  /return (2 sigma + 1) square kernel, sigma = 4 alpha^level
+ */
+std::shared_ptr<const CImg<float> > ph_mh_kernel(float alpha, float level);
+
+/* /brief correlation of an image with the Marr-Hildreth kernel
+ *  Same response as img.get_correlate(*ph_mh_kernel(alpha, level)) (neumann
+ *  borders) up to float rounding. The kernel is the sum of two separable
+ *  terms, (2 - x^2 - y^2) g(x) g(y) = (2 g(x) - x^2 g(x)) g(y) - g(x) y^2 g(y),
+ *  so all but the tiniest kernels run as four 1D passes, linear in sigma.
+ *  /param img   - single channel image
+ *  /param alpha - scale factor of the wavelet
+ *  /param level - level of the scale factor
+ *  /param resp  - (out) response, same size as img
+ */
+void ph_mh_correlate(const CImg<uint8_t> &img, float alpha, float level, CImg<float> &resp);
+
+#endif /* _PH_MHCORR_H */
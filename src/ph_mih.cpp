@@ -0,0 +1,324 @@
+/*
+
+    pHash, the open source perceptual hash library
+    Copyright (C) 2009 Aetilius, Inc.
+    All rights reserved.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Evan Klinger - eklinger@phash.org
+    D Grant Starkweather - dstarkweather@phash.org
+
+*/
+
+
+#include "pHash.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include "ph_pool.h"
+#include "ph_simd.h"
+
+/* Multi-index hashing (Norouzi, Punjani, Fleet): each hash is cut into m
+ * substrings with one table per substring. Two hashes within distance r
+ * have some substring within r / m of each other, so a query probes the
+ * substring neighbourhoods in the tables instead of reading every hash. */
+
+#define MIH_DENSE_BITS 16 /* substrings up to this width get a flat bucket array */
+
+typedef std::vector<uint32_t> MIHBucket;
+
+typedef struct ph_mih_table {
+    int shift; /* first bit of the substring */
+    int width; /* bits in the substring */
+    std::vector<MIHBucket> dense;
+    std::unordered_map<uint32_t, MIHBucket> sparse;
+} MIHTable;
+
+struct ph_mih_index {
+    int m;
+    std::vector<MIHTable> tables;
+    std::vector<ulong64> codes; /* hash of each id */
+    std::vector<uint8_t> live;  /* 0 for deleted ids */
+    std::vector<uint32_t> free_ids;
+    uint32_t count;             /* live ids */
+};
+
+static inline uint32_t ph_mih_key(const MIHTable &t, ulong64 hash) {
+    return (uint32_t)((hash >> t.shift) & (((ulong64)1 << t.width) - 1));
+}
+
+static const MIHBucket *ph_mih_find(const MIHTable &t, uint32_t key) {
+    if (t.width <= MIH_DENSE_BITS)
+        return t.dense[key].empty() ? NULL : &t.dense[key];
+    std::unordered_map<uint32_t, MIHBucket>::const_iterator it = t.sparse.find(key);
+    return (it == t.sparse.end()) ? NULL : &it->second;
+}
+
+static MIHBucket &ph_mih_bucket(MIHTable &t, uint32_t key) {
+    if (t.width <= MIH_DENSE_BITS)
+        return t.dense[key];
+    return t.sparse[key];
+}
+
+MIHIndex *ph_mih_create(int m) {
+    if (m == 0)
+        m = 4;
+    if (m < 2 || m > 16)
+        return NULL;
+
+    MIHIndex *index = new MIHIndex;
+    index->m = m;
+    index->count = 0;
+    index->tables.resize(m);
+    int shift = 0;
+    for (int i = 0; i < m; i++) {
+        MIHTable &t = index->tables[i];
+        t.shift = shift;
+        t.width = 64 / m + (i < 64 % m ? 1 : 0);
+        if (t.width <= MIH_DENSE_BITS)
+            t.dense.resize((size_t)1 << t.width);
+        shift += t.width;
+    }
+    return index;
+}
+
+void ph_mih_free(MIHIndex *index) {
+    delete index;
+}
+
+int ph_mih_size(const MIHIndex *index) {
+    return index ? (int)index->count : -1;
+}
+
+int64_t ph_mih_insert(MIHIndex *index, ulong64 hash) {
+    if (!index)
+        return -1;
+    uint32_t id;
+    if (!index->free_ids.empty()) {
+        id = index->free_ids.back();
+        index->free_ids.pop_back();
+        index->codes[id] = hash;
+        index->live[id] = 1;
+    } else {
+        if (index->codes.size() >= 0xffffffffu)
+            return -1;
+        id = (uint32_t)index->codes.size();
+        index->codes.push_back(hash);
+        index->live.push_back(1);
+    }
+    for (int i = 0; i < index->m; i++) {
+        MIHTable &t = index->tables[i];
+        ph_mih_bucket(t, ph_mih_key(t, hash)).push_back(id);
+    }
+    index->count++;
+    return id;
+}
+
+int ph_mih_insert_many(MIHIndex *index, const ulong64 *hashes, int count, uint32_t *ids) {
+    if (!index || (!hashes && count > 0) || count < 0)
+        return -1;
+    index->codes.reserve(index->codes.size() + count);
+    index->live.reserve(index->live.size() + count);
+    for (int i = 0; i < count; i++) {
+        int64_t id = ph_mih_insert(index, hashes[i]);
+        if (id < 0)
+            return -1;
+        if (ids)
+            ids[i] = (uint32_t)id;
+    }
+    return count;
+}
+
+int ph_mih_delete(MIHIndex *index, uint32_t id) {
+    if (!index || id >= index->codes.size() || !index->live[id])
+        return -1;
+    const ulong64 hash = index->codes[id];
+    for (int i = 0; i < index->m; i++) {
+        MIHTable &t = index->tables[i];
+        const uint32_t key = ph_mih_key(t, hash);
+        MIHBucket &b = ph_mih_bucket(t, key);
+        MIHBucket::iterator it = std::find(b.begin(), b.end(), id);
+        if (it != b.end()) {
+            *it = b.back();
+            b.pop_back();
+        }
+        if (b.empty() && t.width > MIH_DENSE_BITS)
+            t.sparse.erase(key);
+    }
+    index->live[id] = 0;
+    index->free_ids.push_back(id);
+    index->count--;
+    return 0;
+}
+
+static ulong64 ph_mih_binomial(int n, int k) {
+    ulong64 c = 1;
+    for (int i = 1; i <= k; i++) {
+        c = c * (n - k + i) / i;
+    }
+    return c;
+}
+
+static bool ph_mih_match_less(const MIHMatch &a, const MIHMatch &b) {
+    return (a.distance != b.distance) ? (a.distance < b.distance) : (a.id < b.id);
+}
+
+/* every live id within radius of query (k <= 0), or at least the k nearest
+ * ones with all ties at the k-th distance (k > 0), sorted by distance, id */
+static void ph_mih_search(const MIHIndex *index, ulong64 query, int radius, int k, std::vector<MIHMatch> &found) {
+    const int m = index->m;
+    const int max_dist = (k > 0) ? 64 : radius;
+    int rad[16];
+    uint32_t qkey[16];
+    int hist[65] = {0};
+    int within = 0; /* found ids at distance <= R */
+    double work = 0;
+
+    found.clear();
+    for (int i = 0; i < m; i++) {
+        rad[i] = -1;
+        qkey[i] = ph_mih_key(index->tables[i], query);
+    }
+
+    /* each step of R widens one table by one bit, after the step every id
+     * within R has been found (pigeonhole over the m substrings) */
+    for (int R = 0; R <= max_dist; R++) {
+        const int t = R % m;
+        const int s = R / m;
+        const MIHTable &table = index->tables[t];
+        if (s <= table.width) {
+            /* expected cost of the shell's bucket probes and ids against a
+             * linear scan at one popcount per hash: an id here costs about
+             * two, a hash map probe about sixteen */
+            const double probe = (table.width <= MIH_DENSE_BITS) ? 1.0 : 8.0;
+            const double per_bucket = probe + (double)index->count / (double)((ulong64)1 << table.width);
+            const double shell = (double)ph_mih_binomial(table.width, s) * per_bucket;
+            if (work + shell > index->count / 2.0) {
+                found.clear();
+                for (size_t id = 0; id < index->codes.size(); id++) {
+                    if (!index->live[id])
+                        continue;
+                    const int d = ph_popcount64(query ^ index->codes[id]);
+                    if (d <= max_dist) {
+                        MIHMatch match = {(uint32_t)id, d};
+                        found.push_back(match);
+                    }
+                }
+                break;
+            }
+            work += shell;
+            rad[t] = s;
+
+            /* substrings at exactly s bits from the query's, in Gosper order */
+            const ulong64 end = (ulong64)1 << table.width;
+            for (ulong64 v = ((ulong64)1 << s) - 1; v < end;) {
+                const MIHBucket *b = ph_mih_find(table, qkey[t] ^ (uint32_t)v);
+                for (size_t n = 0; b && n < b->size(); n++) {
+                    const uint32_t id = (*b)[n];
+                    const ulong64 x = query ^ index->codes[id];
+                    const int d = ph_popcount64(x);
+                    if (d > max_dist)
+                        continue;
+                    /* skip ids another table has reached already */
+                    int seen = 0;
+                    for (int j = 0; j < m && !seen; j++) {
+                        if (j != t && rad[j] >= 0 && ph_popcount64(ph_mih_key(index->tables[j], x)) <= rad[j])
+                            seen = 1;
+                    }
+                    if (seen)
+                        continue;
+                    MIHMatch match = {id, d};
+                    found.push_back(match);
+                    hist[d]++;
+                }
+                if (v == 0)
+                    break;
+                const ulong64 c = v & (0 - v);
+                const ulong64 r = v + c;
+                v = (((r ^ v) >> 2) / c) | r;
+            }
+        }
+        within += hist[R];
+        if (k > 0 && within >= k)
+            break;
+    }
+    if (k > 0 && found.size() > (size_t)k) {
+        std::nth_element(found.begin(), found.begin() + k, found.end(), ph_mih_match_less);
+        found.resize(k);
+    }
+    std::sort(found.begin(), found.end(), ph_mih_match_less);
+}
+
+int ph_mih_query(const MIHIndex *index, ulong64 query, int radius, MIHMatch *matches, int capacity) {
+    if (!index || capacity < 0 || (!matches && capacity > 0))
+        return -1;
+    if (radius < 0)
+        return 0;
+    std::vector<MIHMatch> found;
+    ph_mih_search(index, query, radius, 0, found);
+    const int n = std::min((int)found.size(), capacity);
+    std::copy(found.begin(), found.begin() + n, matches);
+    return (int)found.size();
+}
+
+int ph_mih_topk(const MIHIndex *index, ulong64 query, int k, MIHMatch *matches) {
+    if (!index || (!matches && k > 0))
+        return -1;
+    if (k <= 0)
+        return 0;
+    std::vector<MIHMatch> found;
+    ph_mih_search(index, query, 64, k, found);
+    const int n = std::min((int)found.size(), k);
+    std::copy(found.begin(), found.begin() + n, matches);
+    return n;
+}
+
+typedef struct ph_mih_batch {
+    const MIHIndex *index;
+    const ulong64 *queries;
+    int radius;   /* radius query when k <= 0 */
+    int k;
+    MIHMatch *matches;
+    int capacity; /* slots per query */
+    int *counts;
+} MIHBatch;
+
+/* one pool task per query */
+static void ph_mih_batch_task(void *arg, int q) {
+    MIHBatch *b = (MIHBatch *)arg;
+    MIHMatch *out = b->matches ? b->matches + (size_t)q * b->capacity : NULL;
+    b->counts[q] = (b->k > 0) ? ph_mih_topk(b->index, b->queries[q], b->k, out)
+                              : ph_mih_query(b->index, b->queries[q], b->radius, out, b->capacity);
+}
+
+int ph_mih_query_batch(const MIHIndex *index, const ulong64 *queries, int nq, int radius, MIHMatch *matches,
+                       int capacity, int *counts, int threads) {
+    if (!index || (!queries && nq > 0) || !counts || nq < 0 || capacity < 0 || (!matches && capacity > 0))
+        return -1;
+    MIHBatch batch = {index, queries, radius, 0, matches, capacity, counts};
+    ph_parallel_for(ph_mih_batch_task, &batch, nq, threads);
+    return nq;
+}
+
+int ph_mih_topk_batch(const MIHIndex *index, const ulong64 *queries, int nq, int k, MIHMatch *matches,
+                      int *counts, int threads) {
+    if (!index || (!queries && nq > 0) || !counts || nq < 0 || k < 0 || (!matches && k > 0))
+        return -1;
+    MIHBatch batch = {index, queries, 0, k, matches, k, counts};
+    ph_parallel_for(ph_mih_batch_task, &batch, nq, threads);
+    return nq;
+}
@@ -0,0 +1,495 @@
+/*
+
+    pHash, the open source perceptual hash library
+    Copyright (C) 2009 Aetilius, Inc.
+    All rights reserved.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Evan Klinger - eklinger@phash.org
+    D Grant Starkweather - dstarkweather@phash.org
+
+*/
+
+
+
+#include "ph_pipeline.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef HAVE_LIBURING
+#include <fcntl.h>
+#include <liburing.h>
+#include <unistd.h>
+#endif
+
+#include "ph_imageio.h"
+#include "ph_pool.h"
+
+#define PIPELINE_READERS   2
+#define PIPELINE_DEPTH     4 /* files per hashing thread */
+#define PIPELINE_MAX_BYTES ((size_t)256 << 20)
+
+#define PIPELINE_URING_SLOT    ((size_t)1 << 20) /* registered buffer per file, larger files get their own */
+#define PIPELINE_URING_ENTRIES 4096              /* files the ring reads at once */
+
+typedef struct ph_pipeline_item {
+    int64_t index;
+    const char *name; /* files[index], or a copy of a streamed file name */
+    size_t reserved; /* bytes of the budget held until hashed */
+    MappedFile file;
+    int slot; /* registered buffer holding the file, -1 for none */
+} PipelineItem;
+
+typedef struct ph_ring_cell {
+    std::atomic<size_t> seq;
+    PipelineItem item;
+} RingCell;
+
+/* bounded multi-producer multi-consumer ring (D. Vyukov): a cell's sequence
+ * number says whether it waits for a push or a pop at a given position */
+typedef struct ph_pipeline_ring {
+    std::unique_ptr<RingCell[]> cells;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+} PipelineRing;
+
+static void ph_ring_init(PipelineRing &r, size_t capacity) {
+    size_t size = 2;
+    while (size < capacity)
+        size <<= 1;
+    r.cells.reset(new RingCell[size]);
+    for (size_t i = 0; i < size; i++)
+        r.cells[i].seq.store(i, std::memory_order_relaxed);
+    r.mask = size - 1;
+    r.head.store(0, std::memory_order_relaxed);
+    r.tail.store(0, std::memory_order_relaxed);
+}
+
+static bool ph_ring_push(PipelineRing &r, const PipelineItem &item) {
+    size_t pos = r.head.load(std::memory_order_relaxed);
+    RingCell *cell;
+    for (;;) {
+        cell = &r.cells[pos & r.mask];
+        const intptr_t dif = (intptr_t)cell->seq.load(std::memory_order_acquire) - (intptr_t)pos;
+        if (dif == 0) {
+            if (r.head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        } else if (dif < 0) {
+            return false;
+        } else {
+            pos = r.head.load(std::memory_order_relaxed);
+        }
+    }
+    cell->item = item;
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+static bool ph_ring_pop(PipelineRing &r, PipelineItem &item) {
+    size_t pos = r.tail.load(std::memory_order_relaxed);
+    RingCell *cell;
+    for (;;) {
+        cell = &r.cells[pos & r.mask];
+        const intptr_t dif = (intptr_t)cell->seq.load(std::memory_order_acquire) - (intptr_t)(pos + 1);
+        if (dif == 0) {
+            if (r.tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        } else if (dif < 0) {
+            return false;
+        } else {
+            pos = r.tail.load(std::memory_order_relaxed);
+        }
+    }
+    item = cell->item;
+    cell->seq.store(pos + r.mask + 1, std::memory_order_release);
+    return true;
+}
+
+/* waits are on disk reads or whole decodes, so back off to sleeping soon */
+static void ph_pipeline_backoff(int &spins) {
+    if (++spins < 16)
+        std::this_thread::yield();
+    else
+        std::this_thread::sleep_for(std::chrono::microseconds(spins < 64 ? 50 : 200));
+}
+
+typedef struct ph_pipeline {
+    char *const *files;      /* files of a batch, NULL when streamed */
+    int count;
+    ph_pipeline_nextCB next; /* source of a streamed batch */
+    void *next_arg;
+    int depth;
+    size_t max_bytes;
+    ph_pipeline_hashCB hash;
+    void *arg;
+    PipelineRing ring;
+    PipelineRing returned;          /* registered buffers the hashing threads are done with */
+    std::mutex source;              /* held while taking the next file */
+    std::atomic<int64_t> taken;     /* files taken by the readers, final once exhausted */
+    std::atomic<bool> exhausted;    /* no more files will be taken */
+    std::atomic<bool> stop;         /* the hash stage asked to stop */
+    std::atomic<int64_t> popped;    /* files taken by the hashing threads */
+    std::atomic<int> pending;       /* files read ahead and not hashed yet */
+    std::atomic<size_t> pending_bytes;
+} Pipeline;
+
+/* next file to read, false when there are no more or the batch was stopped;
+ * a streamed name is copied as the source only keeps it until the next call */
+static bool ph_pipeline_take(Pipeline *p, PipelineItem &item) {
+    std::lock_guard<std::mutex> lock(p->source);
+    if (p->exhausted.load())
+        return false;
+    const char *name = NULL;
+    const int64_t index = p->taken.load();
+    if (!p->stop.load()) {
+        if (p->files)
+            name = index < p->count ? p->files[index] : NULL;
+        else if ((name = p->next(p->next_arg)) != NULL)
+            name = strdup(name);
+    }
+    if (!name) {
+        p->exhausted = true;
+        return false;
+    }
+    item.index = index;
+    item.name = name;
+    item.reserved = 0;
+    item.slot = -1;
+    p->taken = index + 1;
+    return true;
+}
+
+static void ph_pipeline_release(Pipeline *p, PipelineItem &item) {
+    if (!p->files)
+        free((void *)item.name);
+}
+
+/* take a place among the files read ahead, and size bytes of the budget;
+ * a file larger than the whole budget goes through alone */
+static bool ph_pipeline_try_reserve(Pipeline *p, size_t size) {
+    int n = p->pending.load();
+    do {
+        if (n >= p->depth)
+            return false;
+    } while (!p->pending.compare_exchange_weak(n, n + 1));
+
+    size_t bytes = p->pending_bytes.load();
+    do {
+        if (bytes != 0 && bytes + size > p->max_bytes) {
+            p->pending--;
+            return false;
+        }
+    } while (!p->pending_bytes.compare_exchange_weak(bytes, bytes + size));
+    return true;
+}
+
+static size_t ph_pipeline_file_size(const char *file) {
+    struct stat st;
+    return (stat(file, &st) == 0 && st.st_size > 0) ? (size_t)st.st_size : 0;
+}
+
+static void ph_pipeline_push(PipelineRing &ring, const PipelineItem &item) {
+    // the rings hold depth files, so they only fill for an instant
+    int spins = 0;
+    while (!ph_ring_push(ring, item))
+        ph_pipeline_backoff(spins);
+}
+
+static void ph_pipeline_reader(Pipeline *p) {
+    PipelineItem item;
+    while (ph_pipeline_take(p, item)) {
+        const size_t size = ph_pipeline_file_size(item.name);
+        int spins = 0;
+        while (!ph_pipeline_try_reserve(p, size))
+            ph_pipeline_backoff(spins);
+
+        item.reserved = size;
+        ph_read_file(item.name, item.file);
+        ph_pipeline_push(p->ring, item);
+    }
+}
+
+#ifdef HAVE_LIBURING
+typedef struct ph_uring_reader {
+    struct io_uring ring;
+    uint8_t *buffers; /* depth slots of slot_size bytes */
+    size_t slot_size;
+    bool fixed;       /* buffers are registered with the ring */
+} UringReader;
+
+typedef struct ph_uring_read {
+    PipelineItem item;
+    int fd; /* -1 while opening */
+    size_t done;
+} UringRead;
+
+static bool ph_uring_init(UringReader &u, int depth, size_t max_bytes) {
+    if (io_uring_queue_init(depth, &u.ring, 0) < 0)
+        return false;
+    // one registered buffer per file read ahead, within the byte budget
+    u.slot_size = std::min(PIPELINE_URING_SLOT, std::max(max_bytes / depth, (size_t)1 << 16));
+    u.slot_size = (u.slot_size + 4095) & ~(size_t)4095;
+    u.buffers = (uint8_t *)malloc((size_t)depth * u.slot_size);
+    u.fixed = false;
+    if (u.buffers) {
+        std::vector<struct iovec> iov(depth);
+        for (int i = 0; i < depth; i++) {
+            iov[i].iov_base = u.buffers + (size_t)i * u.slot_size;
+            iov[i].iov_len = u.slot_size;
+        }
+        // may fail on RLIMIT_MEMLOCK, plain reads into the same buffers then
+        u.fixed = io_uring_register_buffers(&u.ring, iov.data(), depth) == 0;
+    }
+    return true;
+}
+
+static void ph_uring_submit_read(UringReader &u, UringRead *rd) {
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&u.ring);
+    uint8_t *dst = (uint8_t *)rd->item.file.data + rd->done;
+    const unsigned len = (unsigned)std::min(rd->item.reserved - rd->done, (size_t)1 << 30);
+    if (u.fixed && rd->item.slot >= 0)
+        io_uring_prep_read_fixed(sqe, rd->fd, dst, len, rd->done, rd->item.slot);
+    else
+        io_uring_prep_read(sqe, rd->fd, dst, len, rd->done);
+    io_uring_sqe_set_data(sqe, rd);
+}
+
+/* hand a file to the hashing threads, with no data if it failed */
+static void ph_uring_finish(Pipeline *p, UringRead *rd, bool ok, std::vector<int> &free_slots) {
+    if (rd->fd >= 0)
+        close(rd->fd);
+    if (ok) {
+        rd->item.file.size = rd->item.reserved;
+    } else {
+        if (rd->item.slot >= 0)
+            free_slots.push_back(rd->item.slot);
+        else
+            free((void *)rd->item.file.data);
+        rd->item.slot = -1;
+        rd->item.file.data = NULL;
+        rd->item.file.size = 0;
+    }
+    ph_pipeline_push(p->ring, rd->item);
+}
+
+/* one thread keeps depth files in flight: the opens of the next files are
+ * submitted together, each completed open submits its file's read into a
+ * registered buffer, and each completed read goes to the hashing threads */
+static void ph_uring_reader(Pipeline *p, UringReader *u) {
+    std::vector<UringRead> reads(p->depth);
+    std::vector<int> free_reads, free_slots;
+    for (int i = p->depth - 1; i >= 0; i--) {
+        free_reads.push_back(i);
+        if (u->buffers)
+            free_slots.push_back(i);
+    }
+
+    // a file taken from the source waits here for a place among those read ahead
+    PipelineItem held;
+    bool holding = false;
+    int inflight = 0, spins = 0;
+    while (inflight > 0 || holding || !p->exhausted.load()) {
+        PipelineItem back;
+        while (ph_ring_pop(p->returned, back))
+            free_slots.push_back(back.slot);
+
+        while (!free_reads.empty()) {
+            if (!holding) {
+                if (!ph_pipeline_take(p, held))
+                    break;
+                held.reserved = ph_pipeline_file_size(held.name);
+                holding = true;
+            }
+            const size_t size = held.reserved;
+            const bool small = u->buffers && size > 0 && size <= u->slot_size;
+            if ((small && free_slots.empty()) || !ph_pipeline_try_reserve(p, size))
+                break;
+            holding = false;
+
+            UringRead *rd = &reads[free_reads.back()];
+            free_reads.pop_back();
+            rd->item = held;
+            rd->item.file.size = 0;
+            rd->item.file.mapped = 0;
+            rd->fd = -1;
+            rd->done = 0;
+            if (small) {
+                rd->item.slot = free_slots.back();
+                free_slots.pop_back();
+                rd->item.file.data = u->buffers + (size_t)rd->item.slot * u->slot_size;
+            } else {
+                rd->item.file.data = size > 0 ? (const uint8_t *)malloc(size) : NULL;
+            }
+            struct io_uring_sqe *sqe = io_uring_get_sqe(&u->ring);
+            io_uring_prep_openat(sqe, AT_FDCWD, rd->item.name, O_RDONLY, 0);
+            io_uring_sqe_set_data(sqe, rd);
+            inflight++;
+        }
+        if (inflight == 0) {
+            // all read ahead, wait for the hashing threads
+            ph_pipeline_backoff(spins);
+            continue;
+        }
+        spins = 0;
+
+        io_uring_submit_and_wait(&u->ring, 1);
+        struct io_uring_cqe *cqe;
+        unsigned head, seen = 0;
+        io_uring_for_each_cqe(&u->ring, head, cqe) {
+            UringRead *rd = (UringRead *)io_uring_cqe_get_data(cqe);
+            const int res = cqe->res;
+            seen++;
+            if (rd->fd < 0) {
+                if (res >= 0)
+                    rd->fd = res;
+                if (res >= 0 && rd->item.file.data) {
+                    ph_uring_submit_read(*u, rd);
+                    continue;
+                }
+            } else if (res > 0) {
+                rd->done += (size_t)res;
+                if (rd->done < rd->item.reserved) {
+                    ph_uring_submit_read(*u, rd);
+                    continue;
+                }
+            }
+            ph_uring_finish(p, rd, rd->item.file.data && rd->done == rd->item.reserved, free_slots);
+            free_reads.push_back((int)(rd - reads.data()));
+            inflight--;
+        }
+        io_uring_cq_advance(&u->ring, seen);
+    }
+}
+#endif
+
+static void ph_pipeline_hasher(Pipeline *p) {
+    int spins = 0;
+    PipelineItem item;
+    for (;;) {
+        if (!ph_ring_pop(p->ring, item)) {
+            // taken is final once exhausted, so nothing is left on the way
+            if (p->exhausted.load() && p->popped.load() == p->taken.load())
+                break;
+            ph_pipeline_backoff(spins);
+            continue;
+        }
+        spins = 0;
+        p->popped++;
+        if (p->hash(p->arg, item.index, item.name, item.file.data, item.file.size))
+            p->stop = true;
+        ph_pipeline_release(p, item);
+        if (item.slot >= 0)
+            ph_pipeline_push(p->returned, item);
+        else
+            ph_unmap_file(item.file);
+        p->pending_bytes -= item.reserved;
+        p->pending--;
+    }
+}
+
+/* start the readers and hash on the pool until the files run out */
+static void ph_pipeline_start(Pipeline &p, const PipelineOptions *opts, int workers, int readers,
+                              ph_pipeline_hashCB hash, void *arg) {
+    p.depth = opts->depth > 0 ? opts->depth : PIPELINE_DEPTH * workers;
+    p.max_bytes = opts->max_bytes > 0 ? opts->max_bytes : PIPELINE_MAX_BYTES;
+    p.hash = hash;
+    p.arg = arg;
+    p.taken = 0;
+    p.exhausted = false;
+    p.stop = false;
+    p.popped = 0;
+    p.pending = 0;
+    p.pending_bytes = 0;
+
+    // readers only wait on I/O, they get threads of their own
+    std::vector<std::thread> thds;
+#ifdef HAVE_LIBURING
+    UringReader u;
+    bool uring = false;
+    if (opts->backend != PH_READ_PREAD) {
+        p.depth = std::min(p.depth, PIPELINE_URING_ENTRIES);
+        uring = ph_uring_init(u, p.depth, p.max_bytes);
+    }
+#else
+    const bool uring = false;
+#endif
+    ph_ring_init(p.ring, (size_t)p.depth);
+    ph_ring_init(p.returned, (size_t)p.depth);
+#ifdef HAVE_LIBURING
+    if (uring)
+        thds.emplace_back(ph_uring_reader, &p, &u);
+#endif
+    for (int n = 0; !uring && n < readers; n++)
+        thds.emplace_back(ph_pipeline_reader, &p);
+
+    ph_parallel_for(workers, workers, [&](int) { ph_pipeline_hasher(&p); });
+    for (std::thread &t : thds)
+        t.join();
+#ifdef HAVE_LIBURING
+    if (uring) {
+        io_uring_queue_exit(&u.ring);
+        free(u.buffers);
+    }
+#endif
+}
+
+static const PipelineOptions ph_pipeline_defaults = {0, 0, 0, 0, PH_READ_AUTO};
+
+void ph_pipeline_run(char *const files[], int count, const PipelineOptions *opts, ph_pipeline_hashCB hash,
+                     void *arg) {
+    if (!files || count <= 0 || !hash)
+        return;
+
+    if (!opts)
+        opts = &ph_pipeline_defaults;
+    int workers = opts->workers > 0 ? opts->workers : ph_pool_size();
+    if (workers > count)
+        workers = count;
+    int readers = opts->readers > 0 ? opts->readers : PIPELINE_READERS;
+    if (readers > count)
+        readers = count;
+
+    Pipeline p;
+    p.files = files;
+    p.count = count;
+    p.next = NULL;
+    p.next_arg = NULL;
+    ph_pipeline_start(p, opts, workers, readers, hash, arg);
+}
+
+void ph_pipeline_stream(ph_pipeline_nextCB next, void *next_arg, const PipelineOptions *opts,
+                        ph_pipeline_hashCB hash, void *arg) {
+    if (!next || !hash)
+        return;
+
+    if (!opts)
+        opts = &ph_pipeline_defaults;
+    const int workers = opts->workers > 0 ? opts->workers : ph_pool_size();
+    const int readers = opts->readers > 0 ? opts->readers : PIPELINE_READERS;
+
+    Pipeline p;
+    p.files = NULL;
+    p.count = 0;
+    p.next = next;
+    p.next_arg = next_arg;
+    ph_pipeline_start(p, opts, workers, readers, hash, arg);
+}
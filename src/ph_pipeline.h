@@ -0,0 +1,63 @@
+/*
+
+    pHash, the open source perceptual hash library
+    Copyright (C) 2009 Aetilius, Inc.
+    All rights reserved.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Evan Klinger - eklinger@phash.org
+    D Grant Starkweather - dstarkweather@phash.org
+
+*/
+
+
+#ifndef _PH_PIPELINE_H
+#define _PH_PIPELINE_H
+
+#include "pHash.h"
+
+/* hash stage of a pipeline: item index from the bytes of its file, data is
+ * NULL when the file could not be read; return non zero to stop reading
+ * further files, those already read ahead are still handed over */
+typedef int (*ph_pipeline_hashCB)(void *arg, int64_t index, const char *file, const uint8_t *data, size_t len);
+
+/* source of a streamed pipeline: next file name, NULL when there are no more;
+ * called by one reader at a time, the name is copied before the next call */
+typedef const char *(*ph_pipeline_nextCB)(void *arg);
+
+/* /brief read the files ahead on reader threads and hash them on the pool
+ *  Readers hand each file's bytes to the hashing threads over a bounded
+ *  lock-free ring; they stop reading ahead when opts->depth files or
+ *  opts->max_bytes bytes wait to be hashed, so a slow disk or network
+ *  share keeps the hashing threads busy without buffering the batch.
+ *  /param files - names of the files
+ *  /param count - number of files
+ *  /param opts  - PipelineOptions, NULL for the defaults
+ *  /param hash  - hash stage, called once for every file
+ *  /param arg   - passed to hash
+ */
+void ph_pipeline_run(char *const files[], int count, const PipelineOptions *opts, ph_pipeline_hashCB hash,
+                     void *arg);
+
+/* /brief ph_pipeline_run over files taken from a source as the readers need
+ *  them, with index counting from 0 in the order next returns them; only the
+ *  files read ahead are held, so the batch may have any number of files
+ *  /param next     - source of the file names
+ *  /param next_arg - passed to next
+ */
+void ph_pipeline_stream(ph_pipeline_nextCB next, void *next_arg, const PipelineOptions *opts,
+                        ph_pipeline_hashCB hash, void *arg);
+
+#endif /* _PH_PIPELINE_H */
@@ -0,0 +1,259 @@
+/*
+
+    pHash, the open source perceptual hash library
+    Copyright (C) 2009 Aetilius, Inc.
+    All rights reserved.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Evan Klinger - eklinger@phash.org
+    D Grant Starkweather - dstarkweather@phash.org
+
+*/
+
+
+
+#include "ph_pool.h"
+
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* indexes left to one thread of a job; the owner takes them from the front,
+ * the others steal from the back */
+typedef struct ph_pool_range {
+    std::mutex lock;
+    int begin;
+    int end;
+} PoolRange;
+
+typedef struct ph_pool_job {
+    ph_taskCB task;
+    void *arg;
+    std::unique_ptr<PoolRange[]> ranges;
+    int nranges;
+    int next_range; /* range of the next thread to join, under the pool lock */
+    int active;     /* pool threads in the job, under the pool lock */
+    std::condition_variable finished;
+} PoolJob;
+
+typedef struct ph_pool {
+    std::mutex lock;
+    std::condition_variable wake;
+    std::list<PoolJob *> jobs;
+    std::vector<std::thread> workers;
+    bool stop;
+    ~ph_pool();
+} Pool;
+
+static thread_local bool ph_pool_inside = false;
+
+/* take the next index of range r, stealing when it is empty;
+ * returns -1 when no range has any left */
+static int ph_pool_next(PoolJob *job, int r) {
+    PoolRange &own = job->ranges[r];
+    {
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (own.begin < own.end)
+            return own.begin++;
+    }
+    for (;;) {
+        int victim = -1, most = 0;
+        for (int i = 0; i < job->nranges; i++) {
+            std::lock_guard<std::mutex> guard(job->ranges[i].lock);
+            const int left = job->ranges[i].end - job->ranges[i].begin;
+            if (left > most) {
+                most = left;
+                victim = i;
+            }
+        }
+        if (victim < 0)
+            return -1;
+
+        int begin, end;
+        {
+            std::lock_guard<std::mutex> guard(job->ranges[victim].lock);
+            PoolRange &v = job->ranges[victim];
+            const int left = v.end - v.begin;
+            if (left <= 0)
+                continue;
+            end = v.end;
+            begin = v.end - (left + 1) / 2;
+            v.end = begin;
+        }
+        std::lock_guard<std::mutex> guard(own.lock);
+        own.begin = begin + 1;
+        own.end = end;
+        return begin;
+    }
+}
+
+static void ph_pool_work(PoolJob *job, int r) {
+    for (int i = ph_pool_next(job, r); i >= 0; i = ph_pool_next(job, r))
+        job->task(job->arg, i);
+}
+
+static void ph_pool_worker(Pool *pool) {
+    ph_pool_inside = true;
+    std::unique_lock<std::mutex> lk(pool->lock);
+    for (;;) {
+        PoolJob *job = nullptr;
+        pool->wake.wait(lk, [&]() {
+            for (PoolJob *j : pool->jobs) {
+                if (j->next_range < j->nranges) {
+                    job = j;
+                    return true;
+                }
+            }
+            return pool->stop;
+        });
+        if (!job)
+            return;
+
+        const int r = job->next_range++;
+        job->active++;
+        lk.unlock();
+        ph_pool_work(job, r);
+        lk.lock();
+        if (--job->active == 0)
+            job->finished.notify_all();
+    }
+}
+
+ph_pool::~ph_pool() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stop = true;
+    }
+    wake.notify_all();
+    for (std::thread &t : workers)
+        t.join();
+}
+
+/* the calling thread works too, so a pool of n threads has n - 1 workers */
+static std::shared_ptr<Pool> ph_pool_create(int threads) {
+    if (threads <= 0)
+        threads = std::thread::hardware_concurrency();
+    std::shared_ptr<Pool> pool = std::make_shared<Pool>();
+    pool->stop = false;
+    for (int i = 1; i < threads; i++)
+        pool->workers.emplace_back(ph_pool_worker, pool.get());
+    return pool;
+}
+
+static std::mutex ph_pool_lock;
+static ph_executorCB ph_pool_executor = nullptr;
+static void *ph_pool_executor_ctx = nullptr;
+
+/* never freed: joining threads while a dll unloads can hang */
+static std::shared_ptr<Pool> &ph_pool_current() {
+    static std::shared_ptr<Pool> *pool = new std::shared_ptr<Pool>();
+    return *pool;
+}
+
+int ph_set_threads(int threads) {
+    if (threads < 0)
+        return -1;
+    std::shared_ptr<Pool> pool = ph_pool_create(threads);
+    std::lock_guard<std::mutex> guard(ph_pool_lock);
+    // running batches keep the old pool until they finish
+    ph_pool_current().swap(pool);
+    return 0;
+}
+
+void ph_set_executor(ph_executorCB exec, void *ctx) {
+    std::lock_guard<std::mutex> guard(ph_pool_lock);
+    ph_pool_executor = exec;
+    ph_pool_executor_ctx = ctx;
+}
+
+static std::shared_ptr<Pool> ph_pool_get() {
+    std::lock_guard<std::mutex> guard(ph_pool_lock);
+    if (!ph_pool_current())
+        ph_pool_current() = ph_pool_create(0);
+    return ph_pool_current();
+}
+
+int ph_pool_size() {
+    return (int)ph_pool_get()->workers.size() + 1;
+}
+
+void ph_parallel_for(ph_taskCB task, void *arg, int count, int threads) {
+    if (count <= 0)
+        return;
+
+    std::shared_ptr<Pool> pool;
+    ph_executorCB exec;
+    void *exec_ctx;
+    {
+        std::lock_guard<std::mutex> guard(ph_pool_lock);
+        exec = ph_pool_executor;
+        exec_ctx = ph_pool_executor_ctx;
+    }
+    if (exec) {
+        exec(task, arg, count, threads, exec_ctx);
+        return;
+    }
+    if (!ph_pool_inside)
+        pool = ph_pool_get();
+
+    int num_threads = pool ? (int)pool->workers.size() + 1 : 1;
+    if (threads > 0 && threads < num_threads)
+        num_threads = threads;
+    if (num_threads > count)
+        num_threads = count;
+    if (num_threads <= 1) {
+        for (int i = 0; i < count; i++)
+            task(arg, i);
+        return;
+    }
+
+    PoolJob job;
+    job.task = task;
+    job.arg = arg;
+    job.ranges.reset(new PoolRange[num_threads]);
+    job.nranges = num_threads;
+    job.next_range = 1;
+    job.active = 0;
+    int rem = count % num_threads;
+    int start = 0;
+    for (int n = 0; n < num_threads; ++n) {
+        int off = count / num_threads;
+        if (rem > 0) {
+            off += 1;
+            --rem;
+        }
+        job.ranges[n].begin = start;
+        job.ranges[n].end = start + off;
+        start += off;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(pool->lock);
+        pool->jobs.push_back(&job);
+    }
+    pool->wake.notify_all();
+
+    ph_pool_inside = true;
+    ph_pool_work(&job, 0);
+    ph_pool_inside = false;
+
+    // every index has been taken, wait for those still running
+    std::unique_lock<std::mutex> lk(pool->lock);
+    pool->jobs.remove(&job);
+    job.finished.wait(lk, [&]() { return job.active == 0; });
+}
@@ -0,0 +1,56 @@
+/*
+
+    pHash, the open source perceptual hash library
+    Copyright (C) 2009 Aetilius, Inc.
+    All rights reserved.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Evan Klinger - eklinger@phash.org
+    D Grant Starkweather - dstarkweather@phash.org
+
+*/
+
+
+#ifndef _PH_POOL_H
+#define _PH_POOL_H
+
+#include "pHash.h"
+
+/* /brief run task(arg, i) for every i in [0, count) and return when all ran
+ *  Runs on the executor set with ph_set_executor, or else on the library
+ *  pool: the indexes start split in contiguous ranges over the threads and
+ *  a thread that runs out steals half of the largest range left, so one
+ *  slow item never holds back the rest. Calls from inside a task run inline.
+ *  /param threads - at most this many threads, 0 for all of the pool
+ */
+void ph_parallel_for(ph_taskCB task, void *arg, int count, int threads);
+
+/* /brief threads ph_parallel_for runs on, the caller's included
+ */
+int ph_pool_size();
+
+template <typename Fn>
+static void ph_parallel_for_task(void *arg, int index) {
+    (*(Fn *)arg)(index);
+}
+
+/* /brief ph_parallel_for on a callable taking the index
+ */
+template <typename Fn>
+static inline void ph_parallel_for(int count, int threads, Fn fn) {
+    ph_parallel_for(ph_parallel_for_task<Fn>, &fn, count, threads);
+}
+
+#endif /* _PH_POOL_H */
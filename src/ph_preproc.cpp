@@ -0,0 +1,286 @@
+/*
+
+    pHash, the open source perceptual hash library
+    Copyright (C) 2009 Aetilius, Inc.
+    All rights reserved.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Evan Klinger - eklinger@phash.org
+    D Grant Starkweather - dstarkweather@phash.org
+
+*/
+
+
+#include "ph_preproc.h"
+
+#include <string.h>
+
+#include <vector>
+
+#define PREPROC_SIZE   32
+#define PREPROC_RADIUS 3 /* 7x7 box */
+#define PREPROC_RING   8 /* rows y-3..y+4 of the box filter window */
+
+static void ph_read_row_gray(const LumaSource *src, int y, uint8_t *luma) {
+    const CImg<uint8_t> &img = *(const CImg<uint8_t> *)src->data;
+    memcpy(luma, img.data(0, y, 0, 0), src->width);
+}
+
+static void ph_read_row_rgb(const LumaSource *src, int y, uint8_t *luma) {
+    const CImg<uint8_t> &img = *(const CImg<uint8_t> *)src->data;
+    const uint8_t *r = img.data(0, y, 0, 0);
+    const uint8_t *g = img.data(0, y, 0, 1);
+    const uint8_t *b = img.data(0, y, 0, 2);
+    for (int x = 0; x < src->width; x++) {
+        luma[x] = (uint8_t)(((66 * r[x] + 129 * g[x] + 25 * b[x] + 128) >> 8) + 16);
+    }
+}
+
+void ph_luma_source_cimg(const CImg<uint8_t> &img, LumaSource &src) {
+    src.width = img.width();
+    src.height = img.height();
+    src.read_row = (img.spectrum() >= 3) ? ph_read_row_rgb : ph_read_row_gray;
+    src.data = &img;
+}
+
+static int ph_view_bytes_per_pixel(PixelFormat format) {
+    switch (format) {
+        case PH_PIXEL_GRAY8:
+        case PH_PIXEL_NV12:
+        case PH_PIXEL_I420:
+            return 1;
+        case PH_PIXEL_RGB24:
+            return 3;
+        case PH_PIXEL_RGBA32:
+        case PH_PIXEL_BGRA32:
+            return 4;
+        default:
+            return 0;
+    }
+}
+
+static const uint8_t *ph_view_row(const ImageView &view, int y) {
+    const int bpp = ph_view_bytes_per_pixel(view.format);
+    const size_t stride = view.stride ? (size_t)view.stride : (size_t)view.width * bpp;
+    return view.data + stride * y;
+}
+
+static void ph_read_view_gray(const LumaSource *src, int y, uint8_t *luma) {
+    memcpy(luma, ph_view_row(*(const ImageView *)src->data, y), src->width);
+}
+
+/* r, g and b at byte offsets ro, go and bo of each bpp sized pixel */
+static inline void ph_read_view_color(const LumaSource *src, int y, uint8_t *luma, int bpp, int ro, int go,
+                                      int bo) {
+    const uint8_t *p = ph_view_row(*(const ImageView *)src->data, y);
+    for (int x = 0; x < src->width; x++, p += bpp) {
+        luma[x] = (uint8_t)(((66 * p[ro] + 129 * p[go] + 25 * p[bo] + 128) >> 8) + 16);
+    }
+}
+
+static void ph_read_view_rgb24(const LumaSource *src, int y, uint8_t *luma) {
+    ph_read_view_color(src, y, luma, 3, 0, 1, 2);
+}
+
+static void ph_read_view_rgba32(const LumaSource *src, int y, uint8_t *luma) {
+    ph_read_view_color(src, y, luma, 4, 0, 1, 2);
+}
+
+static void ph_read_view_bgra32(const LumaSource *src, int y, uint8_t *luma) {
+    ph_read_view_color(src, y, luma, 4, 2, 1, 0);
+}
+
+int ph_luma_source_view(const ImageView &view, LumaSource &src) {
+    const int bpp = ph_view_bytes_per_pixel(view.format);
+    if (!view.data || view.width <= 0 || view.height <= 0 || bpp == 0)
+        return -1;
+    if (view.stride != 0 && view.stride < view.width * bpp)
+        return -1;
+
+    src.width = view.width;
+    src.height = view.height;
+    src.data = &view;
+    switch (view.format) {
+        case PH_PIXEL_RGB24:
+            src.read_row = ph_read_view_rgb24;
+            break;
+        case PH_PIXEL_RGBA32:
+            src.read_row = ph_read_view_rgba32;
+            break;
+        case PH_PIXEL_BGRA32:
+            src.read_row = ph_read_view_bgra32;
+            break;
+        default:
+            src.read_row = ph_read_view_gray;
+            break;
+    }
+    return 0;
+}
+
+int ph_luma_plane_view(const ImageView &view, CImg<uint8_t> &plane) {
+    LumaSource src;
+    if (ph_luma_source_view(view, src) < 0)
+        return -1;
+
+    if (src.read_row == ph_read_view_gray && (view.stride == 0 || view.stride == view.width)) {
+        plane.assign(view.data, view.width, view.height, 1, 1, true);
+        return 0;
+    }
+
+    plane.assign(view.width, view.height, 1, 1);
+    for (int y = 0; y < view.height; y++) {
+        src.read_row(&src, y, plane.data(0, y));
+    }
+    return 0;
+}
+
+/* one source pixel's share of an output cell */
+struct ph_resample_tap {
+    int cell;
+    float weight;
+};
+
+/* taps[first[i] .. first[i + 1]) are the cells fed by source pixel i.
+ * Area: the weight is the overlap measured in output pixels, so every output
+ * cell receives weights summing to 1 whether the axis shrinks or grows.
+ * Nearest: cell c takes pixel c * n / 32, like CImg's resize(), weight 1. */
+static void ph_resample_taps(int n, int area, std::vector<ph_resample_tap> &taps, std::vector<int> &first) {
+    taps.clear();
+    first.resize(n + 1);
+    if (!area) {
+        int cell = 0;
+        for (int i = 0; i < n; i++) {
+            first[i] = (int)taps.size();
+            for (; cell < PREPROC_SIZE && (int)((long long)cell * n / PREPROC_SIZE) == i; cell++) {
+                ph_resample_tap tap = {cell, 1.0f};
+                taps.push_back(tap);
+            }
+        }
+        first[n] = (int)taps.size();
+        return;
+    }
+    const double scale = (double)PREPROC_SIZE / n;
+    for (int i = 0; i < n; i++) {
+        first[i] = (int)taps.size();
+        const double lo = i * scale;
+        const double hi = (i + 1) * scale;
+        for (int cell = (int)lo; cell < PREPROC_SIZE && cell < hi; cell++) {
+            const double a = (lo > cell) ? lo : cell;
+            const double b = (hi < cell + 1) ? hi : cell + 1;
+            if (b > a) {
+                ph_resample_tap tap = {cell, (float)(b - a)};
+                taps.push_back(tap);
+            }
+        }
+    }
+    first[n] = (int)taps.size();
+}
+
+/* luma row r filtered by the horizontal 7 tap box into hrow */
+static void ph_box_row(const LumaSource &src, int r, uint8_t *padded, int *hrow) {
+    const int width = src.width;
+    uint8_t *luma = padded + PREPROC_RADIUS;
+    src.read_row(&src, r, luma);
+    for (int i = 1; i <= PREPROC_RADIUS; i++) {
+        luma[-i] = luma[0];
+        luma[width - 1 + i] = luma[width - 1];
+    }
+    int sum = 0;
+    for (int i = 0; i < 2 * PREPROC_RADIUS + 1; i++) {
+        sum += padded[i];
+    }
+    hrow[0] = sum;
+    for (int x = 1; x < width; x++) {
+        sum += padded[x + 2 * PREPROC_RADIUS] - padded[x - 1];
+        hrow[x] = sum;
+    }
+}
+
+/* add one filtered row to the output cells it feeds */
+static void ph_resample_row(const int *vsum, int width, const std::vector<ph_resample_tap> &xtaps,
+                            const std::vector<int> &xfirst, const ph_resample_tap *ytaps, int nytaps, float *out) {
+    float rowacc[PREPROC_SIZE];
+    for (int c = 0; c < PREPROC_SIZE; c++) {
+        rowacc[c] = 0.0f;
+    }
+    for (int x = 0; x < width; x++) {
+        const float v = (float)vsum[x];
+        for (int t = xfirst[x]; t < xfirst[x + 1]; t++) {
+            rowacc[xtaps[t].cell] += xtaps[t].weight * v;
+        }
+    }
+    for (int t = 0; t < nytaps; t++) {
+        float *cells = out + ytaps[t].cell * PREPROC_SIZE;
+        const float w = ytaps[t].weight;
+        for (int c = 0; c < PREPROC_SIZE; c++) {
+            cells[c] += w * rowacc[c];
+        }
+    }
+}
+
+int ph_dct_preprocess_fused(const LumaSource &src, float *out, int area) {
+    const int width = src.width;
+    const int height = src.height;
+    if (width <= 0 || height <= 0 || !src.read_row || !out)
+        return -1;
+
+    std::vector<ph_resample_tap> xtaps, ytaps;
+    std::vector<int> xfirst, yfirst;
+    ph_resample_taps(width, area, xtaps, xfirst);
+    ph_resample_taps(height, area, ytaps, yfirst);
+
+    std::vector<uint8_t> padded(width + 2 * PREPROC_RADIUS);
+    std::vector<int> ring((size_t)PREPROC_RING * width);
+    std::vector<int> vsum(width, 0);
+
+    memset(out, 0, PREPROC_SIZE * PREPROC_SIZE * sizeof(float));
+
+    /* window of row 0 is rows clamp(-3..3) */
+    for (int r = 0; r <= PREPROC_RADIUS && r < height; r++) {
+        ph_box_row(src, r, padded.data(), &ring[(size_t)r * width]);
+    }
+    for (int d = -PREPROC_RADIUS; d <= PREPROC_RADIUS; d++) {
+        const int r = (d < 0) ? 0 : ((d < height) ? d : height - 1);
+        const int *hrow = &ring[(size_t)(r % PREPROC_RING) * width];
+        for (int x = 0; x < width; x++) {
+            vsum[x] += hrow[x];
+        }
+    }
+
+    for (int y = 0; y < height; y++) {
+        if (yfirst[y] != yfirst[y + 1]) {
+            ph_resample_row(vsum.data(), width, xtaps, xfirst, &ytaps[yfirst[y]], yfirst[y + 1] - yfirst[y], out);
+        }
+
+        if (y + 1 == height)
+            break;
+
+        /* slide the window: drop row clamp(y - 3), add row clamp(y + 4) */
+        const int leaving = (y - PREPROC_RADIUS < 0) ? 0 : y - PREPROC_RADIUS;
+        int entering = y + PREPROC_RADIUS + 1;
+        if (entering < height) {
+            ph_box_row(src, entering, padded.data(), &ring[(size_t)(entering % PREPROC_RING) * width]);
+        } else {
+            entering = height - 1;
+        }
+        const int *hout = &ring[(size_t)(leaving % PREPROC_RING) * width];
+        const int *hin = &ring[(size_t)(entering % PREPROC_RING) * width];
+        for (int x = 0; x < width; x++) {
+            vsum[x] += hin[x] - hout[x];
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,80 @@
+/*
+
+    pHash, the open source perceptual hash library
+    Copyright (C) 2009 Aetilius, Inc.
+    All rights reserved.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Evan Klinger - eklinger@phash.org
+    D Grant Starkweather - dstarkweather@phash.org
+
+*/
+
+
+#ifndef _PH_PREPROC_H
+#define _PH_PREPROC_H
+
+#include <stdint.h>
+
+#include "pHash.h"
+
+/* /brief source of 8 bit luma rows
+ *  Lets the streaming preprocessing stages read an image one row at a time,
+ *  whatever the pixel layout of the underlying buffer is.
+ */
+typedef struct ph_luma_source {
+    int width;
+    int height;
+    /* write the luma of row y (0 <= y < height) to luma[0..width-1] */
+    void (*read_row)(const struct ph_luma_source *src, int y, uint8_t *luma);
+    const void *data;
+} LumaSource;
+
+/* /brief luma source reading a planar CImg
+ *  Gray images use channel 0, rgb(a) images are converted with the same
+ *  integer Y formula as CImg's RGBtoYCbCr().
+ *  /param img - source image, must outlive the LumaSource
+ *  /param src - (out) LumaSource
+ */
+void ph_luma_source_cimg(const CImg<uint8_t> &img, LumaSource &src);
+
+/* /brief luma source reading a caller owned buffer in place
+ *  /param view - ImageView, must outlive the LumaSource
+ *  /param src  - (out) LumaSource
+ *  /return int value - less than 0 for an invalid view
+ */
+int ph_luma_source_view(const ImageView &view, LumaSource &src);
+
+/* /brief single luma plane of a view
+ *  Gray, NV12 and I420 views with packed rows are shared, not copied, so the
+ *  plane must be treated as read only.
+ *  /param view  - ImageView
+ *  /param plane - (out) width x height x 1 x 1 luma
+ *  /return int value - less than 0 for an invalid view
+ */
+int ph_luma_plane_view(const ImageView &view, CImg<uint8_t> &plane);
+
+/* /brief fused dct hash preprocessing
+ *  Luma conversion, 7x7 box filter (clamped borders) and resampling to 32x32
+ *  in one pass over the source rows. Only 8 filtered rows and a few width
+ *  sized buffers are held at any time.
+ *  /param src  - LumaSource of the image
+ *  /param out  - (out) 32x32 floats, row major
+ *  /param area - 1 for area resampling, 0 for CImg's nearest neighbour sampling
+ *  /return int value - less than 0 for error
+ */
+int ph_dct_preprocess_fused(const LumaSource &src, float *out, int area);
+
+#endif /* _PH_PREPROC_H */
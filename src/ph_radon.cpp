@@ -0,0 +1,246 @@
+/*
+
+    pHash, the open source perceptual hash library
+    Copyright (C) 2009 Aetilius, Inc.
+    All rights reserved.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Evan Klinger - eklinger@phash.org
+    D Grant Starkweather - dstarkweather@phash.org
+
+*/
+
+
+#include "ph_radon.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <mutex>
+
+#define RADON_CACHE_SIZE 8
+
+static void ph_radon_geometry_free(RadonGeometry *geom) {
+    if (!geom)
+        return;
+    free(geom->line_start);
+    free(geom->offsets);
+    free(geom->nb_pix_perline);
+    delete geom;
+}
+
+/* walks the lines exactly like ph_radon_projections, recording which pixel
+ * ends up in each cell of the projection map */
+static RadonGeometry *ph_radon_geometry_build(int width, int height, int N) {
+    const int D = (width > height) ? width : height;
+    float x_center = (float)width / 2;
+    float y_center = (float)height / 2;
+    int x_off = std::round(x_center);
+    int y_off = std::round(y_center);
+
+    RadonGeometry *geom = new RadonGeometry;
+    geom->width = width;
+    geom->height = height;
+    geom->N = N;
+    geom->line_start = (int *)malloc((N + 1) * sizeof(int));
+    geom->offsets = NULL;
+    geom->nb_pix_perline = (int *)calloc(N, sizeof(int));
+    int *cells = (int *)malloc((size_t)N * D * sizeof(int));
+    if (!geom->line_start || !geom->nb_pix_perline || !cells) {
+        free(cells);
+        ph_radon_geometry_free(geom);
+        return NULL;
+    }
+    for (size_t i = 0; i < (size_t)N * D; i++)
+        cells[i] = -1;
+
+    int *nb_per_line = geom->nb_pix_perline;
+    double factorPi = cimg::PI / 180.0;
+
+    for (int k = 0; k < N / 4 + 1; k++) {
+        double theta = k * factorPi;
+        double alpha = std::tan(theta);
+        for (int x = 0; x < D; x++) {
+            double y = alpha * (x - x_off);
+            int yd = std::round(y);
+            if ((yd + y_off >= 0) && (yd + y_off < height) && (x < width)) {
+                cells[k * D + x] = (yd + y_off) * width + x;
+                nb_per_line[k] += 1;
+            }
+            if ((yd + x_off >= 0) && (yd + x_off < width) && (k != N / 4) && (x < height)) {
+                cells[(N / 2 - k) * D + x] = x * width + yd + x_off;
+                nb_per_line[N / 2 - k] += 1;
+            }
+        }
+    }
+    int j = 0;
+    for (int k = 3 * N / 4; k < N; k++) {
+        double theta = k * factorPi;
+        double alpha = std::tan(theta);
+        for (int x = 0; x < D; x++) {
+            double y = alpha * (x - x_off);
+            int yd = std::round(y);
+            if ((yd + y_off >= 0) && (yd + y_off < height) && (x < width)) {
+                cells[k * D + x] = (yd + y_off) * width + x;
+                nb_per_line[k] += 1;
+            }
+            if ((y_off - yd >= 0) && (y_off - yd < width) && (2 * y_off - x >= 0) && (2 * y_off - x < height) &&
+                (k != 3 * N / 4)) {
+                cells[(k - j) * D + x] = (-(x - y_off) + y_off) * width + (-yd + y_off);
+                nb_per_line[k - j] += 1;
+            }
+        }
+        j += 2;
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < (size_t)N * D; i++)
+        count += (cells[i] >= 0);
+    geom->offsets = (int *)malloc((count ? count : 1) * sizeof(int));
+    if (!geom->offsets) {
+        free(cells);
+        ph_radon_geometry_free(geom);
+        return NULL;
+    }
+    int n = 0;
+    for (int k = 0; k < N; k++) {
+        geom->line_start[k] = n;
+        const int *line = cells + (size_t)k * D;
+        for (int x = 0; x < D; x++) {
+            if (line[x] >= 0)
+                geom->offsets[n++] = line[x];
+        }
+    }
+    geom->line_start[N] = n;
+
+    free(cells);
+    return geom;
+}
+
+std::shared_ptr<const RadonGeometry> ph_radon_geometry(int width, int height, int N) {
+    static std::mutex mutex;
+    static std::shared_ptr<const RadonGeometry> cache[RADON_CACHE_SIZE]; /* most recent first */
+
+    if (width <= 0 || height <= 0 || N <= 0)
+        return NULL;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int i = 0; i < RADON_CACHE_SIZE && cache[i]; i++) {
+            if (cache[i]->width == width && cache[i]->height == height && cache[i]->N == N) {
+                std::shared_ptr<const RadonGeometry> geom = cache[i];
+                for (; i > 0; i--)
+                    cache[i] = cache[i - 1];
+                cache[0] = geom;
+                return geom;
+            }
+        }
+    }
+
+    /* built outside the lock, two threads may race to build the same size */
+    RadonGeometry *built = ph_radon_geometry_build(width, height, N);
+    if (!built)
+        return NULL;
+    std::shared_ptr<const RadonGeometry> geom(built, ph_radon_geometry_free);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (int i = RADON_CACHE_SIZE - 1; i > 0; i--)
+        cache[i] = cache[i - 1];
+    cache[0] = geom;
+    return geom;
+}
+
+void ph_feature_normalize(double *features, int N) {
+    double sum = 0.0;
+    double sum_sqd = 0.0;
+    for (int k = 0; k < N; ++k) {
+        sum += features[k];
+        sum_sqd += features[k] * features[k];
+    }
+    const double mean = sum / N;
+    const double var = 1.0 / sqrt((sum_sqd / N) - mean * mean);
+
+    for (int i = 0; i < N; ++i) {
+        features[i] = (features[i] - mean) * var;
+    }
+}
+
+int ph_radon_features(const CImg<uint8_t> &img, int N, Features &fv) {
+    std::shared_ptr<const RadonGeometry> geom = ph_radon_geometry(img.width(), img.height(), N);
+    if (!geom)
+        return -1;
+
+    fv.features = (double *)malloc(N * sizeof(double));
+    fv.size = N;
+    if (!fv.features)
+        return -1;
+
+    const uint8_t *pixels = img.data();
+    const int *offsets = geom->offsets;
+    for (int k = 0; k < N; ++k) {
+        const int nb_pixels = geom->nb_pix_perline[k];
+        if (nb_pixels == 0) {
+            fv.features[k] = 0.0;
+            continue;
+        }
+        /* integer sums are exact, so they equal the double sums over the map */
+        uint64_t line_sum = 0;
+        uint64_t line_sum_sqd = 0;
+        for (int i = geom->line_start[k]; i < geom->line_start[k + 1]; i++) {
+            const uint32_t pixel_value = pixels[offsets[i]];
+            line_sum += pixel_value;
+            line_sum_sqd += pixel_value * pixel_value;
+        }
+        const double nb_pixels_inv = 1.0 / nb_pixels;
+        const double mean = (double)line_sum * nb_pixels_inv;
+        fv.features[k] = (double)line_sum_sqd * nb_pixels_inv - mean * mean;
+    }
+    ph_feature_normalize(fv.features, N);
+
+    return 0;
+}
+
+static void ph_radon_dct_table_free(const double *table) { free((void *)table); }
+
+std::shared_ptr<const double> ph_radon_dct_table(int N) {
+    static std::mutex mutex;
+    static std::shared_ptr<const double> cache[RADON_CACHE_SIZE];
+    static int cache_n[RADON_CACHE_SIZE];
+
+    if (N <= 0)
+        return NULL;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    int slot = RADON_CACHE_SIZE - 1;
+    for (int i = 0; i < RADON_CACHE_SIZE; i++) {
+        if (cache[i] && cache_n[i] == N)
+            return cache[i];
+        if (!cache[i] && slot == RADON_CACHE_SIZE - 1)
+            slot = i;
+    }
+
+    double *table = (double *)malloc((size_t)PH_RADIAL_COEFFS * N * sizeof(double));
+    if (!table)
+        return NULL;
+    const double PI_2N = cimg::PI / (2 * N);
+    for (int k = 0; k < PH_RADIAL_COEFFS; ++k) {
+        for (int n = 0; n < N; ++n) {
+            table[k * N + n] = cos(PI_2N * (2 * n + 1) * k);
+        }
+    }
+    cache[slot] = std::shared_ptr<const double>(table, ph_radon_dct_table_free);
+    cache_n[slot] = N;
+    return cache[slot];
+}
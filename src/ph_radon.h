@@ -0,0 +1,79 @@
+/*
+
+    pHash, the open source perceptual hash library
+    Copyright (C) 2009 Aetilius, Inc.
+    All rights reserved.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Evan Klinger - eklinger@phash.org
+    D Grant Starkweather - dstarkweather@phash.org
+
+*/
+
+
+#ifndef _PH_RADON_H
+#define _PH_RADON_H
+
+#include <memory>
+
+#include "pHash.h"
+
+#define PH_RADIAL_COEFFS 40 /* number of digest coefficients */
+
+/* /brief sampling geometry of the radon projections of one image size
+ *  For every projection line, the offsets of the pixels ph_radon_projections
+ *  leaves in the projection map, and the number of pixels it counts for the
+ *  line (a pixel overwritten by a later line is counted but not summed).
+ */
+typedef struct ph_radon_geometry {
+    int width;
+    int height;
+    int N;
+    int *line_start; /* N + 1 indexes into offsets */
+    int *offsets;    /* y * width + x */
+    int *nb_pix_perline;
+} RadonGeometry;
+
+/* /brief geometry for an image size and number of lines
+ *  The last few geometries are cached, batches of same size images build
+ *  the tables once. Safe to call from several threads.
+ *  /return shared geometry, NULL for error
+ */
+std::shared_ptr<const RadonGeometry> ph_radon_geometry(int width, int height, int N);
+
+/* /brief radon feature vector without a projection map
+ *  Gives the same features as ph_radon_projections followed by
+ *  ph_feature_vector, summing each line straight from the image.
+ *  /param img - single channel image
+ *  /param N   - int number of angled lines to consider
+ *  /param fv  - (out) Features, features malloc'ed
+ *  /return int value - less than 0 for error
+ */
+int ph_radon_features(const CImg<uint8_t> &img, int N, Features &fv);
+
+/* /brief normalize raw line variances to zero mean and unit variance
+ *  /param features - N line variances, normalized in place
+ *  /param N        - number of lines
+ */
+void ph_feature_normalize(double *features, int N);
+
+/* /brief cosine table of the digest dct
+ *  table[k * N + n] = cos(PI / (2 * N) * (2 * n + 1) * k) for the
+ *  PH_RADIAL_COEFFS digest coefficients, cached per N.
+ *  /return shared table, NULL for error
+ */
+std::shared_ptr<const double> ph_radon_dct_table(int N);
+
+#endif /* _PH_RADON_H */
@@ -0,0 +1,174 @@
+/*
+
+    pHash, the open source perceptual hash library
+    Copyright (C) 2009 Aetilius, Inc.
+    All rights reserved.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Evan Klinger - eklinger@phash.org
+    D Grant Starkweather - dstarkweather@phash.org
+
+*/
+
+#ifndef _PH_SIMD_H
+#define _PH_SIMD_H
+
+/* x86 SIMD helpers shared by the internal kernels. The kernels are compiled
+ * for the baseline target and the wider paths are selected at runtime, so the
+ * library never requires -mavx2 or similar flags. */
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PH_SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(PH_SIMD_X86) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define PH_SIMD_SSE2 1
+#endif
+
+#if defined(PH_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+#define PH_TARGET_AVX2 __attribute__((target("avx2")))
+#define PH_SIMD_AVX2   1
+#elif defined(PH_SIMD_X86) && defined(_MSC_VER)
+#define PH_TARGET_AVX2
+#define PH_SIMD_AVX2 1
+#endif
+
+#if defined(PH_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+#define PH_TARGET_POPCNT __attribute__((target("popcnt")))
+#define PH_SIMD_POPCNT   1
+#endif
+
+/* AVX-512 VPOPCNTQ needs gcc 7 / clang 5 / msvc 2019 intrinsics */
+#if defined(PH_SIMD_X86) && ((defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 7) || \
+                             (defined(__clang__) && __clang_major__ >= 5))
+#define PH_TARGET_AVX512_POPCNT __attribute__((target("avx512f,avx512vpopcntdq,popcnt")))
+#define PH_SIMD_AVX512_POPCNT   1
+#elif defined(PH_SIMD_X86) && defined(_MSC_VER) && _MSC_VER >= 1920
+#define PH_TARGET_AVX512_POPCNT
+#define PH_SIMD_AVX512_POPCNT 1
+#endif
+
+#ifdef PH_SIMD_X86
+#if defined(_MSC_VER)
+static inline void ph_cpuid(int leaf, int subleaf, int regs[4]) {
+    __cpuidex(regs, leaf, subleaf);
+}
+
+static inline unsigned long long ph_xgetbv() {
+    return _xgetbv(0);
+}
+#else
+#include <cpuid.h>
+static inline void ph_cpuid(int leaf, int subleaf, int regs[4]) {
+    unsigned int a, b, c, d;
+    __cpuid_count(leaf, subleaf, a, b, c, d);
+    regs[0] = (int)a;
+    regs[1] = (int)b;
+    regs[2] = (int)c;
+    regs[3] = (int)d;
+}
+
+static inline unsigned long long ph_xgetbv() {
+    unsigned int lo, hi;
+    __asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((unsigned long long)hi << 32) | lo;
+}
+#endif
+#endif
+
+/** /brief number of bits set in a 64-bit word, for the scalar paths
+ **/
+static inline int ph_popcount64(unsigned long long x) {
+#ifdef _MSC_VER
+    x -= (x >> 1) & 0x5555555555555555ULL;
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return int((x * 0x0101010101010101ULL) >> 56);
+#else
+    return __builtin_popcountll(x);
+#endif
+}
+
+/** /brief check for AVX2 support by both the cpu and the os
+ *  /return int 1 for supported, 0 otherwise
+ **/
+static inline int ph_cpu_has_avx2() {
+#ifdef PH_SIMD_X86
+    static const int has_avx2 = []() {
+        int regs[4];
+        ph_cpuid(0, 0, regs);
+        if (regs[0] < 7)
+            return 0;
+        ph_cpuid(1, 0, regs);
+        const int osxsave = (regs[2] >> 27) & 1;
+        const int avx = (regs[2] >> 28) & 1;
+        if (!osxsave || !avx || (ph_xgetbv() & 0x06) != 0x06)
+            return 0;
+        ph_cpuid(7, 0, regs);
+        return (regs[1] >> 5) & 1;
+    }();
+    return has_avx2;
+#else
+    return 0;
+#endif
+}
+
+/** /brief check for the POPCNT instruction
+ *  /return int 1 for supported, 0 otherwise
+ **/
+static inline int ph_cpu_has_popcnt() {
+#ifdef PH_SIMD_X86
+    static const int has_popcnt = []() {
+        int regs[4];
+        ph_cpuid(1, 0, regs);
+        return (regs[2] >> 23) & 1;
+    }();
+    return has_popcnt;
+#else
+    return 0;
+#endif
+}
+
+/** /brief check for AVX-512F with VPOPCNTQ support by both the cpu and the os
+ *  /return int 1 for supported, 0 otherwise
+ **/
+static inline int ph_cpu_has_avx512_popcnt() {
+#ifdef PH_SIMD_X86
+    static const int has_popcnt = []() {
+        int regs[4];
+        ph_cpuid(0, 0, regs);
+        if (regs[0] < 7)
+            return 0;
+        ph_cpuid(1, 0, regs);
+        const int osxsave = (regs[2] >> 27) & 1;
+        /* xmm, ymm, opmask and both halves of zmm state */
+        if (!osxsave || (ph_xgetbv() & 0xe6) != 0xe6)
+            return 0;
+        ph_cpuid(7, 0, regs);
+        const int avx512f = (regs[1] >> 16) & 1;
+        const int vpopcntdq = (regs[2] >> 14) & 1;
+        return (avx512f && vpopcntdq) ? 1 : 0;
+    }();
+    return has_popcnt;
+#else
+    return 0;
+#endif
+}
+
+#endif /* _PH_SIMD_H */
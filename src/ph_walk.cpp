@@ -0,0 +1,273 @@
+/*
+
+    pHash, the open source perceptual hash library
+    Copyright (C) 2009 Aetilius, Inc.
+    All rights reserved.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Evan Klinger - eklinger@phash.org
+    D Grant Starkweather - dstarkweather@phash.org
+
+*/
+
+
+#include "pHash.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef HAVE_DIRENT_H
+#include <dirent.h>
+#else
+#include "win/dirent.h"
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>
+#define WALK_STATAT 1 /* stat entries relative to their open directory */
+#endif
+
+#define WALK_THREADS 4    /* threads listing directories */
+#define WALK_QUEUE   4096 /* paths found and not taken yet */
+#define WALK_BATCH   64   /* paths a lister hands over at once */
+
+struct ph_walker {
+    std::vector<std::string> extensions; /* lower case, without the dot */
+    size_t min_size;
+    size_t max_size;
+    std::mutex lock;
+    std::condition_variable dirs_cv;  /* a directory to list, or the walk ended */
+    std::condition_variable found_cv; /* a path to take, or the walk ended */
+    std::condition_variable room_cv;  /* room among the paths found */
+    std::vector<char *> dirs;         /* directories to list, the last first so the list stays short */
+    int listing;                      /* directories being listed */
+    std::deque<char *> found;
+    bool stop;
+    char *current; /* path last returned by ph_walk_next */
+    std::vector<std::thread> thds;
+};
+
+static bool ph_walk_done(Walker *w) {
+    return w->stop || (w->dirs.empty() && w->listing == 0);
+}
+
+static char *ph_walk_join(const char *dir, const char *name) {
+    const size_t dlen = strlen(dir), nlen = strlen(name);
+    const bool slash = dlen > 0 && (dir[dlen - 1] == '/' || dir[dlen - 1] == '\\');
+    char *path = (char *)malloc(dlen + nlen + 2);
+    if (!path)
+        return NULL;
+    memcpy(path, dir, dlen);
+    if (!slash)
+        path[dlen] = '/';
+    memcpy(path + dlen + (slash ? 0 : 1), name, nlen + 1);
+    return path;
+}
+
+static bool ph_walk_extension_ok(Walker *w, const char *name) {
+    if (w->extensions.empty())
+        return true;
+    const char *dot = strrchr(name, '.');
+    if (!dot)
+        return false;
+    std::string ext(dot + 1);
+    for (size_t i = 0; i < ext.size(); i++)
+        ext[i] = (char)tolower((unsigned char)ext[i]);
+    for (size_t i = 0; i < w->extensions.size(); i++) {
+        if (w->extensions[i] == ext)
+            return true;
+    }
+    return false;
+}
+
+/* hand paths to ph_walk_next, waiting for room; false once stopped */
+static bool ph_walk_flush(Walker *w, std::vector<char *> &paths) {
+    std::unique_lock<std::mutex> lock(w->lock);
+    size_t i = 0;
+    while (i < paths.size()) {
+        w->room_cv.wait(lock, [w] { return w->stop || w->found.size() < WALK_QUEUE; });
+        if (w->stop)
+            break;
+        for (; i < paths.size() && w->found.size() < WALK_QUEUE; i++)
+            w->found.push_back(paths[i]);
+        w->found_cv.notify_all();
+    }
+    for (; i < paths.size(); i++)
+        free(paths[i]);
+    paths.clear();
+    return !w->stop;
+}
+
+/* list one directory: subdirectories go back on the list, files passing the
+ * filters to ph_walk_next. The entry type comes from d_type, the file system
+ * is only asked for a stat when it does not say or a size filter needs it,
+ * and then relative to the open directory. Links are not followed. */
+static void ph_walk_list(Walker *w, const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d)
+        return;
+    const bool want_size = w->min_size > 0 || w->max_size > 0;
+    std::vector<char *> paths, subdirs;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        const char *name = e->d_name;
+        if (!strcmp(name, ".") || !strcmp(name, ".."))
+            continue;
+        int type = e->d_type;
+        if (type != DT_DIR && type != DT_UNKNOWN && (type != DT_REG || !ph_walk_extension_ok(w, name)))
+            continue;
+
+        struct stat st;
+        char *path = NULL;
+        if (type == DT_UNKNOWN || (type == DT_REG && want_size)) {
+#ifdef WALK_STATAT
+            if (fstatat(dirfd(d), name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+                continue;
+#else
+            path = ph_walk_join(dir, name);
+            if (!path || stat(path, &st) != 0) {
+                free(path);
+                continue;
+            }
+#endif
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+            if (type == DT_UNKNOWN || (type == DT_REG && !ph_walk_extension_ok(w, name))) {
+                free(path);
+                continue;
+            }
+            if (type == DT_REG && ((w->min_size > 0 && (size_t)st.st_size < w->min_size) ||
+                                   (w->max_size > 0 && (size_t)st.st_size > w->max_size))) {
+                free(path);
+                continue;
+            }
+        }
+        if (!path && !(path = ph_walk_join(dir, name)))
+            continue;
+        if (type == DT_DIR) {
+            subdirs.push_back(path);
+        } else {
+            paths.push_back(path);
+            if (paths.size() >= WALK_BATCH && !ph_walk_flush(w, paths))
+                break;
+        }
+    }
+    closedir(d);
+
+    if (!subdirs.empty()) {
+        std::lock_guard<std::mutex> lock(w->lock);
+        w->dirs.insert(w->dirs.end(), subdirs.rbegin(), subdirs.rend());
+        w->dirs_cv.notify_all();
+    }
+    ph_walk_flush(w, paths);
+}
+
+static void ph_walk_thread(Walker *w) {
+    std::unique_lock<std::mutex> lock(w->lock);
+    for (;;) {
+        w->dirs_cv.wait(lock, [w] { return !w->dirs.empty() || ph_walk_done(w); });
+        if (w->stop || w->dirs.empty())
+            break;
+        char *dir = w->dirs.back();
+        w->dirs.pop_back();
+        w->listing++;
+        lock.unlock();
+        ph_walk_list(w, dir);
+        free(dir);
+        lock.lock();
+        w->listing--;
+    }
+    // wake the other listers and ph_walk_next to see the end
+    w->dirs_cv.notify_all();
+    w->found_cv.notify_all();
+}
+
+Walker *ph_walk_open(const char *dirname, const WalkOptions *opts) {
+    struct stat st;
+    if (!dirname || stat(dirname, &st) != 0 || !S_ISDIR(st.st_mode))
+        return NULL;
+    char *root = strdup(dirname);
+    if (!root)
+        return NULL;
+
+    Walker *w = new Walker;
+    w->min_size = opts ? opts->min_size : 0;
+    w->max_size = opts ? opts->max_size : 0;
+    if (opts && opts->extensions) {
+        // "jpg,.PNG, tif" -> jpg png tif
+        for (const char *p = opts->extensions; *p;) {
+            const char *end = p + strcspn(p, ",");
+            std::string ext;
+            for (const char *c = p; c < end; c++) {
+                if (!isspace((unsigned char)*c) && !(ext.empty() && *c == '.'))
+                    ext += (char)tolower((unsigned char)*c);
+            }
+            if (!ext.empty())
+                w->extensions.push_back(ext);
+            p = *end ? end + 1 : end;
+        }
+    }
+    w->dirs.push_back(root);
+    w->listing = 0;
+    w->stop = false;
+    w->current = NULL;
+    const int threads = (opts && opts->threads > 0) ? opts->threads : WALK_THREADS;
+    for (int i = 0; i < threads; i++)
+        w->thds.emplace_back(ph_walk_thread, w);
+    return w;
+}
+
+const char *ph_walk_next(Walker *w) {
+    if (!w)
+        return NULL;
+    std::unique_lock<std::mutex> lock(w->lock);
+    free(w->current);
+    w->current = NULL;
+    w->found_cv.wait(lock, [w] { return !w->found.empty() || ph_walk_done(w); });
+    if (w->found.empty() || w->stop)
+        return NULL;
+    w->current = w->found.front();
+    w->found.pop_front();
+    w->room_cv.notify_one();
+    return w->current;
+}
+
+void ph_walk_close(Walker *w) {
+    if (!w)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(w->lock);
+        w->stop = true;
+        w->dirs_cv.notify_all();
+        w->room_cv.notify_all();
+        w->found_cv.notify_all();
+    }
+    for (std::thread &t : w->thds)
+        t.join();
+    for (char *dir : w->dirs)
+        free(dir);
+    for (char *path : w->found)
+        free(path);
+    free(w->current);
+    delete w;
+}
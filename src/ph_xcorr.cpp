@@ -0,0 +1,182 @@
+/*
+
+    pHash, the open source perceptual hash library
+    Copyright (C) 2009 Aetilius, Inc.
+    All rights reserved.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Evan Klinger - eklinger@phash.org
+    D Grant Starkweather - dstarkweather@phash.org
+
+*/
+
+
+#include "pHash.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "ph_simd.h"
+
+#define XCORR_LANES 8 /* shifts are padded to a multiple of the widest vector */
+
+/* r[d] += y[j] * xx[j + d] for rows j0..j1-1 and all npad shifts. Every path
+ * adds the rows in the same order, without fma, so they agree exactly. */
+#ifdef PH_SIMD_SSE2
+static void ph_xcorr_rows_sse2(const float *xx, const float *y, int j0, int j1, float *r, int npad) {
+    for (int d = 0; d < npad; d += 4) {
+        __m128 acc = _mm_loadu_ps(r + d);
+        for (int j = j0; j < j1; j++) {
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(y[j]), _mm_loadu_ps(xx + j + d)));
+        }
+        _mm_storeu_ps(r + d, acc);
+    }
+}
+#else
+static void ph_xcorr_rows_scalar(const float *xx, const float *y, int j0, int j1, float *r, int npad) {
+    for (int j = j0; j < j1; j++) {
+        const float yj = y[j];
+        const float *xs = xx + j;
+        for (int d = 0; d < npad; d++) {
+            r[d] += yj * xs[d];
+        }
+    }
+}
+#endif
+
+#ifdef PH_SIMD_AVX2
+PH_TARGET_AVX2 static void ph_xcorr_rows_avx2(const float *xx, const float *y, int j0, int j1, float *r, int npad) {
+    for (int d = 0; d < npad; d += 8) {
+        __m256 acc = _mm256_loadu_ps(r + d);
+        for (int j = j0; j < j1; j++) {
+            acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(y[j]), _mm256_loadu_ps(xx + j + d)));
+        }
+        _mm256_storeu_ps(r + d, acc);
+    }
+}
+#endif
+
+typedef void (*ph_xcorr_func)(const float *, const float *, int, int, float *, int);
+
+static ph_xcorr_func ph_xcorr_select() {
+#ifdef PH_SIMD_AVX2
+    if (ph_cpu_has_avx2())
+        return ph_xcorr_rows_avx2;
+#endif
+#ifdef PH_SIMD_SSE2
+    return ph_xcorr_rows_sse2;
+#else
+    return ph_xcorr_rows_scalar;
+#endif
+}
+
+int ph_normalize_digest(const Digest &digest, NormDigest &norm) {
+    norm.coeffs = NULL;
+    norm.size = 0;
+    const int N = digest.size;
+    if (!digest.coeffs || N <= 0)
+        return -1;
+
+    norm.coeffs = (float *)malloc(N * sizeof(float));
+    if (!norm.coeffs)
+        return -1;
+    norm.size = N;
+
+    double sum = 0.0;
+    for (int i = 0; i < N; i++) {
+        sum += digest.coeffs[i];
+    }
+    const double mean = sum / N;
+    double den = 0.0;
+    for (int i = 0; i < N; i++) {
+        den += (digest.coeffs[i] - mean) * (digest.coeffs[i] - mean);
+    }
+    /* a constant digest correlates with nothing, ph_crosscorr gives it 0 as well */
+    const double scale = (den > 0.0) ? 1.0 / sqrt(den) : 0.0;
+    for (int i = 0; i < N; i++) {
+        norm.coeffs[i] = (float)((digest.coeffs[i] - mean) * scale);
+    }
+    return 0;
+}
+
+void ph_free_normalized_digest(NormDigest &norm) {
+    free(norm.coeffs);
+    norm.coeffs = NULL;
+    norm.size = 0;
+}
+
+int ph_crosscorr_many(const NormDigest &query, const NormDigest *candidates, int count, double *pcc, int *shift,
+                      double threshold, int early_out) {
+    static const ph_xcorr_func rows = ph_xcorr_select();
+
+    const int N = query.size;
+    if (!query.coeffs || N <= 0 || count < 0 || (count > 0 && (!candidates || !pcc || !shift)))
+        return -1;
+
+    /* the query repeated so that every circular shift is a contiguous run */
+    const int npad = (N + XCORR_LANES - 1) / XCORR_LANES * XCORR_LANES;
+    std::vector<float> xx(N + npad);
+    for (int k = 0; k < N + npad; k++) {
+        xx[k] = query.coeffs[k % N];
+    }
+    std::vector<float> r(npad);
+
+    /* the bound is too loose to reject much before three quarters of the rows
+     * and a check costs about as much as a few rows, so check once there */
+    const int jc = early_out ? (3 * N + 3) / 4 : N;
+
+    int nb_matches = 0;
+    for (int m = 0; m < count; m++) {
+        const NormDigest &cand = candidates[m];
+        pcc[m] = 0.0;
+        shift[m] = -1;
+        if (!cand.coeffs || cand.size != N)
+            continue;
+
+        std::fill(r.begin(), r.end(), 0.0f);
+        rows(xx.data(), cand.coeffs, 0, jc, r.data(), npad);
+        if (jc < N) {
+            /* the rows left can add at most the norm of the rest of the
+             * candidate to any shift (cauchy-schwarz, the query has norm 1) */
+            float rest = 0.0f;
+            for (int j = jc; j < N; j++) {
+                rest += cand.coeffs[j] * cand.coeffs[j];
+            }
+            float peak = r[0];
+            for (int d = 1; d < N; d++) {
+                peak = (r[d] > peak) ? r[d] : peak;
+            }
+            if (peak + sqrt(rest) + 1e-5 <= threshold) {
+                pcc[m] = peak;
+                continue;
+            }
+            rows(xx.data(), cand.coeffs, jc, N, r.data(), npad);
+        }
+
+        int best = 0;
+        for (int d = 1; d < N; d++) {
+            if (r[d] > r[best])
+                best = d;
+        }
+        pcc[m] = r[best];
+        shift[m] = best;
+        if (pcc[m] > threshold)
+            nb_matches++;
+    }
+    return nb_matches;
+}